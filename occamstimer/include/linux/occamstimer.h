@@ -1,6 +1,24 @@
 #ifndef OCCAMSTIMER_H
 #define OCCAMSTIMER_H
 
+/*
+ * Intervals are a struct __kernel_timespec, which has 64 bit seconds
+ * on every ABI and is what the kernel has taken from users since
+ * struct timespec was removed from it. Users fill in its tv_sec and
+ * tv_nsec rather than assigning a struct timespec to it.
+ */
+#include <linux/time_types.h>
+
+/*
+ * The vectored add_work takes an array of struct iovec. Users get it
+ * from the C library's header, since <linux/uio.h> defines it again
+ * unguarded and so cannot be included alongside <sys/uio.h>.
+ */
+#ifdef __KERNEL__
+#include <linux/uio.h>
+#else
+#include <sys/uio.h>
+#endif /* __KERNEL__ */
 
 
 /* 
@@ -15,6 +33,12 @@
 /* The maximum buffer size of each work packet  */
 #define OT_MAX_WORK_SIZE 1024 /* 1 kb */
 
+/* The maximum number of work packets added by one batch IOCTL call */
+#define OT_MAX_WORK_BATCH 64
+
+/* The maximum number of fragments gathered into one work packet */
+#define OT_MAX_WORK_IOV 16
+
 
 
 /**
@@ -71,7 +95,9 @@ enum occamstimer_action {
  * 
  * Note that we also define that we also define the OCCAMSTIMER_DEBUG
  * statement is used in place of printk to include narrative debug
- * statements in the datastream output.
+ * statements in the datastream output. Without DSKI they are
+ * pr_debug() messages, which cost nothing unless dynamic debug turns
+ * them on.
  */
 #ifdef CONFIG_KUSP_OCCAMSTIMER_DSKI
 #include <linux/kusp/dski.h>
@@ -80,7 +106,7 @@ enum occamstimer_action {
 #define OT_INFO(info) DSTRM_DEBUG(OCCAMSTIMER, DEBUG, "[%d] %s\n", __line__, info)
 #else
 #define OT_DEBUG(fmt, args...) \
-	printk(strcat(strcat("[OCCAMSTIMER:%d] ", fmt), "\n"), __LINE__, ##args)
+	pr_debug("[OCCAMSTIMER:%d] " fmt "\n", __LINE__, ##args)
 
 #define OT_EVENT(ename) OT_DEBUG(#ename)
 #define OT_INFO(info) OT_DEBUG(info)
@@ -120,14 +146,26 @@ enum occamstimer_attr_cmd {
  */
 
 /*
- * A helper struct that will store the two parameters for the
- * "add_work" ioctl call. We do this so that we can keep a general
- * format for each type of IOCTL call by continuing to use "cmd" and
- * "value" attribtues at the top level.
+ * A helper struct that will store the parameters for the "add_work"
+ * ioctl call. We do this so that we can keep a general format for
+ * each type of IOCTL call by continuing to use "cmd" and "value"
+ * attribtues at the top level.
+ *
+ * @length: The number of bytes of @data, which may include NULs when
+ *          the work was gathered by the vectored "add_work" call.
+ *          The kernel always terminates @data at @length as well.
+ *
+ * @cookie: The user's own id for the workitem, handed back unchanged
+ *          by "get_work". With more than one workqueue workitems may
+ *          complete in another order than they were added in, so a
+ *          user that matches completions to its submissions must do
+ *          it by cookie rather than by order.
  */
 struct occamstimer_ioctl_work_params {
 	char                          data[OT_MAX_WORK_SIZE];
-	struct timespec               exec_int;
+	struct __kernel_timespec      exec_int;
+	unsigned int                  length;
+	unsigned long long            cookie;
 };
 
 typedef struct occamstimer_ioctl_work_s {
@@ -136,6 +174,80 @@ typedef struct occamstimer_ioctl_work_s {
 } occamstimer_ioctl_work_t;
 
 
+/*
+ * Describes one workitem of a batch "add_work" IOCTL call. Unlike
+ * struct occamstimer_ioctl_work_params the payload is not embedded,
+ * so the kernel copies each payload exactly once from wherever the
+ * user has it, straight into the new workitem.
+ *
+ * @data: The NUL terminated work, shorter than OT_MAX_WORK_SIZE.
+ *
+ * @exec_int: The simulated execution interval of the work.
+ *
+ * @cookie: Returned with the completed work, as for struct
+ *          occamstimer_ioctl_work_params.
+ */
+struct occamstimer_work_desc {
+	const char                    *data;
+	struct __kernel_timespec      exec_int;
+	unsigned long long            cookie;
+};
+
+/*
+ * The batch "add_work" IOCTL call adds @count workitems described by
+ * @value to the pending queue under a single acquisition of the
+ * queue lock. Either every workitem is added or none are.
+ */
+typedef struct occamstimer_ioctl_batch_s {
+	enum occamstimer_attr_cmd             cmd;
+	unsigned int                          count;
+	const struct occamstimer_work_desc    *value;
+} occamstimer_ioctl_batch_t;
+
+
+/*
+ * The vectored "add_work" IOCTL call gathers the @iovcnt fragments at
+ * @iov, at most OT_MAX_WORK_IOV of them, into the payload of one new
+ * workitem. The payload is taken as bytes rather than a string, so
+ * it may contain NULs, but all of it must fit in OT_MAX_WORK_SIZE - 1
+ * bytes. @cookie is returned with the completed work.
+ */
+typedef struct occamstimer_ioctl_workv_s {
+	enum occamstimer_attr_cmd             cmd;
+	unsigned int                          iovcnt;
+	const struct iovec                    *iov;
+	struct __kernel_timespec              exec_int;
+	unsigned long long                    cookie;
+} occamstimer_ioctl_workv_t;
+
+
+/*
+ * The command area of an IORING_OP_URING_CMD submission to the
+ * device. The SQE's cmd_op is one of the IOCTL numbers below and @arg
+ * the address of the argument struct that IOCTL call takes. A
+ * get_work command waits for completed work instead of failing with
+ * -EAGAIN.
+ */
+struct occamstimer_uring_cmd {
+	unsigned long long                    arg;
+};
+
+
+/*
+ * The page a user maps read only from the device with mmap(2) at
+ * offset 0, to watch for completions without a system call.
+ *
+ * @completed: The number of workitems the device has put on its done
+ *             queue since it was loaded. It is advanced after each
+ *             one is there, so a reader that sees it change will find
+ *             a workitem with get_work, unless another reader took
+ *             it first.
+ */
+struct occamstimer_seq_page {
+	unsigned long long                    completed;
+};
+
+
 typedef struct occamstimer_ioctl_status_s {
 	enum occamstimer_attr_cmd     cmd;
 	enum occamstimer_status       value;
@@ -148,17 +260,75 @@ typedef struct occamstimer_ioctl_action_s {
 
 } occamstimer_ioctl_action_t;
 
-/* 
- * This generic union allows us to make a more generic IOCTRL call
- * interface. Each per-IOCTL-flavor struct should be a member of this
- * union.
+
+/*
+ * The "eventfd" IOCTL call (OT_ATTR_SET) registers the eventfd @value
+ * to be signalled when completed work is waiting, or with -1
+ * unregisters it. One eventfd may be registered with the device at a
+ * time, by one open file, and it is unregistered when that file is
+ * closed.
+ *
+ * Signals are coalesced. After it is signalled the eventfd is not
+ * signalled again until a get_work call has found no completed work,
+ * so a reader should read the eventfd and then take work until
+ * get_work fails with EAGAIN. The count read is a number of wakeups,
+ * not of workitems.
+ */
+typedef struct occamstimer_ioctl_eventfd_s {
+	enum occamstimer_attr_cmd    cmd;
+	int                          value;
+} occamstimer_ioctl_eventfd_t;
+
+
+/*
+ * The "inline" IOCTL call gets or sets the inline threshold @value,
+ * in nanoseconds and less than a second. Workitems whose exec_int is
+ * less than it are serviced as soon as they reach the front of the
+ * pending queue, without programming the timer, since for them the
+ * timer interrupt costs more than the interval it simulates. It is 0,
+ * disabled, when the device is loaded.
  */
-typedef union occamstimer_ioctl_param_u {
-	occamstimer_ioctl_work_t          work;
-	occamstimer_ioctl_status_t        status;
-	occamstimer_ioctl_action_t        action;
-} occamstimer_ioctl_param_union;
+typedef struct occamstimer_ioctl_inline_s {
+	enum occamstimer_attr_cmd    cmd;
+	unsigned int                 value;
+} occamstimer_ioctl_inline_t;
+
 
+/*
+ * The counts of serviced workitems that the "stats" IOCTL call gets,
+ * since the device was loaded, summed over its workqueues.
+ *
+ * @serviced_timer: Serviced when the timer expired.
+ *
+ * @serviced_inline: Serviced inline, below the inline threshold.
+ *
+ * @serviced_remote: Of those, the ones serviced on a CPU of another
+ *                   NUMA node than the one the workitem was allocated
+ *                   on.
+ *
+ * @steals: How many times a workqueue that ran out of work took some
+ *          from a sibling.
+ *
+ * @stolen: The workitems taken that way.
+ *
+ * @imbalance_max: The most workitems found pending on a sibling by a
+ *                 workqueue with none, i.e. the worst backlog seen
+ *                 while a workqueue sat idle. This is the largest of
+ *                 the workqueues' rather than the sum.
+ */
+struct occamstimer_stats {
+	unsigned long long           serviced_timer;
+	unsigned long long           serviced_inline;
+	unsigned long long           serviced_remote;
+	unsigned long long           steals;
+	unsigned long long           stolen;
+	unsigned long long           imbalance_max;
+};
+
+typedef struct occamstimer_ioctl_stats_s {
+	enum occamstimer_attr_cmd    cmd;
+	struct occamstimer_stats     value;
+} occamstimer_ioctl_stats_t;
 
 /* 
  * Used by _IOW to create the unique IOCTL call numbers. It appears
@@ -180,5 +350,15 @@ typedef union occamstimer_ioctl_param_u {
 	_IOW(OCCAMSTIMER_MAGIC, 2, occamstimer_ioctl_status_t)
 #define OCCAMSTIMER_IOCTL_ACTION \
 	_IOW(OCCAMSTIMER_MAGIC, 3, occamstimer_ioctl_action_t)
+#define OCCAMSTIMER_IOCTL_BATCH \
+	_IOW(OCCAMSTIMER_MAGIC, 4, occamstimer_ioctl_batch_t)
+#define OCCAMSTIMER_IOCTL_WORKV \
+	_IOW(OCCAMSTIMER_MAGIC, 5, occamstimer_ioctl_workv_t)
+#define OCCAMSTIMER_IOCTL_EVENTFD \
+	_IOW(OCCAMSTIMER_MAGIC, 6, occamstimer_ioctl_eventfd_t)
+#define OCCAMSTIMER_IOCTL_INLINE \
+	_IOW(OCCAMSTIMER_MAGIC, 7, occamstimer_ioctl_inline_t)
+#define OCCAMSTIMER_IOCTL_STATS \
+	_IOW(OCCAMSTIMER_MAGIC, 8, occamstimer_ioctl_stats_t)
 
 #endif /* OCCAMSTIMER_H */
@@ -1,13 +1,20 @@
 #ifndef LIBOCCAMSTIMER_H
 #define LIBOCCAMSTIMER_H
 
+#include <sys/uio.h>
 #include <linux/occamstimer.h>
 
 extern int occamstimer_open(void);
 extern int occamstimer_close(int fd);
 
 extern int occamstimer_add_work(int fd, char *data, struct timespec *exec_int);
+extern int occamstimer_add_work_batch(int fd, const struct occamstimer_work_desc *work,
+				      unsigned int count);
+extern int occamstimer_add_workv(int fd, const struct iovec *iov, int iovcnt,
+				 const struct timespec *exec_int);
 extern int occamstimer_get_work(int fd, char *data);
+extern int occamstimer_get_work_cookie(int fd, char *data, unsigned long long *cookie);
+extern int occamstimer_get_work_len(int fd, void *data, size_t *length);
 
 extern int occamstimer_get_status(int fd, enum occamstimer_status *status);
 extern int occamstimer_set_status(int fd, enum occamstimer_status status);
@@ -15,6 +22,82 @@ extern int occamstimer_set_status(int fd, enum occamstimer_status status);
 extern int occamstimer_start_device(int fd);
 extern int occamstimer_pause_device(int fd);
 
+extern int occamstimer_set_eventfd(int fd, int efd);
+
+extern int occamstimer_set_inline(int fd, unsigned int inline_ns);
+extern int occamstimer_get_inline(int fd, unsigned int *inline_ns);
+extern int occamstimer_get_stats(int fd, struct occamstimer_stats *stats);
+
+
+/*
+ * Asynchronous submission. A context batches the workitems submitted
+ * to it and calls each one's callback when the device completes it,
+ * from occamstimer_ctx_process(). Nothing blocks, so one thread can
+ * keep any number of workitems in flight from its event loop:
+ *
+ *	while (occamstimer_ctx_inflight(ctx)) {
+ *		epoll_wait(epfd, events, n, occamstimer_ctx_timeout(ctx));
+ *		...
+ *		occamstimer_ctx_process(ctx);
+ *	}
+ *
+ * @data is the completed work, or NULL with a negative errno in
+ * @status if the workitem could not be added to the device. That is
+ * the only place a failed submission is reported: once
+ * occamstimer_ctx_submit() has returned 0 for a workitem, its
+ * callback is always called, and occamstimer_ctx_flush() and
+ * occamstimer_ctx_process() return the number of workitems they added
+ * or completed rather than the errno. occamstimer_ctx_submit() only
+ * fails, with a negative errno, for a workitem it did not queue, whose
+ * callback is never called.
+ */
+struct occamstimer_ctx;
+
+typedef void (*occamstimer_done_fn)(struct occamstimer_ctx *ctx, const char *data,
+				    int status, void *arg);
+
+extern struct occamstimer_ctx *occamstimer_ctx_create(int fd);
+extern void occamstimer_ctx_destroy(struct occamstimer_ctx *ctx);
+
+extern int occamstimer_ctx_submit(struct occamstimer_ctx *ctx, const char *data,
+				  const struct timespec *exec_int,
+				  occamstimer_done_fn done, void *arg);
+extern int occamstimer_ctx_flush(struct occamstimer_ctx *ctx);
+
+extern int occamstimer_ctx_timeout(struct occamstimer_ctx *ctx);
+extern long long occamstimer_ctx_timeout_ns(struct occamstimer_ctx *ctx);
+extern int occamstimer_ctx_process(struct occamstimer_ctx *ctx);
+extern unsigned int occamstimer_ctx_inflight(struct occamstimer_ctx *ctx);
+
+
+/*
+ * Waiting for completed work. For workitems of a few microseconds,
+ * sleeping until the device signals costs more than the work itself,
+ * so a waiter may instead spin on the completion sequence the device
+ * publishes in a shared page (struct occamstimer_seq_page), or spin
+ * for a while and then sleep:
+ *
+ *	w = occamstimer_waiter_create(fd, OT_WAIT_HYBRID, OT_WAIT_SPIN_NS);
+ *	while (...)
+ *		occamstimer_wait_work(w, data);
+ */
+enum occamstimer_wait_mode {
+	OT_WAIT_SPIN = 0,
+	OT_WAIT_HYBRID,
+	OT_WAIT_BLOCK,
+};
+
+/* A spin budget for OT_WAIT_HYBRID, a little over a context switch */
+#define OT_WAIT_SPIN_NS 20000
+
+struct occamstimer_waiter;
+
+extern struct occamstimer_waiter *occamstimer_waiter_create(int fd,
+							    enum occamstimer_wait_mode mode,
+							    long long spin_ns);
+extern void occamstimer_waiter_destroy(struct occamstimer_waiter *w);
+extern int occamstimer_wait_work(struct occamstimer_waiter *w, char *data);
+
 
 
 #endif /* LIBOCCAMSTIMER_H */
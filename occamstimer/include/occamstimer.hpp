@@ -0,0 +1,249 @@
+/*
+ * occamstimer.hpp - C++20 coroutines over liboccamstimer
+ *
+ * An executor multiplexes any number of coroutines over one device
+ * fd on one thread. Each coroutine submits work with
+ *
+ *	int status = co_await ot.submit("payload", interval);
+ *
+ * and is suspended until that workitem completes. Submissions are
+ * batched and completions dispatched by the asynchronous context of
+ * liboccamstimer (struct occamstimer_ctx), which finds each one's
+ * awaiter by its cookie. A device with several workqueues may
+ * complete work out of order, so coroutines need not resume in the
+ * order they submitted in.
+ *
+ * Awaiting does not allocate: the awaiter lives in the coroutine's
+ * frame, the payload is copied into the context's batch, and the
+ * context's ring of outstanding workitems and the executor's ready
+ * queue only grow until they fit the most work ever in flight. Only
+ * spawning a task allocates, for its frame.
+ */
+#ifndef LIBOCCAMSTIMER_HPP
+#define LIBOCCAMSTIMER_HPP
+
+#include <coroutine>
+#include <cerrno>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <time.h>
+
+extern "C" {
+#include <occamstimer.h>
+}
+
+namespace occamstimer {
+
+class executor;
+
+/**
+ * A coroutine run by an executor, started with executor::spawn().
+ * Its frame is freed when it returns.
+ */
+class task {
+public:
+	struct promise_type {
+		executor *exec = nullptr;
+
+		task get_return_object() {
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept;
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+
+	~task() {
+		if (handle_)
+			handle_.destroy();
+	}
+
+private:
+	friend class executor;
+
+	explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+	std::coroutine_handle<promise_type> release() {
+		return std::exchange(handle_, {});
+	}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+
+/**
+ * Runs tasks that submit work to one device. Everything, including
+ * the completion callbacks, happens on the thread calling run().
+ */
+class executor {
+public:
+	/**
+	 * The awaiter of one submission. It is queued on the
+	 * context with itself as the callback's argument, and put on
+	 * the ready queue when the workitem completes.
+	 */
+	class submit_awaiter {
+	public:
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(std::coroutine_handle<> handle) {
+			int ret;
+
+			handle_ = handle;
+			ret = occamstimer_ctx_submit(exec_.ctx_, data_, &interval_,
+						     &executor::on_done, this);
+
+			/* never queued, so on_done() will not be called */
+			if (ret < 0) {
+				status_ = ret;
+				return false;
+			}
+
+			return true;
+		}
+
+		int await_resume() const noexcept { return status_; }
+
+	private:
+		friend class executor;
+
+		submit_awaiter(executor &exec, const char *data,
+			       const struct timespec &interval)
+			: exec_(exec), data_(data), interval_(interval) {}
+
+		executor                 &exec_;
+		const char               *data_;
+		struct timespec          interval_;
+		std::coroutine_handle<>  handle_;
+		int                      status_ = 0;
+	};
+
+	explicit executor(int fd) : ctx_(occamstimer_ctx_create(fd)) {
+		if (!ctx_)
+			throw std::bad_alloc();
+	}
+
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	~executor() {
+		occamstimer_ctx_destroy(ctx_);
+	}
+
+	/**
+	 * Add the NUL terminated @data, to be serviced for @interval.
+	 * Awaiting the result suspends the caller until the workitem
+	 * has completed, and gives 0 or the negative errno it failed
+	 * with. @data is copied before the caller is suspended.
+	 */
+	submit_awaiter submit(const char *data, const struct timespec &interval) {
+		return submit_awaiter(*this, data, interval);
+	}
+
+	/**
+	 * Schedule @t to start on the next pass of run().
+	 */
+	void spawn(task &&t) {
+		auto handle = t.release();
+
+		handle.promise().exec = this;
+		live_++;
+		ready_.push_back(handle);
+	}
+
+	/**
+	 * Run until every spawned task has returned, sleeping
+	 * while nothing is ready.
+	 */
+	void run() {
+		int ret;
+
+		while (live_) {
+			/* resuming may make more ready, take them next pass */
+			running_.swap(ready_);
+			for (auto handle : running_)
+				handle.resume();
+			running_.clear();
+
+			if (!ready_.empty())
+				continue;
+
+			ret = occamstimer_ctx_process(ctx_);
+			if (ret < 0)
+				throw std::runtime_error("occamstimer: failed to reap work");
+
+			if (ret == 0 && ready_.empty() && live_)
+				wait();
+		}
+	}
+
+	/**
+	 * Size the ready queue for @count coroutines waiting at once,
+	 * so that it never grows while running.
+	 */
+	void reserve(size_t count) {
+		ready_.reserve(count);
+		running_.reserve(count);
+	}
+
+private:
+	friend struct task::promise_type;
+
+	static void on_done(struct occamstimer_ctx *, const char *, int status, void *arg) {
+		auto *awaiter = static_cast<submit_awaiter *>(arg);
+
+		awaiter->status_ = status;
+		awaiter->exec_.ready_.push_back(awaiter->handle_);
+	}
+
+	/**
+	 * Sleep until the oldest workitem is due, to the
+	 * nanosecond rather than poll()'s millisecond.
+	 */
+	void wait() {
+		long long        ns = occamstimer_ctx_timeout_ns(ctx_);
+		struct timespec  ts;
+
+		if (ns < 0)
+			return;
+
+		ts.tv_sec = ns / 1000000000LL;
+		ts.tv_nsec = ns % 1000000000LL;
+		ppoll(nullptr, 0, &ts, nullptr);
+	}
+
+	void task_done() {
+		live_--;
+	}
+
+	struct occamstimer_ctx                *ctx_;
+	std::vector<std::coroutine_handle<>>  ready_;
+	std::vector<std::coroutine_handle<>>  running_;
+	long                                  live_ = 0;
+};
+
+
+inline auto task::promise_type::final_suspend() noexcept {
+	struct finish {
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+			handle.promise().exec->task_done();
+			handle.destroy();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	return finish{};
+}
+
+} /* namespace occamstimer */
+
+#endif /* LIBOCCAMSTIMER_HPP */
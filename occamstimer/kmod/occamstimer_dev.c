@@ -0,0 +1,1452 @@
+/*
+ * occamstimer_dev.c - Example kmod utilizing HRTimers, and IOCTL
+ */
+#include <linux/err.h>
+#include <linux/cpumask.h>
+#include <linux/errno.h>
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/kernel.h>
+#include <linux/kobject.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h> 
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/time.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/spinlock_types.h>
+
+/* 
+ * This is a relative include which assumes that it is being compiled
+ * from $KUSPROOT/examples/kmods/occamstimer/kmod. Thus, the relative
+ * pathname referes the corresponding directory in the example source
+ * tree. 
+ * 
+ * The Makefile in the kernel code that is called by the Makefile for
+ * this module does not have an obvious way to set the
+ * C_INCLUDE_PATH. The kernel module Makefile seems to hardcode the
+ * include directory to be relative to the kernel area. Therefore, to
+ * be able to include the header file we created for this module I
+ * have been forced to use a relative pathname.
+ *
+ * If this module were installed to the system (via an RPM for
+ * example) this assertion would be false because the header file
+ * would be placed in the kernel include area.
+ */
+#include "../include/linux/occamstimer.h"
+#include "occamstimer_mq.h"
+
+
+/**
+ * The workqueues that service the device, nr_queues of them, each
+ * with its own timer. Work submitted on a CPU goes to one of them and
+ * the others steal from it if it backs up, see struct occamstimer_mq.
+ * With the default of one the device is serviced exactly as by a
+ * single workqueue. With more, workitems may complete out of the
+ * order they were added in. There can be at most one per possible
+ * CPU.
+ *
+ * The workqueue itself is implemented in occamstimer_queue.c, and the
+ * set of them in occamstimer_mq.c.
+ */
+static struct occamstimer_mq ot_mq;
+
+static unsigned int nr_queues = 1;
+module_param(nr_queues, uint, 0444);
+MODULE_PARM_DESC(nr_queues, "The number of workqueues servicing the device, at most one per CPU (default 1)");
+
+/**
+ * The page users map to watch ot_mq's completions, see struct
+ * occamstimer_seq_page. It is only written by the workqueues, which
+ * advance it atomically.
+ *
+ * There is one counter for all the workqueues, so the page cannot be
+ * local to all of them when they span nodes; it is left on the node
+ * the module is loaded on rather than split per node, which would
+ * change what users map.
+ */
+static struct occamstimer_seq_page *ot_seq_page;
+
+
+/* 
+ * ===============================================
+ *             Eventfd Notification
+ * ===============================================
+ *
+ * A user may register an eventfd for the device to signal when
+ * completed work is waiting, so that an event loop can watch the
+ * device along with its other file descriptors instead of polling
+ * get_work.
+ *
+ * Signals are coalesced so that a burst of completions wakes the
+ * reader once. The eventfd is armed when it is registered and
+ * whenever a get_work call finds the done queue empty. The first
+ * completion after that signals it and disarms it, and completions
+ * while it is disarmed signal nothing: the reader is already awake
+ * and will take them before get_work fails again.
+ */
+
+/*
+ * @ot_eventfd_file: The open file that registered @ot_eventfd, which
+ *                   is unregistered when that file is closed.
+ */
+static DEFINE_SPINLOCK(ot_eventfd_lock);
+static struct eventfd_ctx *ot_eventfd;
+static struct file *ot_eventfd_file;
+static int ot_eventfd_armed;
+
+
+static void
+occamstimer_eventfd_signal(struct eventfd_ctx *ctx) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	eventfd_signal(ctx);
+#else
+	eventfd_signal(ctx, 1);
+#endif
+}
+
+
+/**
+ * Signal the eventfd if it is armed. Called from the timer callback
+ * each time a workitem has been put on the done queue.
+ */
+static void
+occamstimer_eventfd_notify(void) {
+
+	unsigned long flags;
+
+	spin_lock_irqsave(&ot_eventfd_lock, flags);
+
+	if (ot_eventfd && ot_eventfd_armed) {
+		ot_eventfd_armed = 0;
+		occamstimer_eventfd_signal(ot_eventfd);
+	}
+
+	spin_unlock_irqrestore(&ot_eventfd_lock, flags);
+}
+
+
+/**
+ * Arm the eventfd once a reader has found the done queue empty. A
+ * workitem may have completed since the reader looked, while the
+ * eventfd was still disarmed, so look again now under
+ * ot_eventfd_lock and signal straight away if one has. A workitem
+ * completed after that sees the eventfd armed.
+ */
+static void
+occamstimer_eventfd_arm(void) {
+
+	unsigned long flags;
+
+	spin_lock_irqsave(&ot_eventfd_lock, flags);
+
+	if (ot_eventfd && !ot_eventfd_armed) {
+		if (occamstimer_mq_has_done(&ot_mq))
+			occamstimer_eventfd_signal(ot_eventfd);
+		else
+			ot_eventfd_armed = 1;
+	}
+
+	spin_unlock_irqrestore(&ot_eventfd_lock, flags);
+}
+
+
+/**
+ * Register the eventfd @fd on behalf of @file, replacing any it
+ * registered before, or unregister it if @fd is negative. Returns
+ * -EBUSY if another open file has one registered.
+ */
+static int
+occamstimer_eventfd_set(struct file *file, int fd) {
+
+	struct eventfd_ctx   *ctx = NULL, *old;
+	unsigned long        flags;
+
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	}
+
+	spin_lock_irqsave(&ot_eventfd_lock, flags);
+
+	if (ot_eventfd && ot_eventfd_file != file) {
+		spin_unlock_irqrestore(&ot_eventfd_lock, flags);
+		if (ctx)
+			eventfd_ctx_put(ctx);
+		return -EBUSY;
+	}
+
+	old = ot_eventfd;
+	ot_eventfd = ctx;
+	ot_eventfd_file = ctx ? file : NULL;
+	ot_eventfd_armed = 0;
+
+	spin_unlock_irqrestore(&ot_eventfd_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+
+	/* Work may already be waiting. */
+	if (ctx)
+		occamstimer_eventfd_arm();
+
+	return 0;
+}
+
+
+/* 
+ * ===============================================
+ *                IOCTL Interface
+ * ===============================================
+ */
+
+/*
+ * Generic open call that will always be successful since there is no
+ * extra setup we need to do for this module.
+ */
+static int
+occamstimer_open(struct inode *inode, struct file *file) {
+	OT_EVENT(FUNC_OPEN);
+	return 0;
+}
+
+
+static int
+occamstimer_close(struct inode *inode, struct file *file) {
+	OT_EVENT(FUNC_CLOSE);
+
+	/* Drop the eventfd if this file registered it. */
+	occamstimer_eventfd_set(file, -1);
+
+	return 0;
+}
+
+/*
+ * The size of the argument struct that each flavor of IOCTL call
+ * expects, indexed by the command number given to _IOW(). The size
+ * encoded in the IOCTL number by the user must match the entry in
+ * this table exactly, so a stale or foreign userspace header is
+ * rejected before we touch the user's memory. Commands without an
+ * entry are not valid.
+ */
+static const size_t
+occamstimer_ioctl_sizes[] = {
+	[_IOC_NR(OCCAMSTIMER_IOCTL_WORK)]   = sizeof(occamstimer_ioctl_work_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_STATUS)] = sizeof(occamstimer_ioctl_status_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_ACTION)] = sizeof(occamstimer_ioctl_action_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_BATCH)]  = sizeof(occamstimer_ioctl_batch_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_WORKV)]  = sizeof(occamstimer_ioctl_workv_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_EVENTFD)] = sizeof(occamstimer_ioctl_eventfd_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_INLINE)]  = sizeof(occamstimer_ioctl_inline_t),
+	[_IOC_NR(OCCAMSTIMER_IOCTL_STATS)]   = sizeof(occamstimer_ioctl_stats_t),
+};
+
+
+/**
+ * Whether the user's interval @ts is valid, as timespec64_valid()
+ * judges it.
+ */
+static bool
+occamstimer_exec_int_valid(const struct __kernel_timespec *ts) {
+
+	struct timespec64 ts64 = {
+		.tv_sec  = ts->tv_sec,
+		.tv_nsec = ts->tv_nsec,
+	};
+
+	return timespec64_valid(&ts64);
+}
+
+
+/**
+ * Allocate a workitem and copy the user's work parameters straight
+ * into it. This is the only copy of the payload made on the
+ * submission path.
+ *
+ * @uwork: The user's add_work IOCTL arguments.
+ */
+static int
+occamstimer_ioctl_add_work(occamstimer_ioctl_work_t __user *uwork) {
+
+	int ret = 0;
+	struct occamstimer_workqueue *wq = occamstimer_mq_queue(&ot_mq);
+	struct occamstimer_workitem *work_ptr;
+
+	work_ptr = occamstimer_wq_alloc_work(wq);
+	if (work_ptr == NULL) {
+		/* Assume that if we cannot allocate memory then there
+		 * is none. */
+		OT_INFO("workitem memory kmalloc failed");
+		return -ENOMEM;
+	}
+
+	if (copy_from_user(&work_ptr->value, &uwork->value, 
+			   sizeof(work_ptr->value))) {
+		ret = -EFAULT;
+		goto err;
+	}
+
+	/* 
+	 * Nothing guarantees that the user terminated the string
+	 * within the buffer, so do it for them instead of walking off
+	 * the end of the workitem later.
+	 */
+	work_ptr->value.data[OT_MAX_WORK_SIZE - 1] = '\0';
+	work_ptr->value.length = strlen(work_ptr->value.data);
+
+	if (!occamstimer_exec_int_valid(&work_ptr->value.exec_int)) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = occamstimer_mq_add_work(&ot_mq, wq, work_ptr);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	kfree(work_ptr);
+	return ret;
+}
+
+
+/**
+ * Allocate a workitem for each of the user's work descriptors and
+ * copy each payload straight into its workitem, then add them all to
+ * the pending queue at once. If any descriptor is bad nothing is
+ * added.
+ *
+ * @ubatch: The user's batch add_work IOCTL arguments.
+ */
+static int
+occamstimer_ioctl_add_work_batch(occamstimer_ioctl_batch_t __user *ubatch) {
+
+	int                                  ret = 0;
+	unsigned int                         i, count;
+	const struct occamstimer_work_desc   __user *udescs;
+	struct occamstimer_work_desc         desc;
+	struct occamstimer_workqueue         *wq = occamstimer_mq_queue(&ot_mq);
+	struct occamstimer_workitem          *work_ptr, *tmp;
+	long                                 len;
+	LIST_HEAD(works);
+
+	if (get_user(count, &ubatch->count) || get_user(udescs, &ubatch->value))
+		return -EFAULT;
+
+	if (count > OT_MAX_WORK_BATCH)
+		return -E2BIG;
+
+	for (i = 0; i < count; i++) {
+
+		if (copy_from_user(&desc, &udescs[i], sizeof(desc))) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		if (!occamstimer_exec_int_valid(&desc.exec_int)) {
+			ret = -EINVAL;
+			goto err;
+		}
+
+		work_ptr = occamstimer_wq_alloc_work(wq);
+		if (work_ptr == NULL) {
+			OT_INFO("workitem memory kmalloc failed");
+			ret = -ENOMEM;
+			goto err;
+		}
+
+		/* Put it on our list first so the error path frees it. */
+		list_add_tail(&work_ptr->ent, &works);
+
+		len = strncpy_from_user(work_ptr->value.data, 
+					(const char __user *)desc.data, 
+					OT_MAX_WORK_SIZE);
+		if (len < 0) {
+			ret = -EFAULT;
+			goto err;
+		}
+		if (len == OT_MAX_WORK_SIZE) {
+			/* The workitem is too large. */
+			ret = -EOVERFLOW;
+			goto err;
+		}
+
+		work_ptr->value.length = len;
+		work_ptr->value.exec_int = desc.exec_int;
+		work_ptr->value.cookie = desc.cookie;
+	}
+
+	ret = occamstimer_mq_add_work_list(&ot_mq, wq, &works);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	list_for_each_entry_safe(work_ptr, tmp, &works, ent) {
+		list_del(&work_ptr->ent);
+		kfree(work_ptr);
+	}
+	return ret;
+}
+
+
+/**
+ * Allocate a workitem and gather each of the user's fragments
+ * straight into its payload, one after another. Nothing is assumed
+ * about the bytes, so the payload may contain NULs; its length is
+ * kept in the workitem.
+ *
+ * @uworkv: The user's vectored add_work IOCTL arguments.
+ */
+static int
+occamstimer_ioctl_add_workv(occamstimer_ioctl_workv_t __user *uworkv) {
+
+	int                            ret = 0;
+	unsigned int                   i;
+	size_t                         len = 0;
+	occamstimer_ioctl_workv_t      args;
+	struct iovec                   iov;
+	struct occamstimer_workqueue   *wq = occamstimer_mq_queue(&ot_mq);
+	struct occamstimer_workitem    *work_ptr;
+
+	if (copy_from_user(&args, uworkv, sizeof(args)))
+		return -EFAULT;
+
+	if (args.iovcnt > OT_MAX_WORK_IOV)
+		return -EINVAL;
+
+	if (!occamstimer_exec_int_valid(&args.exec_int))
+		return -EINVAL;
+
+	work_ptr = occamstimer_wq_alloc_work(wq);
+	if (work_ptr == NULL) {
+		OT_INFO("workitem memory kmalloc failed");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < args.iovcnt; i++) {
+
+		if (copy_from_user(&iov, &args.iov[i], sizeof(iov))) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		/* Leave room for the terminating NUL. */
+		if (iov.iov_len > OT_MAX_WORK_SIZE - 1 - len) {
+			ret = -EOVERFLOW;
+			goto err;
+		}
+
+		if (copy_from_user(work_ptr->value.data + len, 
+				   iov.iov_base, iov.iov_len)) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		len += iov.iov_len;
+	}
+
+	work_ptr->value.data[len] = '\0';
+	work_ptr->value.length = len;
+	work_ptr->value.exec_int = args.exec_int;
+	work_ptr->value.cookie = args.cookie;
+
+	ret = occamstimer_mq_add_work(&ot_mq, wq, work_ptr);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	kfree(work_ptr);
+	return ret;
+}
+
+
+/**
+ * Copy a completed workitem directly back to the user and free it.
+ *
+ * @uwork: The user's get_work IOCTL arguments.
+ */
+static int
+occamstimer_put_work(struct occamstimer_workitem *work_ptr,
+		     occamstimer_ioctl_work_t __user *uwork) {
+
+	int ret = 0;
+
+	if (copy_to_user(&uwork->value, &work_ptr->value, 
+			 sizeof(work_ptr->value)))
+		ret = -EFAULT;
+
+	/* Finally remember to free the workitem since we kmalloc'd it
+	 * when it was added. */
+	kfree(work_ptr);
+
+	return ret;
+}
+
+
+/**
+ * Copy the first completed workitem directly back to the user and
+ * free it. Returns -EAGAIN when there is no completed work, which
+ * also arms the eventfd.
+ *
+ * @uwork: The user's get_work IOCTL arguments.
+ */
+static int
+occamstimer_ioctl_get_work(occamstimer_ioctl_work_t __user *uwork) {
+
+	struct occamstimer_workitem *work_ptr;
+
+	work_ptr = occamstimer_mq_get_work(&ot_mq);
+	if (work_ptr == NULL) {
+		occamstimer_eventfd_arm();
+		return -EAGAIN;
+	}
+
+	return occamstimer_put_work(work_ptr, uwork);
+}
+
+
+static long
+occamstimer_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param)
+{
+	int                           ret = 0;
+	unsigned int                  nr = _IOC_NR(ioctl_num);
+	void __user                   *uarg = (void __user *)ioctl_param;
+	enum occamstimer_attr_cmd     cmd;
+
+	OT_EVENT(FUNC_IOCTL);
+
+	if (_IOC_TYPE(ioctl_num) != OCCAMSTIMER_MAGIC ||
+	    nr >= ARRAY_SIZE(occamstimer_ioctl_sizes) ||
+	    occamstimer_ioctl_sizes[nr] == 0 ||
+	    _IOC_SIZE(ioctl_num) != occamstimer_ioctl_sizes[nr]) {
+		printk("ioctl: no such command\n");
+		return -ENOTTY;
+	}
+
+	/* 
+	 * Every flavor of IOCTL argument struct begins with its
+	 * cmd. Only that is read up front; each flavor then copies
+	 * exactly the part of its arguments it needs, and no more.
+	 */
+	if (get_user(cmd, (enum occamstimer_attr_cmd __user *)uarg))
+		return -EFAULT;
+
+	switch (ioctl_num) {
+
+	case OCCAMSTIMER_IOCTL_WORK:
+	{
+		occamstimer_ioctl_work_t __user *uwork = uarg;
+
+		if (cmd == OT_ATTR_GET) {
+			ret = occamstimer_ioctl_get_work(uwork);
+		} else if (cmd == OT_ATTR_ADD) {
+			ret = occamstimer_ioctl_add_work(uwork);
+		} else{			
+			ret = -EINVAL;
+		}
+			
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_WORKV:
+	{
+		if (cmd == OT_ATTR_ADD)
+			ret = occamstimer_ioctl_add_workv(uarg);
+		else
+			ret = -EINVAL;
+
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_BATCH:
+	{
+		if (cmd == OT_ATTR_ADD)
+			ret = occamstimer_ioctl_add_work_batch(uarg);
+		else
+			ret = -EINVAL;
+
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_EVENTFD:
+	{
+		occamstimer_ioctl_eventfd_t __user *ueventfd = uarg;
+		int fd;
+
+		if (cmd != OT_ATTR_SET)
+			ret = -EINVAL;
+		else if (get_user(fd, &ueventfd->value))
+			ret = -EFAULT;
+		else
+			ret = occamstimer_eventfd_set(file, fd);
+
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_INLINE:
+	{
+		occamstimer_ioctl_inline_t __user *uinline = uarg;
+		unsigned int inline_ns;
+
+		if (cmd == OT_ATTR_GET) {
+			inline_ns = occamstimer_mq_get_inline(&ot_mq);
+			if (put_user(inline_ns, &uinline->value))
+				ret = -EFAULT;
+		} else if (cmd == OT_ATTR_SET) {
+			if (get_user(inline_ns, &uinline->value))
+				ret = -EFAULT;
+			else
+				ret = occamstimer_mq_set_inline(&ot_mq, inline_ns);
+		} else {
+			ret = -EINVAL;
+		}
+
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_STATS:
+	{
+		occamstimer_ioctl_stats_t __user *ustats = uarg;
+		struct occamstimer_stats stats;
+
+		if (cmd != OT_ATTR_GET) {
+			ret = -EINVAL;
+			break;
+		}
+
+		occamstimer_mq_get_stats(&ot_mq, &stats);
+		if (copy_to_user(&ustats->value, &stats, sizeof(stats)))
+			ret = -EFAULT;
+
+		break;
+	}
+
+	case OCCAMSTIMER_IOCTL_STATUS:
+	{
+		occamstimer_ioctl_status_t __user *ustatus = uarg;
+		enum occamstimer_status status;
+
+		if (cmd == OT_ATTR_GET) {
+			ret = occamstimer_mq_get_status(&ot_mq, &status);
+			if (!ret && put_user(status, &ustatus->value))
+				ret = -EFAULT;
+		} else if (cmd == OT_ATTR_SET) {
+			if (get_user(status, &ustatus->value))
+				ret = -EFAULT;
+			else
+				ret = occamstimer_mq_set_status(&ot_mq, status);
+		} else {
+			ret = -EINVAL;
+		}
+			
+		break;
+
+	}
+
+	case OCCAMSTIMER_IOCTL_ACTION:
+	{
+		occamstimer_ioctl_action_t __user *uaction = uarg;
+		enum occamstimer_action action;
+
+		if (get_user(action, &uaction->value))
+			return -EFAULT;
+
+		if (action == OT_ACTION_START)
+			ret = occamstimer_mq_start(&ot_mq);
+		else if (action == OT_ACTION_PAUSE)
+			ret = occamstimer_mq_pause(&ot_mq);
+		else 
+			WARN(1, "Undefined action for occamstimer.\n");
+						
+		break;
+	}
+
+	default:
+	{
+		printk("ioctl: no such command\n");
+		ret = -ENOTTY;
+	}
+	} /* end of switch(ioctl_num) */
+
+	
+	return ret;
+}
+
+
+
+
+/* 
+ * ===============================================
+ *                io_uring Interface
+ * ===============================================
+ *
+ * Every IOCTL call can also be issued as an IORING_OP_URING_CMD whose
+ * cmd_op is the IOCTL number and whose command area holds a struct
+ * occamstimer_uring_cmd pointing at the same argument struct. The
+ * result is the CQE's res.
+ *
+ * The one difference is get_work: rather than failing with -EAGAIN,
+ * a get_work command that finds no completed work waits on
+ * ot_uring_waiters, and the workqueue completes one waiter for each
+ * workitem it services. Completions thus arrive as CQEs in the
+ * same ring as the rest of the application's I/O.
+ */
+#if defined(CONFIG_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#include <linux/io_uring/cmd.h>
+
+/*
+ * Kept in the io_uring_cmd's pdu while a get_work command waits.
+ */
+struct occamstimer_uring_pdu {
+	struct list_head                  ent;
+	struct io_uring_cmd               *ioucmd;
+	occamstimer_ioctl_work_t __user   *uwork;
+};
+
+static DEFINE_SPINLOCK(ot_uring_lock);
+static LIST_HEAD(ot_uring_waiters);
+
+
+static struct occamstimer_uring_pdu *
+occamstimer_uring_pdu(struct io_uring_cmd *ioucmd) {
+	BUILD_BUG_ON(sizeof(struct occamstimer_uring_pdu) > sizeof(ioucmd->pdu));
+	return (struct occamstimer_uring_pdu *)ioucmd->pdu;
+}
+
+
+/**
+ * Take the first completed workitem, or if there is none queue
+ * @ioucmd to wait for one. The check and the queueing happen under
+ * ot_uring_lock, which occamstimer_uring_notify() also takes, so a
+ * workitem completed in between cannot be missed. The copy to the
+ * user happens after the lock is dropped since it may fault.
+ */
+static int
+occamstimer_uring_get_work(struct io_uring_cmd *ioucmd) {
+
+	struct occamstimer_uring_pdu   *pdu = occamstimer_uring_pdu(ioucmd);
+	struct occamstimer_workitem    *work_ptr;
+	unsigned long                  flags;
+
+	spin_lock_irqsave(&ot_uring_lock, flags);
+
+	work_ptr = occamstimer_mq_get_work(&ot_mq);
+	if (work_ptr == NULL)
+		list_add_tail(&pdu->ent, &ot_uring_waiters);
+
+	spin_unlock_irqrestore(&ot_uring_lock, flags);
+
+	if (work_ptr == NULL)
+		return -EIOCBQUEUED;
+
+	return occamstimer_put_work(work_ptr, pdu->uwork);
+}
+
+
+/**
+ * Run in the waiting task's context, where we can copy to the user,
+ * once the timer callback has completed a workitem for it. Another
+ * reader may have taken that workitem first, in which case we wait
+ * again.
+ */
+static void
+occamstimer_uring_get_work_task(struct io_uring_cmd *ioucmd,
+				unsigned int issue_flags) {
+
+	int ret;
+
+	ret = occamstimer_uring_get_work(ioucmd);
+	if (ret != -EIOCBQUEUED)
+		io_uring_cmd_done(ioucmd, ret, 0, issue_flags);
+}
+
+
+/**
+ * Hand the @count workitems just completed to the first @count
+ * waiting get_work commands, as many as there are.
+ */
+static void
+occamstimer_uring_notify(struct occamstimer_workqueue *wq, unsigned int count) {
+
+	struct occamstimer_uring_pdu   *pdu;
+	unsigned long                  flags;
+
+	spin_lock_irqsave(&ot_uring_lock, flags);
+
+	/* Only queues task work, so it is safe under the lock. */
+	while (count-- && !list_empty(&ot_uring_waiters)) {
+		pdu = list_first_entry(&ot_uring_waiters,
+				       struct occamstimer_uring_pdu, ent);
+		list_del_init(&pdu->ent);
+		io_uring_cmd_complete_in_task(pdu->ioucmd, 
+					      occamstimer_uring_get_work_task);
+	}
+
+	spin_unlock_irqrestore(&ot_uring_lock, flags);
+}
+
+
+/**
+ * A waiting get_work command is cancelled when its ring goes away.
+ * If it has already been handed a workitem, it completes as usual.
+ */
+static int
+occamstimer_uring_cancel(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+
+	struct occamstimer_uring_pdu   *pdu = occamstimer_uring_pdu(ioucmd);
+	unsigned long                  flags;
+	int                            waiting;
+
+	spin_lock_irqsave(&ot_uring_lock, flags);
+
+	waiting = !list_empty(&pdu->ent);
+	if (waiting)
+		list_del_init(&pdu->ent);
+
+	spin_unlock_irqrestore(&ot_uring_lock, flags);
+
+	if (waiting)
+		io_uring_cmd_done(ioucmd, -ECANCELED, 0, issue_flags);
+
+	return 0;
+}
+
+
+static int
+occamstimer_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+
+	const struct occamstimer_uring_cmd   *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+	struct occamstimer_uring_pdu         *pdu = occamstimer_uring_pdu(ioucmd);
+	void __user                          *uarg;
+	enum occamstimer_attr_cmd            attr_cmd;
+	int                                  ret;
+
+	if (issue_flags & IO_URING_F_CANCEL)
+		return occamstimer_uring_cancel(ioucmd, issue_flags);
+
+	uarg = u64_to_user_ptr(READ_ONCE(cmd->arg));
+
+	if (ioucmd->cmd_op != OCCAMSTIMER_IOCTL_WORK)
+		return occamstimer_ioctl(ioucmd->file, ioucmd->cmd_op, 
+					 (unsigned long)uarg);
+
+	if (get_user(attr_cmd, (enum occamstimer_attr_cmd __user *)uarg))
+		return -EFAULT;
+
+	if (attr_cmd != OT_ATTR_GET)
+		return occamstimer_ioctl(ioucmd->file, ioucmd->cmd_op, 
+					 (unsigned long)uarg);
+
+	INIT_LIST_HEAD(&pdu->ent);
+	pdu->ioucmd = ioucmd;
+	pdu->uwork = uarg;
+
+	ret = occamstimer_uring_get_work(ioucmd);
+	if (ret == -EIOCBQUEUED)
+		io_uring_cmd_mark_cancelable(ioucmd, issue_flags);
+
+	return ret;
+}
+
+#define OCCAMSTIMER_URING_CMD .uring_cmd = occamstimer_uring_cmd,
+#else
+#define OCCAMSTIMER_URING_CMD
+
+static inline void
+occamstimer_uring_notify(struct occamstimer_workqueue *wq, unsigned int count) {
+}
+#endif /* CONFIG_IO_URING */
+
+
+/**
+ * Each workqueue's notify hook, run each time its timer callback or an
+ * inline service puts workitems on the done queue.
+ */
+static void
+occamstimer_notify(struct occamstimer_workqueue *wq, unsigned int count) {
+	occamstimer_eventfd_notify();
+	occamstimer_uring_notify(wq, count);
+}
+
+
+/* 
+ * ===============================================
+ *             Completion Sequence Page
+ * ===============================================
+ */
+
+/**
+ * Map ot_seq_page into the user's address space, read only. A user
+ * whose workitems take only a few microseconds can spin on it rather
+ * than sleep, which costs more than the work itself; see
+ * occamstimer_wait_work() in liboccamstimer. Nothing changes for
+ * users that do not map it.
+ */
+static int
+occamstimer_mmap(struct file *file, struct vm_area_struct *vma) {
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	return remap_pfn_range(vma, vma->vm_start, 
+			       virt_to_phys(ot_seq_page) >> PAGE_SHIFT,
+			       PAGE_SIZE, vma->vm_page_prot);
+}
+
+
+
+/* 
+ * ===============================================
+ *             Sysfs Interface
+ * ===============================================
+ */
+
+/*
+ * How the timer of each workqueue of ot_mq is set up is exposed under
+ * /sys/kernel/occamstimer/wq<n>/, one file per member of struct
+ * occamstimer_timer_config, along with the NUMA node it is bound to
+ * and its stats:
+ *
+ *   timer_clock     monotonic, realtime or boottime
+ *   timer_mode      hard or soft
+ *   timer_cpu       the CPU the timer fires on, or -1 for any
+ *   timer_slack_ns  how late the timer may fire
+ *   node            the node it is bound to, or -1 for none
+ *   stats           read only, struct occamstimer_stats
+ *
+ * They may only be written while the workqueue is not running; a
+ * write otherwise fails with EBUSY. For example, to keep the timer of
+ * the first workqueue on an isolated CPU 3 for latency runs:
+ *
+ *   echo 3 > /sys/kernel/occamstimer/wq0/timer_cpu
+ *
+ * or to let it expire in softirq context, up to 50us late, alongside
+ * other timers for bulk runs:
+ *
+ *   echo soft > /sys/kernel/occamstimer/wq0/timer_mode
+ *   echo 50000 > /sys/kernel/occamstimer/wq0/timer_slack_ns
+ */
+
+/*
+ * Serializes the writers, which each read, change and write back the
+ * whole configuration.
+ */
+static DEFINE_MUTEX(ot_sysfs_mutex);
+
+/* The root kobj for this module, /sys/kernel/occamstimer. */
+static struct kobject *ot_kobj;
+
+/* The directory of each workqueue in it, in the order of ot_mq.wqs. */
+static struct kobject **ot_wq_kobjs;
+
+static const struct {
+	const char  *name;
+	clockid_t   clock;
+} ot_clocks[] = {
+	{ "monotonic", CLOCK_MONOTONIC },
+	{ "realtime",  CLOCK_REALTIME },
+	{ "boottime",  CLOCK_BOOTTIME },
+};
+
+
+/**
+ * The workqueue whose directory @kobj is.
+ */
+static struct occamstimer_workqueue *
+occamstimer_kobj_wq(struct kobject *kobj) {
+
+	unsigned int i;
+
+	for (i = 1; i < ot_mq.nr; i++) {
+		if (ot_wq_kobjs[i] == kobj)
+			return ot_mq.wqs[i];
+	}
+
+	return ot_mq.wqs[0];
+}
+
+
+/**
+ * Read, change with @update and write back the configuration of
+ * @wq's timer. Returns @count, as a store routine must, or the error
+ * from occamstimer_wq_set_timer().
+ */
+static ssize_t
+occamstimer_timer_store(struct occamstimer_workqueue *wq,
+			void (*update)(struct occamstimer_timer_config *cfg,
+				       long long value),
+			long long value, size_t count) {
+
+	struct occamstimer_timer_config cfg;
+	int ret;
+
+	mutex_lock(&ot_sysfs_mutex);
+
+	occamstimer_wq_get_timer(wq, &cfg);
+	update(&cfg, value);
+	ret = occamstimer_wq_set_timer(wq, &cfg);
+
+	mutex_unlock(&ot_sysfs_mutex);
+
+	return ret ? ret : count;
+}
+
+
+static ssize_t
+occamstimer_timer_clock_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf) {
+
+	struct occamstimer_timer_config cfg;
+	int i;
+
+	occamstimer_wq_get_timer(occamstimer_kobj_wq(kobj), &cfg);
+
+	for (i = 0; i < ARRAY_SIZE(ot_clocks); i++) {
+		if (ot_clocks[i].clock == cfg.clock)
+			return sprintf(buf, "%s\n", ot_clocks[i].name);
+	}
+
+	return sprintf(buf, "%d\n", cfg.clock);
+}
+
+static void
+occamstimer_update_clock(struct occamstimer_timer_config *cfg, long long value) {
+	cfg->clock = value;
+}
+
+static ssize_t
+occamstimer_timer_clock_store(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      const char *buf, size_t count) {
+
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ot_clocks); i++) {
+		if (sysfs_streq(buf, ot_clocks[i].name))
+			return occamstimer_timer_store(occamstimer_kobj_wq(kobj),
+						       occamstimer_update_clock,
+						       ot_clocks[i].clock, count);
+	}
+
+	return -EINVAL;
+}
+
+static struct kobj_attribute occamstimer_timer_clock_attr =
+	__ATTR(timer_clock, 0644,
+	       occamstimer_timer_clock_show,
+	       occamstimer_timer_clock_store);
+
+
+static ssize_t
+occamstimer_timer_mode_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf) {
+
+	struct occamstimer_timer_config cfg;
+
+	occamstimer_wq_get_timer(occamstimer_kobj_wq(kobj), &cfg);
+
+	return sprintf(buf, "%s\n", cfg.soft ? "soft" : "hard");
+}
+
+static void
+occamstimer_update_mode(struct occamstimer_timer_config *cfg, long long value) {
+	cfg->soft = value;
+}
+
+static ssize_t
+occamstimer_timer_mode_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count) {
+
+	if (sysfs_streq(buf, "hard"))
+		return occamstimer_timer_store(occamstimer_kobj_wq(kobj),
+					       occamstimer_update_mode, 0, count);
+
+	if (sysfs_streq(buf, "soft"))
+		return occamstimer_timer_store(occamstimer_kobj_wq(kobj),
+					       occamstimer_update_mode, 1, count);
+
+	return -EINVAL;
+}
+
+static struct kobj_attribute occamstimer_timer_mode_attr =
+	__ATTR(timer_mode, 0644,
+	       occamstimer_timer_mode_show,
+	       occamstimer_timer_mode_store);
+
+
+static ssize_t
+occamstimer_timer_cpu_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf) {
+
+	struct occamstimer_timer_config cfg;
+
+	occamstimer_wq_get_timer(occamstimer_kobj_wq(kobj), &cfg);
+
+	return sprintf(buf, "%d\n", cfg.cpu);
+}
+
+static void
+occamstimer_update_cpu(struct occamstimer_timer_config *cfg, long long value) {
+	cfg->cpu = value;
+}
+
+static ssize_t
+occamstimer_timer_cpu_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count) {
+
+	int cpu;
+
+	if (sscanf(buf, "%d", &cpu) != 1)
+		return -EINVAL;
+
+	return occamstimer_timer_store(occamstimer_kobj_wq(kobj),
+				       occamstimer_update_cpu, cpu, count);
+}
+
+static struct kobj_attribute occamstimer_timer_cpu_attr =
+	__ATTR(timer_cpu, 0644,
+	       occamstimer_timer_cpu_show,
+	       occamstimer_timer_cpu_store);
+
+
+static ssize_t
+occamstimer_timer_slack_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf) {
+
+	struct occamstimer_timer_config cfg;
+
+	occamstimer_wq_get_timer(occamstimer_kobj_wq(kobj), &cfg);
+
+	return sprintf(buf, "%llu\n", cfg.slack_ns);
+}
+
+static void
+occamstimer_update_slack(struct occamstimer_timer_config *cfg, long long value) {
+	cfg->slack_ns = value;
+}
+
+static ssize_t
+occamstimer_timer_slack_store(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      const char *buf, size_t count) {
+
+	long long slack_ns;
+
+	if (sscanf(buf, "%lld", &slack_ns) != 1 || slack_ns < 0)
+		return -EINVAL;
+
+	return occamstimer_timer_store(occamstimer_kobj_wq(kobj),
+				       occamstimer_update_slack, slack_ns, count);
+}
+
+static struct kobj_attribute occamstimer_timer_slack_attr =
+	__ATTR(timer_slack_ns, 0644,
+	       occamstimer_timer_slack_show,
+	       occamstimer_timer_slack_store);
+
+
+static ssize_t
+occamstimer_node_show(struct kobject *kobj,
+		      struct kobj_attribute *attr, char *buf) {
+
+	return sprintf(buf, "%d\n", occamstimer_wq_get_node(occamstimer_kobj_wq(kobj)));
+}
+
+static ssize_t
+occamstimer_node_store(struct kobject *kobj,
+		       struct kobj_attribute *attr,
+		       const char *buf, size_t count) {
+
+	int node, ret;
+
+	if (sscanf(buf, "%d", &node) != 1)
+		return -EINVAL;
+
+	mutex_lock(&ot_sysfs_mutex);
+	ret = occamstimer_wq_set_node(occamstimer_kobj_wq(kobj), node);
+	mutex_unlock(&ot_sysfs_mutex);
+
+	return ret ? ret : count;
+}
+
+static struct kobj_attribute occamstimer_node_attr =
+	__ATTR(node, 0644, occamstimer_node_show, occamstimer_node_store);
+
+
+/*
+ * One "name value" pair per line. serviced_remote staying near 0
+ * shows the workitems are serviced where they were allocated, and
+ * imbalance_max how far this workqueue found a sibling behind when it
+ * had nothing to do. serviced_remote does not cover the workqueue
+ * itself; mem_node is the node it is on, to compare with the node it
+ * is bound to.
+ */
+static ssize_t
+occamstimer_stats_show(struct kobject *kobj,
+		       struct kobj_attribute *attr, char *buf) {
+
+	struct occamstimer_workqueue *wq = occamstimer_kobj_wq(kobj);
+	struct occamstimer_stats stats;
+
+	occamstimer_wq_get_stats(wq, &stats);
+
+	return sprintf(buf,
+		       "serviced_timer %llu\n"
+		       "serviced_inline %llu\n"
+		       "serviced_remote %llu\n"
+		       "steals %llu\n"
+		       "stolen %llu\n"
+		       "imbalance_max %llu\n"
+		       "mem_node %d\n",
+		       stats.serviced_timer, stats.serviced_inline,
+		       stats.serviced_remote, stats.steals, stats.stolen,
+		       stats.imbalance_max, occamstimer_wq_mem_node(wq));
+}
+
+static struct kobj_attribute occamstimer_stats_attr =
+	__ATTR(stats, 0444, occamstimer_stats_show, NULL);
+
+
+static struct attribute *occamstimer_wq_attrs[] = {
+	&occamstimer_timer_clock_attr.attr,
+	&occamstimer_timer_mode_attr.attr,
+	&occamstimer_timer_cpu_attr.attr,
+	&occamstimer_timer_slack_attr.attr,
+	&occamstimer_node_attr.attr,
+	&occamstimer_stats_attr.attr,
+	NULL,	/* need to NULL terminate the list of attributes */
+};
+
+/*
+ * Created in the directory of each workqueue.
+ */
+static struct attribute_group occamstimer_wq_attr_group = {
+	.attrs = occamstimer_wq_attrs,
+};
+
+
+/**
+ * Remove everything occamstimer_sysfs_init() created. Removing a
+ * kobject removes its files.
+ */
+static void
+occamstimer_sysfs_exit(void) {
+
+	unsigned int i;
+
+	if (ot_wq_kobjs) {
+		for (i = 0; i < ot_mq.nr; i++)
+			kobject_put(ot_wq_kobjs[i]);
+		kfree(ot_wq_kobjs);
+		ot_wq_kobjs = NULL;
+	}
+
+	kobject_put(ot_kobj);
+}
+
+
+/**
+ * Create /sys/kernel/occamstimer and a directory in it for each
+ * workqueue. Returns 0, or an error having removed whatever was
+ * created.
+ */
+static int
+occamstimer_sysfs_init(void) {
+
+	char          name[16];
+	unsigned int  i;
+	int           ret;
+
+	/*
+	 * Create a simple kobject with the name of "occamstimer",
+	 * located under /sys/kernel/
+	 */
+	ot_kobj = kobject_create_and_add(OT_MODULE_NAME, kernel_kobj);
+	if (!ot_kobj)
+		return -ENOMEM;
+
+	ot_wq_kobjs = kzalloc(ot_mq.nr * sizeof(*ot_wq_kobjs), GFP_KERNEL);
+	if (!ot_wq_kobjs) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < ot_mq.nr; i++) {
+
+		snprintf(name, sizeof(name), "wq%u", i);
+
+		ot_wq_kobjs[i] = kobject_create_and_add(name, ot_kobj);
+		if (!ot_wq_kobjs[i]) {
+			ret = -ENOMEM;
+			goto err;
+		}
+
+		ret = sysfs_create_group(ot_wq_kobjs[i], &occamstimer_wq_attr_group);
+		if (ret)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	occamstimer_sysfs_exit();
+	return ret;
+}
+
+
+
+/* 
+ * ===============================================
+ *            Module init/exit 
+ * ===============================================
+ */
+
+/* 
+ * The file_operations struct is an instance of the standard character
+ * device table entry. We choose to initialize only the open, release,
+ * unlock_ioctl and mmap elements, and uring_cmd where the kernel has
+ * it, since these are the only functions we use in this module.
+ */
+struct file_operations
+occamstimer_dev_fops = {
+	.owner          = THIS_MODULE,
+	.unlocked_ioctl = occamstimer_ioctl,
+	.open           = occamstimer_open,
+	.release        = occamstimer_close,
+	.mmap           = occamstimer_mmap,
+	OCCAMSTIMER_URING_CMD
+};
+
+
+/* 
+ * This is an instance of the miscdevice structure which is used in
+ * the occamstimer_init routine as a part of registering the module
+ * when it is loaded. 
+ * 
+ * The device type is "misc" which means that it will be assigned a
+ * static major number of 10. We deduced this by doing ls -la /dev and
+ * noticed several different entries we knew to be modules with major
+ * number 10 but with different minor numbers.
+ * 
+ */
+static struct miscdevice
+occamstimer_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = OT_MODULE_NAME,
+	.fops  = &occamstimer_dev_fops,
+};
+
+
+/**
+ * This routine is executed when the module is loaded into the
+ * kernel. I.E. during the insmod command.
+ */
+static int
+__init occamstimer_init(void)
+{
+	int ret = 0;
+	unsigned int i;
+
+	if (nr_queues == 0 || nr_queues > nr_cpu_ids) {
+		printk("occamstimer: nr_queues must be from 1 to %u\n", 
+		       nr_cpu_ids);
+		return -EINVAL;
+	}
+
+	/* 
+	 * Initializing ot_mq. This must happen before the device is
+	 * registered since the IOCTLs may be called as soon as it is.
+	 */
+	ot_seq_page = (struct occamstimer_seq_page *)get_zeroed_page(GFP_KERNEL);
+	if (ot_seq_page == NULL)
+		return -ENOMEM;
+
+	/* The page is mapped to userspace by remap_pfn_range(). */
+	SetPageReserved(virt_to_page(ot_seq_page));
+
+	ret = occamstimer_mq_init(&ot_mq, nr_queues);
+	if (ret)
+		goto err_page;
+
+	for (i = 0; i < ot_mq.nr; i++) {
+		ot_mq.wqs[i]->seq = ot_seq_page;
+		ot_mq.wqs[i]->notify = occamstimer_notify;
+	}
+
+	/*
+	 * Attempt to register the module as a misc. device with the
+	 * kernel.
+	 */
+	ret = misc_register(&occamstimer_misc);
+		
+	if (ret < 0) {
+		/* Registration failed so give up. */
+		goto err_wq;
+	}
+
+	ret = occamstimer_sysfs_init();
+	if (ret)
+		goto err_misc;
+
+	printk("occamstimer module installed\n");
+
+	return 0;
+
+err_misc:
+	misc_deregister(&occamstimer_misc);
+err_wq:
+	occamstimer_mq_destroy(&ot_mq);
+err_page:
+	ClearPageReserved(virt_to_page(ot_seq_page));
+	free_page((unsigned long)ot_seq_page);
+	return ret;
+}
+
+/*
+ * This code is executed when the module is being removed from the
+ * kernel during the rmmod command.
+ */
+static void
+__exit occamstimer_exit(void)
+{ 
+	occamstimer_sysfs_exit();
+
+	misc_deregister(&occamstimer_misc);
+
+	occamstimer_mq_destroy(&ot_mq);
+
+	ClearPageReserved(virt_to_page(ot_seq_page));
+	free_page((unsigned long)ot_seq_page);
+
+	printk("occamstimer module uninstalled\n");
+}
+
+module_init(occamstimer_init);
+module_exit(occamstimer_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Simple module example with HRTimers and IOCTL");
+MODULE_AUTHOR("Dillon Hicks <hhicks@ittc.ku.edu>");
@@ -0,0 +1,370 @@
+/*
+ * occamstimer_mq.c - Several occamstimer workqueues servicing one
+ * device in parallel
+ *
+ * The device operations are applied to every workqueue of a struct
+ * occamstimer_mq, and the per workqueue state is combined into the
+ * device's. The stealing itself is done by the workqueues' timer
+ * callbacks, see __occamstimer_steal() in occamstimer_queue.c; here
+ * idle workqueues are only kicked into it.
+ *
+ * No lock is held across workqueues here. Each call takes the lock of
+ * one workqueue at a time, so the device wide results (the status,
+ * whether there is completed work) are only as current as the last
+ * workqueue looked at.
+ */
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/topology.h>
+#endif /* __KERNEL__ */
+
+#include "occamstimer_mq.h"
+
+
+/*
+ * How the status of each workqueue counts toward the status of the
+ * device: the most active of them wins.
+ */
+static const int occamstimer_status_rank[] = {
+	[OT_SETUP]        = 0,
+	[OT_FINISHED]     = 1,
+	[OT_STOPPED]      = 2,
+	[OT_ITEM_SERVICE] = 3,
+	[OT_RUNNING]      = 3,
+};
+
+
+/*
+ * ===============================================
+ *            Multi-queue init/destroy
+ * ===============================================
+ */
+
+/**
+ * Initialize @mq with @nr empty workqueues in the OT_SETUP state.
+ * Returns -EINVAL for no workqueues, or -ENOMEM.
+ *
+ * Workqueue @i takes the work submitted from CPU @i (among others, see
+ * occamstimer_mq_queue()), so it is allocated on that CPU's node,
+ * where its lock and lists will mostly be touched.
+ */
+int
+occamstimer_mq_init(struct occamstimer_mq *mq, unsigned int nr) {
+
+	struct occamstimer_workqueue *wq;
+	unsigned int i;
+
+	if (nr == 0)
+		return -EINVAL;
+
+	mq->nr = 0;
+	mq->next_get = 0;
+
+	mq->wqs = kzalloc(nr * sizeof(*mq->wqs), GFP_KERNEL);
+	if (mq->wqs == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+
+		wq = kzalloc_node(sizeof(*wq), GFP_KERNEL,
+				  cpu_to_node(i % nr_cpu_ids));
+		if (wq == NULL) {
+			occamstimer_mq_destroy(mq);
+			return -ENOMEM;
+		}
+
+		occamstimer_wq_init(wq);
+
+		/* A lone workqueue has no one to steal from. */
+		if (nr > 1) {
+			wq->siblings = mq->wqs;
+			wq->nr_siblings = nr;
+		}
+		wq->index = i;
+
+		mq->wqs[i] = wq;
+		mq->nr++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Destroy and free every workqueue of @mq, along with their work.
+ *
+ * Each is stopped first, so that its timer does not steal from one
+ * that is already gone.
+ */
+void
+occamstimer_mq_destroy(struct occamstimer_mq *mq) {
+
+	unsigned int i;
+
+	for (i = 0; i < mq->nr; i++)
+		occamstimer_wq_set_status(mq->wqs[i], OT_STOPPED);
+
+	for (i = 0; i < mq->nr; i++) {
+		occamstimer_wq_destroy(mq->wqs[i]);
+		kfree(mq->wqs[i]);
+	}
+
+	kfree(mq->wqs);
+	mq->wqs = NULL;
+	mq->nr = 0;
+}
+
+
+/*
+ * ===============================================
+ *                Public Interface
+ * ===============================================
+ */
+
+/**
+ * The workqueue work submitted from this CPU goes to. Which CPU that
+ * is may change right after, which only affects balance.
+ */
+struct occamstimer_workqueue *
+occamstimer_mq_queue(struct occamstimer_mq *mq) {
+
+	return mq->wqs[raw_smp_processor_id() % mq->nr];
+}
+
+
+/**
+ * Get the status of the device: running if any workqueue is, else
+ * stopped if any is, else finished if any is, else still in setup.
+ */
+int
+occamstimer_mq_get_status(struct occamstimer_mq *mq,
+			  enum occamstimer_status *status) {
+
+	enum occamstimer_status wq_status;
+	unsigned int i;
+
+	occamstimer_wq_get_status(mq->wqs[0], status);
+
+	for (i = 1; i < mq->nr; i++) {
+		occamstimer_wq_get_status(mq->wqs[i], &wq_status);
+		if (occamstimer_status_rank[wq_status] >
+		    occamstimer_status_rank[*status])
+			*status = wq_status;
+	}
+
+	return 0;
+}
+
+
+int
+occamstimer_mq_set_status(struct occamstimer_mq *mq,
+			  enum occamstimer_status new_status) {
+
+	unsigned int i;
+
+	for (i = 0; i < mq->nr; i++)
+		occamstimer_wq_set_status(mq->wqs[i], new_status);
+
+	return 0;
+}
+
+
+/**
+ * Kick idle siblings of @wq to steal from it if there is work waiting
+ * behind its head, see occamstimer_wq_kick(): one for each such
+ * workitem at most, so that they are not all woken to race for the
+ * same one, starting with the sibling after @wq.
+ */
+static void
+occamstimer_mq_balance(struct occamstimer_mq *mq,
+		       struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workqueue *sib;
+	unsigned int i, waiting;
+
+	if (mq->nr < 2 || READ_ONCE(wq->status) != OT_RUNNING)
+		return;
+
+	waiting = READ_ONCE(wq->nr_pending);
+
+	for (i = 1; i < mq->nr && waiting > 1; i++) {
+		sib = mq->wqs[(wq->index + i) % mq->nr];
+		if (READ_ONCE(sib->nr_pending) == 0 && occamstimer_wq_kick(sib))
+			waiting--;
+	}
+}
+
+
+/**
+ * Start every workqueue that is not already running, then set the
+ * ones left without work to stealing from the others. Returns
+ * -EINVAL only if none could be started, as for a lone workqueue.
+ */
+int
+occamstimer_mq_start(struct occamstimer_mq *mq) {
+
+	unsigned int i;
+	int ret = -EINVAL;
+
+	for (i = 0; i < mq->nr; i++) {
+		if (!occamstimer_wq_start(mq->wqs[i]))
+			ret = 0;
+	}
+
+	for (i = 0; i < mq->nr; i++)
+		occamstimer_mq_balance(mq, mq->wqs[i]);
+
+	return ret;
+}
+
+
+/**
+ * Pause every workqueue. Returns the first error, having still
+ * paused the rest.
+ */
+int
+occamstimer_mq_pause(struct occamstimer_mq *mq) {
+
+	unsigned int i;
+	int ret = 0, err;
+
+	for (i = 0; i < mq->nr; i++) {
+		err = occamstimer_wq_pause(mq->wqs[i]);
+		if (err && !ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Add a workitem to @wq, one of @mq's, see occamstimer_wq_add_work().
+ * It is normally occamstimer_mq_queue(), whose node the workitem
+ * should have been allocated on with occamstimer_wq_alloc_work().
+ */
+int
+occamstimer_mq_add_work(struct occamstimer_mq *mq,
+			struct occamstimer_workqueue *wq,
+			struct occamstimer_workitem *work_ptr) {
+
+	LIST_HEAD(works);
+
+	list_add_tail(&work_ptr->ent, &works);
+
+	return occamstimer_mq_add_work_list(mq, wq, &works);
+}
+
+
+/**
+ * Add every workitem on @works to @wq, one of @mq's, see
+ * occamstimer_wq_add_work_list(), and kick idle siblings if they
+ * are left waiting.
+ */
+int
+occamstimer_mq_add_work_list(struct occamstimer_mq *mq,
+			     struct occamstimer_workqueue *wq,
+			     struct list_head *works) {
+
+	int ret;
+
+	ret = occamstimer_wq_add_work_list(wq, works);
+	if (ret)
+		return ret;
+
+	occamstimer_mq_balance(mq, wq);
+
+	return 0;
+}
+
+
+/**
+ * Remove a completed workitem from any of the workqueues and return
+ * it, or NULL if none has completed work. The workqueues are taken
+ * from in turn, so the order of completion is kept within each
+ * workqueue but not across them.
+ */
+struct occamstimer_workitem *
+occamstimer_mq_get_work(struct occamstimer_mq *mq) {
+
+	struct occamstimer_workitem *work_ptr;
+	unsigned int i, first, index;
+
+	first = READ_ONCE(mq->next_get);
+
+	for (i = 0; i < mq->nr; i++) {
+		index = (first + i) % mq->nr;
+		work_ptr = occamstimer_wq_get_work(mq->wqs[index]);
+		if (work_ptr) {
+			WRITE_ONCE(mq->next_get, (index + 1) % mq->nr);
+			return work_ptr;
+		}
+	}
+
+	return NULL;
+}
+
+
+int
+occamstimer_mq_has_done(struct occamstimer_mq *mq) {
+
+	unsigned int i;
+
+	for (i = 0; i < mq->nr; i++) {
+		if (occamstimer_wq_has_done(mq->wqs[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+int
+occamstimer_mq_set_inline(struct occamstimer_mq *mq, unsigned int inline_ns) {
+
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < mq->nr && !ret; i++)
+		ret = occamstimer_wq_set_inline(mq->wqs[i], inline_ns);
+
+	return ret;
+}
+
+
+unsigned int
+occamstimer_mq_get_inline(struct occamstimer_mq *mq) {
+
+	return occamstimer_wq_get_inline(mq->wqs[0]);
+}
+
+
+/**
+ * Sum the stats of the workqueues, taking the largest imbalance_max.
+ */
+void
+occamstimer_mq_get_stats(struct occamstimer_mq *mq,
+			 struct occamstimer_stats *stats) {
+
+	struct occamstimer_stats wq_stats;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < mq->nr; i++) {
+		occamstimer_wq_get_stats(mq->wqs[i], &wq_stats);
+
+		stats->serviced_timer += wq_stats.serviced_timer;
+		stats->serviced_inline += wq_stats.serviced_inline;
+		stats->serviced_remote += wq_stats.serviced_remote;
+		stats->steals += wq_stats.steals;
+		stats->stolen += wq_stats.stolen;
+
+		if (wq_stats.imbalance_max > stats->imbalance_max)
+			stats->imbalance_max = wq_stats.imbalance_max;
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * occamstimer_mq.h - Several occamstimer workqueues servicing one
+ * device in parallel
+ *
+ * Each workqueue keeps its own lock, timer and pending and done
+ * queues, so the timers of different workqueues service their
+ * workitems independently, on different CPUs if they are placed
+ * there. Like the workqueue core, this is built both into the kernel
+ * module and into ../libotqueue.
+ */
+#ifndef OCCAMSTIMER_MQ_H
+#define OCCAMSTIMER_MQ_H
+
+#include "occamstimer_queue.h"
+
+
+/**
+ * Work is submitted to the workqueue of the submitting CPU, so a
+ * workqueue can back up while its siblings sit idle. Two things keep
+ * them level:
+ *
+ *   - A workqueue whose timer runs out of pending work steals from
+ *     the tail of the sibling with the most, rather than finishing.
+ *
+ *   - When work is added behind the head of a running workqueue, an
+ *     idle sibling is kicked for each workitem waiting, up to all of
+ *     them, so that their timers steal some of it.
+ *
+ * With a single workqueue neither happens and it behaves exactly as
+ * a lone struct occamstimer_workqueue.
+ *
+ * @nr: The number of workqueues.
+ *
+ * @wqs: The workqueues, each allocated on its own so that their
+ *       locks do not share cache lines.
+ *
+ * @next_get: The workqueue get_work looks at first, so that the
+ *            completed work is taken from each in turn.
+ */
+struct occamstimer_mq {
+	unsigned int                  nr;
+	struct occamstimer_workqueue  **wqs;
+	unsigned int                  next_get;
+};
+
+
+/*
+ * ===============================================
+ *             Multi-queue Interface
+ * ===============================================
+ */
+
+extern int occamstimer_mq_init(struct occamstimer_mq *mq, unsigned int nr);
+extern void occamstimer_mq_destroy(struct occamstimer_mq *mq);
+
+extern struct occamstimer_workqueue *
+occamstimer_mq_queue(struct occamstimer_mq *mq);
+
+extern int occamstimer_mq_get_status(struct occamstimer_mq *mq,
+				     enum occamstimer_status *status);
+extern int occamstimer_mq_set_status(struct occamstimer_mq *mq,
+				     enum occamstimer_status new_status);
+
+extern int occamstimer_mq_start(struct occamstimer_mq *mq);
+extern int occamstimer_mq_pause(struct occamstimer_mq *mq);
+
+extern int occamstimer_mq_add_work(struct occamstimer_mq *mq,
+				   struct occamstimer_workqueue *wq,
+				   struct occamstimer_workitem *work_ptr);
+extern int occamstimer_mq_add_work_list(struct occamstimer_mq *mq,
+					struct occamstimer_workqueue *wq,
+					struct list_head *works);
+extern struct occamstimer_workitem *
+occamstimer_mq_get_work(struct occamstimer_mq *mq);
+extern int occamstimer_mq_has_done(struct occamstimer_mq *mq);
+
+extern int occamstimer_mq_set_inline(struct occamstimer_mq *mq,
+				     unsigned int inline_ns);
+extern unsigned int occamstimer_mq_get_inline(struct occamstimer_mq *mq);
+extern void occamstimer_mq_get_stats(struct occamstimer_mq *mq,
+				     struct occamstimer_stats *stats);
+
+#endif /* OCCAMSTIMER_MQ_H */
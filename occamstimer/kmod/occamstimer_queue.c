@@ -0,0 +1,1285 @@
+/*
+ * occamstimer_queue.c - The occamstimer workqueue state machine
+ *
+ * This file contains everything that operates on a struct
+ * occamstimer_workqueue: adding work, starting and pausing the
+ * simulated device, the timer callback that services the pending
+ * queue, and retrieving completed work. It is linked into the kernel
+ * module and, unchanged, into the userspace libotqueue build.
+ *
+ * All workqueue state is protected by the queue lock, which is also
+ * taken by the timer callback. The lock is always taken with
+ * interrupts disabled so that the callback cannot interrupt a holder
+ * of the lock on the same CPU.
+ */
+#ifdef __KERNEL__
+#include <linux/atomic.h>
+#include <linux/cpumask.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/nodemask.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/time.h>
+#include <linux/topology.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+/* Before 4.16 every hrtimer expires in hardirq context. */
+#define HRTIMER_MODE_SOFT 0
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define OT_HRTIMER_SETUP
+#endif
+#endif /* __KERNEL__ */
+
+#include "occamstimer_queue.h"
+
+
+static enum hrtimer_restart
+occamstimer_workqueue_timer_callback(struct hrtimer *timer);
+static void
+occamstimer_do_work(struct occamstimer_workqueue *wq,
+		    struct occamstimer_workitem *work_ptr);
+
+
+/*
+ * The most workitems serviced inline in one go, so that a long run of
+ * short workitems does not keep interrupts off. The rest are left to
+ * the timer, armed to expire straight away.
+ */
+#define OT_INLINE_BUDGET 64
+
+/*
+ * The most workitems taken from a sibling in one steal, since they
+ * are unlinked one at a time with both queue locks held.
+ */
+#define OT_STEAL_BUDGET 64
+
+
+/*
+ * ===============================================
+ *                Public Interface
+ * ===============================================
+ */
+
+/**
+ * Assumption: Calling context holds the queue lock
+ */
+static void
+__occamstimer_get_status(struct occamstimer_workqueue *wq,
+			 enum occamstimer_status *status) {
+
+        OT_EVENT(FUNC_GET_STATUS_2);
+	*status = wq->status;
+}
+
+/**
+ *
+ */
+int
+occamstimer_wq_get_status(struct occamstimer_workqueue *wq,
+			  enum occamstimer_status *status) {
+
+	unsigned long flags;
+
+	OT_EVENT(FUNC_GET_STATUS_1);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	__occamstimer_get_status(wq, status);
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+
+	return 0;
+}
+
+/**
+ * Assumption: Calling context holds the queue lock
+ */
+static void
+__occamstimer_set_status(struct occamstimer_workqueue *wq,
+			 enum occamstimer_status new_status) {
+	OT_EVENT(FUNC_SET_STATUS_2);
+	OT_DEBUG("status==%d\n", wq->status);
+	OT_DEBUG("new_status==%d\n", new_status);
+	wq->status = new_status;
+
+}
+
+/**
+ *
+ */
+int
+occamstimer_wq_set_status(struct occamstimer_workqueue *wq,
+			  enum occamstimer_status new_status) {
+
+	unsigned long flags;
+
+	OT_EVENT(FUNC_SET_STATUS_1);
+	/*
+	 * Since we want to control concurrent access to our shared
+	 * workqueue we disable interrupts/preemption before
+	 * setting/changing the status.
+	 */
+	spin_lock_irqsave(&wq->lock, flags);
+
+	__occamstimer_set_status(wq, new_status);
+	/* Done reading the status so restore the irq flags to their
+	 * previous state. */
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+
+	return 0;
+
+}
+
+
+/**
+ * Whether @work_ptr is short enough to be serviced inline. Below the
+ * threshold, programming the timer and taking its interrupt costs
+ * more than the interval being simulated.
+ */
+static inline int
+__occamstimer_is_inline(struct occamstimer_workqueue *wq,
+			struct occamstimer_workitem *work_ptr) {
+
+	return work_ptr->value.exec_int.tv_sec == 0 &&
+		work_ptr->value.exec_int.tv_nsec < wq->inline_ns;
+}
+
+
+/**
+ * Service the short workitems at the front of the pending queue right
+ * away, up to OT_INLINE_BUDGET of them, stopping at the first that is
+ * not. Returns how many were serviced.
+ *
+ * Assumption: Calling context holds the queue lock.
+ */
+static unsigned int
+__occamstimer_service_inline(struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workitem *work_ptr;
+	unsigned int count = 0;
+
+	while (count < OT_INLINE_BUDGET && !list_empty(&wq->pending)) {
+
+		work_ptr = list_first_entry(&wq->pending,
+					    struct occamstimer_workitem,
+					    ent);
+		if (!__occamstimer_is_inline(wq, work_ptr))
+			break;
+
+		occamstimer_do_work(wq, work_ptr);
+		count++;
+	}
+
+	wq->stats.serviced_inline += count;
+
+	return count;
+}
+
+
+/**
+ * The interval to program the timer with for the item at the front
+ * of the pending queue: its exec_int, or nothing if it is short
+ * enough to be serviced inline and was only left by the budget.
+ *
+ * Assumption: Calling context holds the queue lock and the pending
+ * queue is not empty.
+ */
+static ktime_t
+__occamstimer_next_interval(struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workitem *work_ptr;
+
+	/* Get the item at the front of the queue */
+	work_ptr = list_first_entry(&wq->pending,
+				    struct occamstimer_workitem,
+				    ent);
+
+	if (__occamstimer_is_inline(wq, work_ptr))
+		return ns_to_ktime(0);
+
+	return ktime_set(work_ptr->value.exec_int.tv_sec,
+			 work_ptr->value.exec_int.tv_nsec);
+}
+
+
+/**
+ * The mode @wq's timer is initialized and armed with.
+ */
+static inline enum hrtimer_mode
+__occamstimer_timer_mode(struct occamstimer_workqueue *wq) {
+
+	enum hrtimer_mode mode = HRTIMER_MODE_ABS;
+
+	if (wq->timer_cfg.soft)
+		mode |= HRTIMER_MODE_SOFT;
+
+	/* Otherwise the kernel may move it to a busier CPU when armed. */
+	if (wq->timer_cfg.cpu >= 0 || wq->node != NUMA_NO_NODE)
+		mode |= HRTIMER_MODE_PINNED;
+
+	return mode;
+}
+
+
+#ifdef __KERNEL__
+/**
+ * The CPU to arm @wq's timer on: the one it is pinned to or, if the
+ * workqueue is bound to another node than this CPU's, one of that
+ * node's. -1 for this CPU.
+ *
+ * Assumption: Calling context holds the queue lock.
+ */
+static int
+__occamstimer_timer_cpu(struct occamstimer_workqueue *wq) {
+
+	int cpu = wq->timer_cfg.cpu;
+
+	if (cpu < 0 && wq->node != NUMA_NO_NODE && wq->node != numa_node_id()) {
+		cpu = cpumask_any_and(cpumask_of_node(wq->node), cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = -1;
+	}
+
+	return cpu;
+}
+#endif /* __KERNEL__ */
+
+
+/**
+ * Arm @wq's timer to expire @interval from now, on the configured CPU
+ * and with the configured slack. A pinned timer fires on the CPU that
+ * armed it, so when that is another CPU it is asked to arm the timer
+ * itself, see occamstimer_remote_arm(). If the CPU has since gone
+ * offline the timer is armed here instead. While the timer is being
+ * set up again it is armed once that is done, see timer_reinit.
+ *
+ * Assumption: Calling context holds the queue lock.
+ */
+static void
+__occamstimer_timer_start(struct occamstimer_workqueue *wq, ktime_t interval) {
+
+	ktime_t expires;
+#ifdef __KERNEL__
+	int cpu;
+	int ret;
+#endif /* __KERNEL__ */
+
+	if (unlikely(wq->timer_reinit)) {
+		wq->timer_deferred = 1;
+		wq->deferred_interval = interval;
+		return;
+	}
+
+	expires = ktime_add(hrtimer_cb_get_time(&wq->timer), interval);
+
+#ifdef __KERNEL__
+	cpu = __occamstimer_timer_cpu(wq);
+
+	if (cpu >= 0 && cpu != smp_processor_id()) {
+
+		wq->remote_expires = expires;
+
+		ret = smp_call_function_single_async(cpu, &wq->remote_arm);
+		if (!ret)
+			wq->remote_pending++;
+
+		/*
+		 * -EBUSY means one sent earlier has yet to run, and it
+		 * arms the timer for the remote_expires just set.
+		 */
+		if (ret != -ENXIO)
+			return;
+	}
+#endif /* __KERNEL__ */
+
+	hrtimer_start_range_ns(&wq->timer, expires, wq->timer_cfg.slack_ns,
+			       __occamstimer_timer_mode(wq));
+}
+
+
+#ifdef __KERNEL__
+/**
+ * Sent by __occamstimer_timer_start() to run on the configured CPU,
+ * in interrupt context, and arm the timer there. The workqueue may
+ * have been paused since, or its timer be being set up again, in
+ * which case the timer is left alone.
+ */
+static void
+occamstimer_remote_arm(void *info) {
+
+	struct occamstimer_workqueue *wq = info;
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if (wq->status == OT_RUNNING && !wq->timer_reinit)
+		hrtimer_start_range_ns(&wq->timer, wq->remote_expires,
+				       wq->timer_cfg.slack_ns,
+				       __occamstimer_timer_mode(wq));
+
+	wq->remote_pending--;
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+#endif /* __KERNEL__ */
+
+
+/**
+ * Service the short workitems at the front of the pending queue
+ * inline, then start the timer for the item left at the front and
+ * change the status to OT_RUNNING, or to OT_FINISHED if none is
+ * left. Returns how many were serviced inline, for the caller to
+ * notify of once it has released the lock.
+ *
+ * The expiration is calculated on the absolute timeline of the
+ * timer's clock as now + exec_int. The workitem's exec_int is left untouched so that it
+ * still describes the simulated interval when the item is handed back
+ * to the user, and so that a paused item is restarted with its full
+ * interval.
+ *
+ * Assumption: Calling context holds the queue lock and the pending
+ * queue is not empty.
+ */
+static unsigned int
+__occamstimer_arm(struct occamstimer_workqueue *wq) {
+
+	unsigned int serviced;
+
+	serviced = __occamstimer_service_inline(wq);
+
+	if (list_empty(&wq->pending)) {
+		__occamstimer_set_status(wq, OT_FINISHED);
+		return serviced;
+	}
+
+	__occamstimer_set_status(wq, OT_RUNNING);
+
+	/* This overrides any kick, and times our own workitem. */
+	wq->kicked = 0;
+
+	__occamstimer_timer_start(wq, __occamstimer_next_interval(wq));
+
+	return serviced;
+}
+
+
+/**
+ * Tell the workqueue's owner about @count workitems just put on the
+ * done queue.
+ *
+ * Assumption: Calling context does not hold the queue lock.
+ */
+static inline void
+occamstimer_wq_notify(struct occamstimer_workqueue *wq, unsigned int count) {
+
+	if (count && wq->notify)
+		wq->notify(wq, count);
+}
+
+
+/**
+ *
+ */
+int
+occamstimer_wq_start(struct occamstimer_workqueue *wq) {
+
+	int ret = 0;
+	unsigned int serviced = 0;
+	unsigned long flags;
+
+	OT_EVENT(FUNC_START);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	switch (wq->status) {
+
+	case OT_SETUP:
+	case OT_FINISHED:
+		OT_INFO("case=setup||finished");
+		if (list_empty(&wq->pending)) {
+			OT_INFO("list_empty(pending)!");
+			break;
+		}
+
+		serviced = __occamstimer_arm(wq);
+		break;
+
+	case OT_STOPPED:
+		OT_INFO("case=stop");
+		/* If somehow the queue became empty while stopped,
+		 * flip out since this indicates undesired operation
+		 * and a serious logic since the queue items should
+		 * not be able to be removed whiled stopped..
+		 */
+		BUG_ON(list_empty(&wq->pending));
+
+		/* Start the timer. A smarter routine would restart
+		 * the item at the front of the queue with the time
+		 * remaining when it was stopped during the last
+		 * "pause", see occamstimer_wq_pause().
+		 */
+		serviced = __occamstimer_arm(wq);
+		break;
+
+	default:
+		OT_INFO("case==default");
+		ret = -EINVAL;
+		break;
+	}
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	occamstimer_wq_notify(wq, serviced);
+
+	return ret;
+
+}
+
+
+
+/**
+ * if OT_RUNNING, stop the timer and change the status to OT_STOPPED.
+ */
+int
+occamstimer_wq_pause(struct occamstimer_workqueue *wq) {
+	int ret = 0;
+	unsigned long flags;
+
+	OT_EVENT(FUNC_PAUSE);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	switch (wq->status) {
+	case OT_RUNNING:
+		/* Note: a smarter routine would get the remaining
+		 * time for the timer using hrtimer_get_remaining()
+		 * and set the item at the front of the pending
+		 * workqueue to have the remaining time as its new
+		 * execution interval so on the next
+		 * "occamstimer_start()" the timer would be started
+		 * with the remaining time instead of the full
+		 * execution interval again.
+		 *
+		 * We cannot wait for a running callback with
+		 * hrtimer_cancel() since the callback spins on the
+		 * lock we are holding. If the callback is already
+		 * running it will find the workqueue OT_STOPPED and
+		 * not restart the timer; occamstimer_wq_set_timer()
+		 * cancels a timer restarted by one that had already
+		 * decided to. A timer being set up again has not been
+		 * armed yet, so it only needs to stay that way.
+		 */
+		if (wq->timer_reinit)
+			wq->timer_deferred = 0;
+		else
+			hrtimer_try_to_cancel(&wq->timer);
+
+		/*
+		 * A workqueue kicked to steal has nothing of its own
+		 * to pause, so it is simply idle again.
+		 */
+		if (list_empty(&wq->pending))
+			__occamstimer_set_status(wq, OT_FINISHED);
+		else
+			__occamstimer_set_status(wq, OT_STOPPED);
+		break;
+	case OT_SETUP:
+	case OT_STOPPED:
+	case OT_FINISHED:
+		/* When not running there is no change of state. */
+		break;
+
+	case OT_ITEM_SERVICE:
+		WARN(1, "Tried to pause while in timer callback. This should not happen\n.");
+		/* "Operation not permitted"s (EPERM) or "Device busy" (EBUSY)?  */
+		ret = -EPERM;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return ret;
+}
+
+/**
+ * Add the workitems on @works to the end of the pending queue, leaving
+ * @works empty. If the workqueue had finished, it is restarted and
+ * the short workitems at the front serviced inline; @serviced is set
+ * to how many.
+ *
+ * Assumption: calling context holds the queue lock.
+ *
+ * @works: A list of workitems linked through their ent.
+ */
+static int
+__occamstimer_add_work(struct occamstimer_workqueue *wq,
+		       struct list_head *works, unsigned int *serviced) {
+
+	int ret = 0;
+	unsigned int count = 0;
+	struct list_head *pos;
+
+	OT_EVENT(FUNC_ADD_WORK_2);
+
+	list_for_each(pos, works)
+		count++;
+
+	switch (wq->status) {
+	case OT_SETUP:
+	case OT_STOPPED:
+	case OT_RUNNING:
+		/*
+		 * Add the new items to the end of the list in order
+		 * to provide queueing semantics.
+		 */
+		list_splice_tail_init(works, &wq->pending);
+		WRITE_ONCE(wq->nr_pending, wq->nr_pending + count);
+		break;
+
+	case OT_FINISHED:
+		list_splice_tail_init(works, &wq->pending);
+		WRITE_ONCE(wq->nr_pending, wq->nr_pending + count);
+		*serviced = __occamstimer_arm(wq);
+		break;
+
+	default:
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Add an already allocated and initialized workitem to the pending
+ * queue. On success the workqueue owns @work_ptr, otherwise the
+ * caller must free it.
+ *
+ * Work may be added while the workqueue is running, in which case it
+ * is serviced after the items already pending. Adding work to a
+ * finished workqueue restarts it, so a producer can keep a started
+ * device busy without racing the timer to call start again.
+ *
+ * @work_ptr: The workitem whose value was filled in by the caller.
+ */
+int
+occamstimer_wq_add_work(struct occamstimer_workqueue *wq,
+			struct occamstimer_workitem *work_ptr) {
+
+	LIST_HEAD(works);
+
+	list_add_tail(&work_ptr->ent, &works);
+
+	return occamstimer_wq_add_work_list(wq, &works);
+}
+
+
+/**
+ * Add every workitem on @works to the pending queue under one
+ * acquisition of the queue lock, in list order. On success the
+ * workqueue owns the workitems and @works is left empty, otherwise
+ * the caller still owns all of them.
+ *
+ * @works: A list of initialized workitems linked through their ent.
+ */
+int
+occamstimer_wq_add_work_list(struct occamstimer_workqueue *wq,
+			     struct list_head *works) {
+
+	int     ret = 0;
+	unsigned int serviced = 0;
+	unsigned long flags;
+
+	OT_EVENT(FUNC_ADD_WORK_1);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	ret = __occamstimer_add_work(wq, works, &serviced);
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	occamstimer_wq_notify(wq, serviced);
+
+	return ret;
+}
+
+
+/**
+ * Service the specific workitem
+ */
+static void
+occamstimer_do_work(struct occamstimer_workqueue *wq,
+		    struct occamstimer_workitem *work_ptr){
+
+	int node;
+
+	OT_EVENT(FUNC_DO_WORK);
+	/* TODO: add extra stuff? A dummy loop? */
+	OT_DEBUG("[%d] data: %s\n", __LINE__, work_ptr->value.data);
+	list_move_tail(&work_ptr->ent, &wq->done);
+	WRITE_ONCE(wq->nr_pending, wq->nr_pending - 1);
+
+	/*
+	 * A workitem allocated on another node than this CPU's had
+	 * to be fetched across the interconnect to be serviced.
+	 */
+	node = numa_node_id();
+	if (page_to_nid(virt_to_page(work_ptr)) != node)
+		wq->stats.serviced_remote++;
+
+	WRITE_ONCE(wq->service_node, node);
+
+	/* The page may be shared with sibling workqueues. */
+	if (wq->seq)
+		atomic64_inc((atomic64_t *)&wq->seq->completed);
+
+}
+
+
+/**
+ * The node to allocate @wq's workitems on: the node it is bound to,
+ * else that of the CPU its timer is pinned to, else that of the CPU
+ * it last serviced a workitem on. Until it has, NUMA_NO_NODE, which
+ * allocates on the caller's node.
+ *
+ * The fields are read without the lock; a workitem allocated on the
+ * old node around a change is only counted as remote.
+ */
+static int
+occamstimer_wq_alloc_node(struct occamstimer_workqueue *wq) {
+
+	int node, cpu;
+
+	node = READ_ONCE(wq->node);
+	if (node != NUMA_NO_NODE)
+		return node;
+
+	cpu = READ_ONCE(wq->timer_cfg.cpu);
+	if (cpu >= 0)
+		return cpu_to_node(cpu);
+
+	return READ_ONCE(wq->service_node);
+}
+
+
+/**
+ * Allocate an uninitialized workitem for @wq on the node it will be
+ * serviced on, see occamstimer_wq_alloc_node(), so that the timer
+ * callback does not service it from another node's memory. It is
+ * freed with kfree(). Returns NULL if there is no memory.
+ */
+struct occamstimer_workitem *
+occamstimer_wq_alloc_work(struct occamstimer_workqueue *wq) {
+
+	return kmalloc_node(sizeof(struct occamstimer_workitem), GFP_KERNEL,
+			    occamstimer_wq_alloc_node(wq));
+}
+
+
+/**
+ * Remove the first workitem from the done queue and return it, or
+ * NULL if there is no completed work. The caller owns the returned
+ * workitem and must kfree() it.
+ */
+struct occamstimer_workitem *
+occamstimer_wq_get_work(struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workitem *work_ptr = NULL;
+	unsigned long flags;
+
+	OT_EVENT(FUNC_GET_WORK);
+
+	spin_lock_irqsave(&wq->lock, flags);
+	if (!list_empty(&wq->done)) {
+		/* Get the list entry for the first workitem in the
+		 * done queue and delete it from the done list. */
+		work_ptr = list_first_entry(&wq->done,
+					    struct occamstimer_workitem, ent);
+		list_del(&work_ptr->ent);
+	}
+	/* Finished modifying the queue so give up the lock. */
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return work_ptr;
+}
+
+
+/**
+ * Whether completed work is waiting on the done queue, without taking
+ * any of it.
+ */
+int
+occamstimer_wq_has_done(struct occamstimer_workqueue *wq) {
+
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	ret = !list_empty(&wq->done);
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return ret;
+}
+
+
+/**
+ * Set the threshold below which workitems are serviced inline, see
+ * struct occamstimer_workqueue. It applies to workitems as they reach
+ * the front of the pending queue from now on.
+ *
+ * @inline_ns: The threshold in nanoseconds, less than a second. 0
+ *             disables inline servicing.
+ */
+int
+occamstimer_wq_set_inline(struct occamstimer_workqueue *wq,
+			  unsigned int inline_ns) {
+
+	unsigned long flags;
+
+	if (inline_ns >= NSEC_PER_SEC)
+		return -EINVAL;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	wq->inline_ns = inline_ns;
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return 0;
+}
+
+
+unsigned int
+occamstimer_wq_get_inline(struct occamstimer_workqueue *wq) {
+
+	unsigned long flags;
+	unsigned int inline_ns;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	inline_ns = wq->inline_ns;
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return inline_ns;
+}
+
+
+void
+occamstimer_wq_get_stats(struct occamstimer_workqueue *wq,
+			 struct occamstimer_stats *stats) {
+
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	*stats = wq->stats;
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+
+/**
+ * Wake @wq if it is idle, finished or never given work, to steal
+ * from its siblings. Its timer is armed to expire straight away and
+ * the callback, finding that it was kicked rather than timing a
+ * workitem, steals; if there is nothing to steal the workqueue is
+ * finished again. Returns whether @wq was idle.
+ */
+int
+occamstimer_wq_kick(struct occamstimer_workqueue *wq) {
+
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if ((wq->status == OT_SETUP || wq->status == OT_FINISHED) &&
+	    list_empty(&wq->pending) && wq->nr_siblings > 1) {
+		__occamstimer_set_status(wq, OT_RUNNING);
+		wq->kicked = 1;
+		__occamstimer_timer_start(wq, 0);
+		ret = 1;
+	}
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return ret;
+}
+
+
+/**
+ * Take up to half of the workitems waiting behind the head of the
+ * most loaded sibling of @wq, from the tail of its pending queue, and
+ * add them in order to the tail of @wq's. The head is left alone
+ * since the sibling's timer is timing it, as is a sibling that is not
+ * running. Returns how many were taken.
+ *
+ * The sibling's lock is taken while holding @wq's, and a sibling may
+ * be stealing from us at the same time. The locks are therefore
+ * ordered by index: a sibling after us is waited for, one before us
+ * is only tried and given up on if it is held.
+ *
+ * Assumption: Calling context holds the queue lock with interrupts
+ * disabled.
+ */
+static unsigned int
+__occamstimer_steal(struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workqueue  *victim = NULL, *sib;
+	unsigned int                  i, load, max_load = 1, take = 0;
+	LIST_HEAD(stolen);
+
+	for (i = 0; i < wq->nr_siblings; i++) {
+		sib = wq->siblings[i];
+		load = READ_ONCE(sib->nr_pending);
+		if (sib != wq && load > max_load) {
+			victim = sib;
+			max_load = load;
+		}
+	}
+
+	if (!victim)
+		return 0;
+
+	if (victim->index > wq->index)
+		spin_lock_nested(&victim->lock, SINGLE_DEPTH_NESTING);
+	else if (!spin_trylock(&victim->lock))
+		return 0;
+
+	/* It may have been serviced or paused since we looked. */
+	load = victim->nr_pending;
+	if (victim->status == OT_RUNNING && load > 1)
+		take = load / 2 < OT_STEAL_BUDGET ? load / 2 : OT_STEAL_BUDGET;
+
+	for (i = 0; i < take; i++)
+		list_move(victim->pending.prev, &stolen);
+
+	WRITE_ONCE(victim->nr_pending, load - take);
+
+	spin_unlock(&victim->lock);
+
+	if (!take)
+		return 0;
+
+	list_splice_tail_init(&stolen, &wq->pending);
+	WRITE_ONCE(wq->nr_pending, wq->nr_pending + take);
+
+	wq->stats.steals++;
+	wq->stats.stolen += take;
+	if (load > wq->stats.imbalance_max)
+		wq->stats.imbalance_max = load;
+
+	return take;
+}
+
+
+/**
+ * Initialize @wq's timer for its timer_cfg.
+ */
+static void
+__occamstimer_timer_init(struct occamstimer_workqueue *wq) {
+
+	/*
+	 * Timer - Note that we initialize the timer to absolute
+	 * timeframe mode and set the appropriate handler routine, but
+	 * do not start it. Since 6.13 the handler is given to
+	 * hrtimer_setup(), and hrtimer_init() is gone from 6.15.
+	 */
+#ifdef OT_HRTIMER_SETUP
+	hrtimer_setup(&wq->timer, occamstimer_workqueue_timer_callback,
+		      wq->timer_cfg.clock,
+		      __occamstimer_timer_mode(wq) & ~HRTIMER_MODE_PINNED);
+#else
+	hrtimer_init(&wq->timer, wq->timer_cfg.clock,
+		     __occamstimer_timer_mode(wq) & ~HRTIMER_MODE_PINNED);
+
+	wq->timer.function = occamstimer_workqueue_timer_callback;
+#endif
+}
+
+
+/**
+ * Change how @wq's timer is set up, see struct
+ * occamstimer_timer_config. The workqueue must not be running, since
+ * the timer is initialized again for a new clock or mode; the change
+ * takes effect when it is next started.
+ *
+ * Returns -EBUSY if the workqueue is running, or -EINVAL if @cfg
+ * names a clock other than those listed or a CPU that is not online.
+ */
+int
+occamstimer_wq_set_timer(struct occamstimer_workqueue *wq,
+			 const struct occamstimer_timer_config *cfg) {
+
+	unsigned long flags;
+	int reinit = 0, ret = 0;
+
+	if (cfg->clock != CLOCK_MONOTONIC && cfg->clock != CLOCK_REALTIME &&
+	    cfg->clock != CLOCK_BOOTTIME)
+		return -EINVAL;
+
+	if (cfg->cpu < -1 || cfg->cpu >= (int)nr_cpu_ids ||
+	    (cfg->cpu >= 0 && !cpu_online(cfg->cpu)))
+		return -EINVAL;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	/*
+	 * A callback that found the workqueue paused, or finished the
+	 * last workitem, may still be on its way out. One that had
+	 * decided to restart the timer before a pause re-arms it as it
+	 * returns, after the pause failed to cancel it. Cancel until
+	 * the timer is neither running nor queued, so that it is not
+	 * set up again under either.
+	 */
+	for (;;) {
+		if (wq->status == OT_RUNNING || wq->status == OT_ITEM_SERVICE ||
+		    wq->timer_reinit) {
+			ret = -EBUSY;
+			goto out;
+		}
+
+		if (hrtimer_try_to_cancel(&wq->timer) >= 0)
+			break;
+
+		spin_unlock_irqrestore(&wq->lock, flags);
+		cpu_relax();
+		spin_lock_irqsave(&wq->lock, flags);
+	}
+
+	/* A pinned timer must be on the node the workqueue is bound to. */
+	if (cfg->cpu >= 0 && wq->node != NUMA_NO_NODE &&
+	    cpu_to_node(cfg->cpu) != wq->node) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	reinit = cfg->clock != wq->timer_cfg.clock ||
+		!cfg->soft != !wq->timer_cfg.soft;
+
+	wq->timer_cfg = *cfg;
+	wq->timer_reinit = reinit;
+
+out:
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	if (ret || !reinit)
+		return ret;
+
+	/*
+	 * The timer is idle and timer_reinit keeps it so, so it is set
+	 * up again without the lock: the userspace timer is destroyed
+	 * by joining its thread, which must not be left waiting on
+	 * the lock. Work started or kicked meanwhile arms it after.
+	 */
+#ifndef __KERNEL__
+	hrtimer_destroy(&wq->timer);
+#endif /* __KERNEL__ */
+	__occamstimer_timer_init(wq);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	wq->timer_reinit = 0;
+	if (wq->timer_deferred) {
+		wq->timer_deferred = 0;
+		if (wq->status == OT_RUNNING)
+			__occamstimer_timer_start(wq, wq->deferred_interval);
+	}
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return 0;
+}
+
+
+void
+occamstimer_wq_get_timer(struct occamstimer_workqueue *wq,
+			 struct occamstimer_timer_config *cfg) {
+
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	*cfg = wq->timer_cfg;
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+
+/**
+ * Bind @wq to NUMA node @node, or unbind it with NUMA_NO_NODE, see
+ * struct occamstimer_workqueue. Workitems already allocated stay
+ * where they are. Like the timer, this may only be changed while the
+ * workqueue is not running.
+ *
+ * @wq itself is not moved to @node. Its siblings and the device hold
+ * pointers to it, and a remote arm may still be on its way to its
+ * timer, so it could only be replaced once all of those were retired.
+ * What is touched per workitem is the workitem, which is allocated on
+ * @node from now on; @wq is a few cache lines taken with the lock.
+ * The stats file of the device's workqueues shows which node it is
+ * on, see occamstimer_wq_mem_node().
+ *
+ * Returns -EBUSY if the workqueue is running, or -EINVAL if @node is
+ * not online or its timer is pinned to a CPU of another node.
+ */
+int
+occamstimer_wq_set_node(struct occamstimer_workqueue *wq, int node) {
+
+	unsigned long flags;
+	int ret = 0;
+
+	if (node < NUMA_NO_NODE || node >= (int)nr_node_ids ||
+	    (node != NUMA_NO_NODE && !node_online(node)))
+		return -EINVAL;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if (wq->status == OT_RUNNING || wq->status == OT_ITEM_SERVICE)
+		ret = -EBUSY;
+	else if (node != NUMA_NO_NODE && wq->timer_cfg.cpu >= 0 &&
+		 cpu_to_node(wq->timer_cfg.cpu) != node)
+		ret = -EINVAL;
+	else
+		WRITE_ONCE(wq->node, node);
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	return ret;
+}
+
+
+int
+occamstimer_wq_get_node(struct occamstimer_workqueue *wq) {
+
+	return READ_ONCE(wq->node);
+}
+
+
+/**
+ * The node @wq's own memory, its lock, list heads and stats, is on.
+ */
+int
+occamstimer_wq_mem_node(struct occamstimer_workqueue *wq) {
+
+	return page_to_nid(virt_to_page(wq));
+}
+
+
+
+
+
+/*
+ * ===============================================
+ *                 Interrupt Handlers
+ * ===============================================
+ */
+
+/**
+ * The timer's handler function/
+ */
+static enum hrtimer_restart
+occamstimer_workqueue_timer_callback(struct hrtimer *timer) {
+
+	struct occamstimer_workqueue   *wq;
+	unsigned long                  flags;
+	unsigned int                   serviced = 0;
+
+	OT_EVENT(FUNC_WORKQUEUE_TIMER_CALLBACK);
+
+	wq = container_of(timer, struct occamstimer_workqueue, timer);
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if (unlikely(wq->status == OT_STOPPED ||
+		     (wq->kicked && wq->status == OT_FINISHED))) {
+		/*
+		 * We fired while occamstimer_wq_pause() held the lock
+		 * and tried to cancel us. The pause wins.
+		 */
+		wq->kicked = 0;
+		goto norestart;
+	}
+
+	if (unlikely(wq->status != OT_RUNNING)) {
+
+		OT_DEBUG("status==%d\n", wq->status);
+
+		WARN(1, "Timer callback activated when (status != OT_RUNNING). "
+		        "This should not happen - timer will not be restarted.\n");
+		goto norestart;
+
+	}
+
+	__occamstimer_set_status(wq, OT_ITEM_SERVICE);
+
+	/*
+	 * A kicked workqueue was not timing a workitem of its own, so
+	 * there is nothing to service yet; it goes straight to looking
+	 * for work below. Work added to it since is timed from now.
+	 */
+	if (likely(!wq->kicked)) {
+
+		if (unlikely(list_empty(&wq->pending))) {
+			WARN(1, "Timer callback activated when (pending queue is empty). "
+			        "This should not happen - timer will not be restarted.\n");
+			__occamstimer_set_status(wq, OT_FINISHED);
+			goto norestart;
+		}
+
+		occamstimer_do_work(wq, list_first_entry(&wq->pending,
+							 struct occamstimer_workitem, ent));
+		wq->stats.serviced_timer++;
+		serviced = 1;
+	}
+
+	wq->kicked = 0;
+
+	/* The timer is only programmed again for a long workitem. */
+	serviced += __occamstimer_service_inline(wq);
+
+	/* Rather than go idle, take over some of a busy sibling's work. */
+	if (list_empty(&wq->pending) && __occamstimer_steal(wq))
+		serviced += __occamstimer_service_inline(wq);
+
+	if (unlikely(list_empty(&wq->pending))) {
+		__occamstimer_set_status(wq, OT_FINISHED);
+		goto norestart;
+	}
+
+	/* Set the new expiration of the timer to the current time
+	 * (on the timer's clock) plus the execution interval fo the
+	 * next work item. The timer is restarted on this CPU. */
+	hrtimer_forward(timer, hrtimer_cb_get_time(timer),
+			__occamstimer_next_interval(wq));
+
+	__occamstimer_set_status(wq, OT_RUNNING);
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	occamstimer_wq_notify(wq, serviced);
+
+	return HRTIMER_RESTART;
+
+
+
+
+
+norestart:
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	occamstimer_wq_notify(wq, serviced);
+
+	return HRTIMER_NORESTART;
+}
+
+
+/*
+ * ===============================================
+ *            Workqueue init/destroy
+ * ===============================================
+ */
+
+/**
+ * Initialize an empty workqueue in the OT_SETUP state.
+ */
+void
+occamstimer_wq_init(struct occamstimer_workqueue *wq) {
+
+	wq->status = OT_SETUP;
+	wq->inline_ns = 0;
+	memset(&wq->stats, 0, sizeof(wq->stats));
+	wq->seq = NULL;
+	wq->notify = NULL;
+
+	wq->timer_cfg.clock = CLOCK_MONOTONIC;
+	wq->timer_cfg.soft = 0;
+	wq->timer_cfg.cpu = -1;
+	wq->timer_cfg.slack_ns = 0;
+
+	wq->node = NUMA_NO_NODE;
+	wq->service_node = NUMA_NO_NODE;
+
+	wq->nr_pending = 0;
+	wq->siblings = NULL;
+	wq->nr_siblings = 0;
+	wq->index = 0;
+	wq->kicked = 0;
+	wq->timer_reinit = 0;
+	wq->timer_deferred = 0;
+	wq->deferred_interval = 0;
+
+	spin_lock_init(&wq->lock);
+
+	/*
+	 * The lists that will function the pending work queue and
+	 * completed work queue.
+	 */
+	INIT_LIST_HEAD(&wq->pending);
+	INIT_LIST_HEAD(&wq->done);
+
+	__occamstimer_timer_init(wq);
+
+#ifdef __KERNEL__
+	wq->remote_pending = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+	INIT_CSD(&wq->remote_arm, occamstimer_remote_arm, wq);
+#else
+	memset(&wq->remote_arm, 0, sizeof(wq->remote_arm));
+	wq->remote_arm.func = occamstimer_remote_arm;
+	wq->remote_arm.info = wq;
+#endif
+#endif /* __KERNEL__ */
+}
+
+
+/**
+ * Stop the timer and free every workitem still on the workqueue.
+ */
+void
+occamstimer_wq_destroy(struct occamstimer_workqueue *wq) {
+
+	struct occamstimer_workitem *work_ptr, *tmp;
+	unsigned long flags;
+
+	/* 
+	 * No new work can arrive here. Stop the workqueue so that a
+	 * callback that has already fired does not restart the timer,
+	 * and wait it out before tearing the lists down.
+	 */
+	spin_lock_irqsave(&wq->lock, flags);
+	__occamstimer_set_status(wq, OT_STOPPED);
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	hrtimer_cancel(&wq->timer);
+
+#ifdef __KERNEL__
+	/* Nor may a remote arm still be on its way to another CPU. */
+	spin_lock_irqsave(&wq->lock, flags);
+	while (wq->remote_pending) {
+		spin_unlock_irqrestore(&wq->lock, flags);
+		cpu_relax();
+		spin_lock_irqsave(&wq->lock, flags);
+	}
+	spin_unlock_irqrestore(&wq->lock, flags);
+#endif /* __KERNEL__ */
+
+	list_for_each_entry_safe(work_ptr, tmp, &wq->pending, ent) {
+		list_del(&work_ptr->ent);
+		kfree(work_ptr);
+	}
+
+	list_for_each_entry_safe(work_ptr, tmp, &wq->done, ent) {
+		list_del(&work_ptr->ent);
+		kfree(work_ptr);
+	}
+
+#ifndef __KERNEL__
+	hrtimer_destroy(&wq->timer);
+	spin_lock_destroy(&wq->lock);
+#endif /* __KERNEL__ */
+}
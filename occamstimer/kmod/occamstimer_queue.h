@@ -0,0 +1,233 @@
+/*
+ * occamstimer_queue.h - The occamstimer workqueue state machine
+ *
+ * The workqueue core is written against the kernel list, spinlock,
+ * ktime and hrtimer interfaces. When it is compiled as part of the
+ * kernel module those are the real thing. When it is compiled outside
+ * of the kernel (see ../libotqueue) the same names are provided by
+ * otcompat.h, which backs the hrtimer with a timerfd and the
+ * spinlocks with pthreads. This lets us exercise and benchmark the
+ * queue logic without root or loading the module.
+ */
+#ifndef OCCAMSTIMER_QUEUE_H
+#define OCCAMSTIMER_QUEUE_H
+
+#ifdef __KERNEL__
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/smp.h>
+#include <linux/spinlock_types.h>
+
+/* See the comment in occamstimer_dev.c about this relative include. */
+#include "../include/linux/occamstimer.h"
+#else
+#include "otcompat.h"
+#include <linux/occamstimer.h>
+#endif /* __KERNEL__ */
+
+
+/*
+ * This/These structure(s) creates the list that we will use as a
+ * workqueue. Note that we do not use the linux kernel standard
+ * workqueues since this is an example of timer use and the workqueue
+ * structure at linux/workqueue.h has many assumptions that, while
+ * generally good, hide many features at a higher level of abstraction
+ * than would be desired for an example of how to use kernel timers in
+ * order to simulate a device driver to do some work.
+ */
+
+
+/**
+ * @value: The data buffer containing the specific "work" and the
+ *         execution interval of the workitem, which is the simulation
+ *         duration that the workitem would take. This is the same
+ *         struct the user passes to the add_work IOCTL so that the
+ *         arguments can be copied from userspace directly into the
+ *         allocated workitem, and the completed work copied directly
+ *         back out of it.
+ *
+ * @ent: The entry of the workitem on either the pending or the done
+ *       queue.
+ */
+struct occamstimer_workitem {
+	struct occamstimer_ioctl_work_params  value;
+	struct list_head                      ent;
+};
+
+
+/**
+ * How the timer of a workqueue is set up, see
+ * occamstimer_wq_set_timer().
+ *
+ * @clock: The clock the expirations are on: CLOCK_MONOTONIC (the
+ *         default), CLOCK_REALTIME or CLOCK_BOOTTIME.
+ *
+ * @soft: Expire in softirq rather than hardirq context. The
+ *        expiration is serviced later, but along with the other
+ *        softirq work on the CPU rather than in an interrupt of its
+ *        own.
+ *
+ * @cpu: The CPU the timer is armed on, and so fires on, or -1 (the
+ *       default) to arm it wherever the workqueue is started and let
+ *       the kernel move it.
+ *
+ * @slack_ns: How late the timer may fire, so that its expirations
+ *            can be coalesced with those of other timers. 0 (the
+ *            default) fires as close to the expiration as possible.
+ *
+ * The userspace build honors the clock only.
+ */
+struct occamstimer_timer_config {
+	clockid_t           clock;
+	int                 soft;
+	int                 cpu;
+	unsigned long long  slack_ns;
+};
+
+
+/**
+ * @lock: atomic spin_lock that protects the physically concurrent
+ *        access to this structure. Interrupt concurrency in
+ *        controlled on the thread side by enabling and disabling
+ *        interrupts.
+ *
+ * @timer: Periodic timer who's handler routine operates on pending
+ *         workitems. This handler routine simulates the ISR for a
+ *         generic device driver which is operating on the
+ *         workqueue. The expiration of a pending timer is the time at
+ *         which the item at the front of the workqueue should be
+ *         serviced.
+ *
+ * @status: State variable indicating the current state of the
+ *          workqueue. The value of this variable is drawn from the
+ *          enum occamstimer_status.
+ *
+ * @pending: The pending work items are enqueued to this list
+ *           structure. During the execution of the timer handler
+ *           routine, the first item will be dequeued and
+ *           serviced.
+ *
+ * @done: Work items serviced from the pending queue are enqueued on
+ *        to this list after being serviced.
+ *
+ * @inline_ns: Workitems whose exec_int is less than this many
+ *             nanoseconds are serviced inline, as soon as they reach
+ *             the front of the pending queue, instead of programming
+ *             the timer for them. 0 disables this.
+ *
+ * @stats: Counts of the workitems serviced by the timer and inline.
+ *
+ * @seq: If set, the page on which the number of workitems put on
+ *       @done is published. It is advanced under the lock as each
+ *       one is.
+ *
+ * @notify: If set, called after the queue lock has been released
+ *          with the number of workitems just put on @done. It is
+ *          called from the timer callback, in the timer's (interrupt)
+ *          context, and from the add and start calls that service
+ *          workitems inline.
+ *
+ * @timer_cfg: How @timer is set up.
+ *
+ * @node: The NUMA node the workqueue is bound to, or NUMA_NO_NODE.
+ *        Its workitems are allocated there and, unless @timer_cfg
+ *        pins it to a CPU, its timer is armed on a CPU there.
+ *
+ * @service_node: The node of the CPU the last workitem was serviced
+ *                on, or NUMA_NO_NODE before the first.
+ *
+ * @nr_pending: The number of workitems on @pending. It is read
+ *              without the lock by siblings looking for work.
+ *
+ * @siblings: The @nr_siblings workqueues, including this one at
+ *            @index, that this one steals work from when it runs out,
+ *            see struct occamstimer_mq. A lone workqueue has none.
+ *
+ * @kicked: The timer was armed by occamstimer_wq_kick() rather than
+ *          for a workitem of this workqueue.
+ *
+ * @timer_reinit: Set while occamstimer_wq_set_timer() sets @timer up
+ *                again with the lock dropped. Nothing touches @timer
+ *                meanwhile; if it is to be armed, @timer_deferred is
+ *                set and it is armed @deferred_interval from when it
+ *                is ready.
+ *
+ * @remote_arm: Kernel only. Sent to @timer_cfg.cpu to arm @timer
+ *              there for @remote_expires, since an hrtimer can only
+ *              be armed on the CPU it is to fire on.
+ *              @remote_pending counts those sent that have not run.
+ */
+struct occamstimer_workqueue {
+	spinlock_t                       lock;
+	struct hrtimer                   timer;
+	enum occamstimer_status          status;
+	struct list_head                 pending;
+	struct list_head                 done;
+	unsigned int                     inline_ns;
+	struct occamstimer_stats         stats;
+	struct occamstimer_seq_page      *seq;
+	void                             (*notify)(struct occamstimer_workqueue *wq,
+						   unsigned int count);
+	struct occamstimer_timer_config  timer_cfg;
+	int                              node;
+	int                              service_node;
+	unsigned int                     nr_pending;
+	struct occamstimer_workqueue     **siblings;
+	unsigned int                     nr_siblings;
+	unsigned int                     index;
+	int                              kicked;
+	int                              timer_reinit;
+	int                              timer_deferred;
+	ktime_t                          deferred_interval;
+#ifdef __KERNEL__
+	call_single_data_t               remote_arm;
+	ktime_t                          remote_expires;
+	unsigned int                     remote_pending;
+#endif /* __KERNEL__ */
+};
+
+
+/*
+ * ===============================================
+ *             Workqueue Interface
+ * ===============================================
+ */
+
+extern void occamstimer_wq_init(struct occamstimer_workqueue *wq);
+extern void occamstimer_wq_destroy(struct occamstimer_workqueue *wq);
+
+extern int occamstimer_wq_get_status(struct occamstimer_workqueue *wq,
+				     enum occamstimer_status *status);
+extern int occamstimer_wq_set_status(struct occamstimer_workqueue *wq,
+				     enum occamstimer_status new_status);
+
+extern int occamstimer_wq_start(struct occamstimer_workqueue *wq);
+extern int occamstimer_wq_pause(struct occamstimer_workqueue *wq);
+
+extern int occamstimer_wq_add_work(struct occamstimer_workqueue *wq,
+				   struct occamstimer_workitem *work_ptr);
+extern int occamstimer_wq_add_work_list(struct occamstimer_workqueue *wq,
+					struct list_head *works);
+extern struct occamstimer_workitem *
+occamstimer_wq_alloc_work(struct occamstimer_workqueue *wq);
+extern struct occamstimer_workitem *
+occamstimer_wq_get_work(struct occamstimer_workqueue *wq);
+extern int occamstimer_wq_has_done(struct occamstimer_workqueue *wq);
+extern int occamstimer_wq_kick(struct occamstimer_workqueue *wq);
+
+extern int occamstimer_wq_set_inline(struct occamstimer_workqueue *wq,
+				     unsigned int inline_ns);
+extern unsigned int occamstimer_wq_get_inline(struct occamstimer_workqueue *wq);
+extern void occamstimer_wq_get_stats(struct occamstimer_workqueue *wq,
+				     struct occamstimer_stats *stats);
+
+extern int occamstimer_wq_set_timer(struct occamstimer_workqueue *wq,
+				    const struct occamstimer_timer_config *cfg);
+extern void occamstimer_wq_get_timer(struct occamstimer_workqueue *wq,
+				     struct occamstimer_timer_config *cfg);
+
+extern int occamstimer_wq_set_node(struct occamstimer_workqueue *wq, int node);
+extern int occamstimer_wq_get_node(struct occamstimer_workqueue *wq);
+extern int occamstimer_wq_mem_node(struct occamstimer_workqueue *wq);
+
+#endif /* OCCAMSTIMER_QUEUE_H */
@@ -1,12 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #define __USE_GNU
 #include <string.h>
 #include <occamstimer.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <linux/unistd.h>
 
 
@@ -17,7 +19,7 @@
  * use IOCTL.
  */
 int occamstimer_open(void) {
-	return open("/dev/occamstimer", 'w');
+	return open("/dev/occamstimer", O_RDWR);
 }
 
 
@@ -44,7 +46,7 @@ int occamstimer_add_work(int fd, char *data, struct timespec *exec_int) {
 	
 	occamstimer_ioctl_work_t ioctl_args;
 		
-	if (strlen(data) > OT_MAX_WORK_SIZE) {
+	if (strlen(data) >= OT_MAX_WORK_SIZE) {
 	  return -EINVAL;
 	}
 
@@ -53,6 +55,7 @@ int occamstimer_add_work(int fd, char *data, struct timespec *exec_int) {
 	ioctl_args.cmd = OT_ATTR_ADD;
 	
 	strcpy(ioctl_args.value.data, data);
+	ioctl_args.value.length = strlen(data);
 	
 	ioctl_args.value.exec_int.tv_sec = exec_int->tv_sec;
 	ioctl_args.value.exec_int.tv_nsec = exec_int->tv_nsec;
@@ -64,10 +67,82 @@ int occamstimer_add_work(int fd, char *data, struct timespec *exec_int) {
 
 
 /**
- * Get completed work from occamstimer
+ * Add many workitems to the occamstimer pending work queue, using one
+ * IOCTL call per OT_MAX_WORK_BATCH workitems. Each payload is copied
+ * by the kernel directly from the buffer @work points to.
  * 
  * @fd: The file descriptor to /dev/occamstimer
- * @data: The character buffer representing the completed work
+ * @work: The descriptors of the workitems to add, in queue order
+ * @count: The number of descriptors in @work
+ *
+ * Returns 0 if every workitem was added. On failure the workitems
+ * of earlier IOCTL calls remain added.
+ */
+int occamstimer_add_work_batch(int fd, const struct occamstimer_work_desc *work,
+			       unsigned int count) {
+
+	int ret = 0;
+	
+	occamstimer_ioctl_batch_t ioctl_args;
+
+	ioctl_args.cmd = OT_ATTR_ADD;
+
+	while (count && !ret) {
+		ioctl_args.count = count < OT_MAX_WORK_BATCH ? count : OT_MAX_WORK_BATCH;
+		ioctl_args.value = work;
+
+		ret = ioctl(fd, OCCAMSTIMER_IOCTL_BATCH, &ioctl_args);
+
+		work += ioctl_args.count;
+		count -= ioctl_args.count;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Add a workitem whose payload is gathered by the kernel from the
+ * @iovcnt fragments at @iov, in order, without concatenating them
+ * here first. The payload is taken as bytes, so it may contain NULs.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @iov: The fragments, at most OT_MAX_WORK_IOV of them
+ *
+ * @exec_int: The simulated execution interval that the simulated
+ *            device would take to process the payload.
+ *
+ * Returns -1 with errno set to EOVERFLOW if the fragments add up to
+ * OT_MAX_WORK_SIZE bytes or more.
+ */
+int occamstimer_add_workv(int fd, const struct iovec *iov, int iovcnt,
+			  const struct timespec *exec_int) {
+
+	occamstimer_ioctl_workv_t ioctl_args;
+
+	if (iovcnt < 0 || iovcnt > OT_MAX_WORK_IOV) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ioctl_args.cmd = OT_ATTR_ADD;
+	ioctl_args.iovcnt = iovcnt;
+	ioctl_args.iov = iov;
+	ioctl_args.exec_int.tv_sec = exec_int->tv_sec;
+	ioctl_args.exec_int.tv_nsec = exec_int->tv_nsec;
+	ioctl_args.cookie = 0;
+
+	return ioctl(fd, OCCAMSTIMER_IOCTL_WORKV, &ioctl_args);
+}
+
+
+/**
+ * Get completed work from occamstimer. Returns -1 with errno set to
+ * EAGAIN when there is no completed work.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @data: The character buffer representing the completed work. It
+ *        must have room for OT_MAX_WORK_SIZE characters.
  */
 int occamstimer_get_work(int fd, char *data) {
 
@@ -75,12 +150,10 @@ int occamstimer_get_work(int fd, char *data) {
 	
 	occamstimer_ioctl_work_t ioctl_args;
 		
-	if (strlen(data) < OT_MAX_WORK_SIZE) {
+	if (data == NULL) {
 	  return -EINVAL;
 	}
 
-	memset(&ioctl_args, 0, sizeof(ioctl_args));
-	
 	ioctl_args.cmd = OT_ATTR_GET;
 	
 	ret = ioctl(fd, OCCAMSTIMER_IOCTL_WORK, &ioctl_args);
@@ -92,6 +165,73 @@ int occamstimer_get_work(int fd, char *data) {
 }
 
 
+/**
+ * Get completed work from occamstimer along with the cookie it was
+ * added with, see struct occamstimer_work_desc. Returns -1 with errno
+ * set to EAGAIN when there is no completed work.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @data: The character buffer representing the completed work. It
+ *        must have room for OT_MAX_WORK_SIZE characters.
+ * @cookie: Set to the workitem's cookie.
+ */
+int occamstimer_get_work_cookie(int fd, char *data, unsigned long long *cookie) {
+
+	int ret = 0;
+	
+	occamstimer_ioctl_work_t ioctl_args;
+		
+	if (data == NULL || cookie == NULL) {
+	  return -EINVAL;
+	}
+
+	ioctl_args.cmd = OT_ATTR_GET;
+	
+	ret = ioctl(fd, OCCAMSTIMER_IOCTL_WORK, &ioctl_args);
+
+	if (!ret) {
+		strcpy(data, ioctl_args.value.data);
+		*cookie = ioctl_args.value.cookie;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Get completed work from occamstimer along with its length, for
+ * payloads added by occamstimer_add_workv() that may contain
+ * NULs. Returns -1 with errno set to EAGAIN when there is no
+ * completed work.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @data: Where the payload is copied, followed by a NUL. It must have
+ *        room for OT_MAX_WORK_SIZE bytes.
+ * @length: Set to the length of the payload.
+ */
+int occamstimer_get_work_len(int fd, void *data, size_t *length) {
+
+	int ret = 0;
+	
+	occamstimer_ioctl_work_t ioctl_args;
+
+	if (data == NULL || length == NULL) {
+	  return -EINVAL;
+	}
+
+	ioctl_args.cmd = OT_ATTR_GET;
+
+	ret = ioctl(fd, OCCAMSTIMER_IOCTL_WORK, &ioctl_args);
+
+	if (!ret) {
+		*length = ioctl_args.value.length;
+		memcpy(data, ioctl_args.value.data, *length + 1);
+	}
+
+	return ret;
+}
+
+
 /**
  * Sets the state of the device. Note that this function should not be
  * used and is included for educational purposes. Use the
@@ -156,6 +296,93 @@ int __occamstimer_do_action(int fd, enum occamstimer_action action) {
 
 }
 
+/**
+ * Have the device signal the eventfd @efd when completed work is
+ * waiting, or stop with an @efd of -1. Signals are coalesced: once
+ * woken, take work with occamstimer_get_work() until it fails with
+ * EAGAIN, which arms the eventfd again.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @efd: An eventfd, as made by eventfd(2), or -1
+ */
+int occamstimer_set_eventfd(int fd, int efd) {
+
+	occamstimer_ioctl_eventfd_t ioctl_args;
+
+	memset(&ioctl_args, 0, sizeof(ioctl_args));
+
+	ioctl_args.cmd = OT_ATTR_SET;
+
+	ioctl_args.value = efd;
+
+	return ioctl(fd, OCCAMSTIMER_IOCTL_EVENTFD, &ioctl_args);
+}
+
+
+/**
+ * Service workitems whose exec_int is below @inline_ns nanoseconds
+ * inline, without the device's timer, or none with 0.
+ * 
+ * @fd: The file descriptor to /dev/occamstimer
+ * @inline_ns: The threshold, less than a second
+ */
+int occamstimer_set_inline(int fd, unsigned int inline_ns) {
+
+	occamstimer_ioctl_inline_t ioctl_args;
+
+	memset(&ioctl_args, 0, sizeof(ioctl_args));
+
+	ioctl_args.cmd = OT_ATTR_SET;
+
+	ioctl_args.value = inline_ns;
+
+	return ioctl(fd, OCCAMSTIMER_IOCTL_INLINE, &ioctl_args);
+}
+
+
+int occamstimer_get_inline(int fd, unsigned int *inline_ns) {
+
+	int ret = 0;
+
+	occamstimer_ioctl_inline_t ioctl_args;
+
+	memset(&ioctl_args, 0, sizeof(ioctl_args));
+
+	ioctl_args.cmd = OT_ATTR_GET;
+
+	ret = ioctl(fd, OCCAMSTIMER_IOCTL_INLINE, &ioctl_args);
+
+	if (!ret)
+		*inline_ns = ioctl_args.value;
+
+	return ret;
+}
+
+
+/**
+ * Get the device's counts of workitems serviced by its timer and
+ * inline, and of those serviced on another NUMA node than they were
+ * allocated on.
+ */
+int occamstimer_get_stats(int fd, struct occamstimer_stats *stats) {
+
+	int ret = 0;
+
+	occamstimer_ioctl_stats_t ioctl_args;
+
+	memset(&ioctl_args, 0, sizeof(ioctl_args));
+
+	ioctl_args.cmd = OT_ATTR_GET;
+
+	ret = ioctl(fd, OCCAMSTIMER_IOCTL_STATS, &ioctl_args);
+
+	if (!ret)
+		*stats = ioctl_args.value;
+
+	return ret;
+}
+
+
 int occamstimer_start_device(int fd) {
 	return __occamstimer_do_action(fd, OT_ACTION_START);
 }
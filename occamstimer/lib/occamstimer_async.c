@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <occamstimer.h>
+
+
+/*
+ * How often occamstimer_ctx_timeout_ns() has the loop poll for a
+ * workitem that is overdue, once it has been polled for after it
+ * was due.
+ */
+#define CTX_OVERDUE_POLL_NS 50000
+
+/*
+ * One submitted workitem, from occamstimer_ctx_submit() until its
+ * completion is dispatched.
+ *
+ * @due: When the device should be done with it, estimated from the
+ *       exec_int of every workitem ahead of it.
+ *
+ * @completed: Set once its callback has been called, while workitems
+ *             submitted before it are still outstanding.
+ */
+struct ctx_item {
+	occamstimer_done_fn  done;
+	void                 *arg;
+	struct timespec      due;
+	int                  completed;
+};
+
+/**
+ * @items: A ring of the workitems from the oldest one not yet
+ *         completed on, in submission order. The first @flushed have
+ *         been added to the device; the @nr_batch after them are
+ *         still in @batch.
+ *
+ * @head_cookie: The cookie of the first workitem of @items. Each
+ *               workitem is submitted with the cookie of its place in
+ *               the ring, so a completion is found there by its cookie.
+ *               A device with several workqueues may complete
+ *               workitems out of order, which leaves @nr_completed of
+ *               them completed behind an outstanding one.
+ *
+ * @store: Copies of the payloads of @batch, so that the caller's
+ *         buffers need not outlive occamstimer_ctx_submit().
+ *
+ * @last_due: The due time of the last workitem added to the device.
+ *
+ * @last_poll: When occamstimer_ctx_process() last read the device.
+ */
+struct occamstimer_ctx {
+	int                           fd;
+	int                           started;
+
+	struct ctx_item               *items;
+	unsigned int                  head;
+	unsigned int                  nr_items;
+	unsigned int                  max_items;
+	unsigned int                  flushed;
+	unsigned long long            head_cookie;
+	unsigned int                  nr_completed;
+
+	struct occamstimer_work_desc  batch[OT_MAX_WORK_BATCH];
+	char                          store[OT_MAX_WORK_BATCH][OT_MAX_WORK_SIZE];
+	unsigned int                  nr_batch;
+
+	struct timespec               last_due;
+	struct timespec               last_poll;
+};
+
+
+static struct ctx_item *ctx_item(struct occamstimer_ctx *ctx, unsigned int i)
+{
+	return &ctx->items[(ctx->head + i) & (ctx->max_items - 1)];
+}
+
+
+/**
+ * Take the completed workitems off the front of the ring.
+ */
+static void ctx_retire(struct occamstimer_ctx *ctx)
+{
+	while (ctx->flushed && ctx_item(ctx, 0)->completed) {
+		ctx->head = (ctx->head + 1) & (ctx->max_items - 1);
+		ctx->head_cookie++;
+		ctx->nr_items--;
+		ctx->flushed--;
+		ctx->nr_completed--;
+	}
+}
+
+
+/**
+ * Double the ring of items, unwrapping it so that it starts at 0.
+ */
+static int ctx_grow(struct occamstimer_ctx *ctx)
+{
+	struct ctx_item  *items;
+	unsigned int     max_items = ctx->max_items ? 2 * ctx->max_items : 256;
+	unsigned int     i;
+
+	items = malloc(sizeof(*items) * max_items);
+	if (!items)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->nr_items; i++)
+		items[i] = *ctx_item(ctx, i);
+
+	free(ctx->items);
+	ctx->items = items;
+	ctx->max_items = max_items;
+	ctx->head = 0;
+
+	return 0;
+}
+
+
+static void timespec_add(struct timespec *ts, const struct __kernel_timespec *add)
+{
+	ts->tv_sec += add->tv_sec;
+	ts->tv_nsec += add->tv_nsec;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+
+/**
+ * Create an asynchronous submission context on the device @fd. The
+ * context expects to be the only reader of the device's completed
+ * work: completions are matched to submissions by their cookies, and
+ * the work of other readers would be taken and ignored. Any completed
+ * work already on the device is discarded.
+ *
+ * Returns NULL if out of memory.
+ */
+struct occamstimer_ctx *occamstimer_ctx_create(int fd)
+{
+	struct occamstimer_ctx *ctx;
+	char data[OT_MAX_WORK_SIZE];
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->fd = fd;
+
+	if (ctx_grow(ctx)) {
+		free(ctx);
+		return NULL;
+	}
+
+	while (!occamstimer_get_work(fd, data))
+		;
+
+	return ctx;
+}
+
+
+/**
+ * Free @ctx. The callbacks of workitems that have not completed are
+ * not called, and workitems still batched are not submitted. The
+ * device fd is left open.
+ */
+void occamstimer_ctx_destroy(struct occamstimer_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	free(ctx->items);
+	free(ctx);
+}
+
+
+/**
+ * Queue a workitem for submission. It is added to the device with
+ * the workitems around it in one batch IOCTL, once OT_MAX_WORK_BATCH
+ * are queued or on the next occamstimer_ctx_flush() or
+ * occamstimer_ctx_process(). @done is called with @arg from
+ * occamstimer_ctx_process() once the device has completed it.
+ *
+ * @data: The NUL terminated work. It is copied, so it need not
+ *        outlive the call.
+ *
+ * Returns 0 once the workitem is queued; from then on only @done
+ * reports how it went, even if flushing a full batch fails. Returns a
+ * negative errno, and never calls @done, if the workitem is too large
+ * or there is no memory for it.
+ */
+int occamstimer_ctx_submit(struct occamstimer_ctx *ctx, const char *data,
+			   const struct timespec *exec_int,
+			   occamstimer_done_fn done, void *arg)
+{
+	struct occamstimer_work_desc  *desc;
+	struct ctx_item               *item;
+	size_t                        len;
+	int                           ret;
+
+	len = strlen(data);
+	if (len >= OT_MAX_WORK_SIZE)
+		return -EINVAL;
+
+	if (ctx->nr_items == ctx->max_items) {
+		ret = ctx_grow(ctx);
+		if (ret)
+			return ret;
+	}
+
+	item = ctx_item(ctx, ctx->nr_items);
+	item->done = done;
+	item->arg = arg;
+	item->completed = 0;
+
+	desc = &ctx->batch[ctx->nr_batch];
+	memcpy(ctx->store[ctx->nr_batch], data, len + 1);
+	desc->data = ctx->store[ctx->nr_batch];
+	desc->exec_int.tv_sec = exec_int->tv_sec;
+	desc->exec_int.tv_nsec = exec_int->tv_nsec;
+	desc->cookie = ctx->head_cookie + ctx->nr_items++;
+
+	if (++ctx->nr_batch == OT_MAX_WORK_BATCH)
+		occamstimer_ctx_flush(ctx);
+
+	return 0;
+}
+
+
+/**
+ * Add the queued workitems to the device, and start it the first
+ * time. Work added to a finished device restarts it, so it is only
+ * started once.
+ *
+ * Returns the number of workitems added. If the IOCTL fails they are
+ * dropped instead and their callbacks called with its negative errno,
+ * which is only reported that way: 0 is returned.
+ */
+int occamstimer_ctx_flush(struct occamstimer_ctx *ctx)
+{
+	struct timespec  now;
+	struct ctx_item  dropped[OT_MAX_WORK_BATCH];
+	unsigned int     i, nr_dropped;
+	int              ret;
+
+	if (!ctx->nr_batch)
+		return 0;
+
+	if (occamstimer_add_work_batch(ctx->fd, ctx->batch, ctx->nr_batch)) {
+		ret = -errno;
+
+		/* off the ring first, the callbacks may submit */
+		nr_dropped = ctx->nr_batch;
+		for (i = 0; i < nr_dropped; i++)
+			dropped[i] = *ctx_item(ctx, ctx->flushed + i);
+
+		ctx->nr_items -= nr_dropped;
+		ctx->nr_batch = 0;
+
+		for (i = 0; i < nr_dropped; i++) {
+			if (dropped[i].done)
+				dropped[i].done(ctx, NULL, ret, dropped[i].arg);
+		}
+
+		return 0;
+	}
+
+	/*
+	 * The device services its pending queue one workitem after
+	 * another, so each is due an exec_int after the one before
+	 * it, or after now if the device has caught up.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_before(&ctx->last_due, &now))
+		ctx->last_due = now;
+
+	for (i = 0; i < ctx->nr_batch; i++) {
+		timespec_add(&ctx->last_due, &ctx->batch[i].exec_int);
+		ctx_item(ctx, ctx->flushed + i)->due = ctx->last_due;
+	}
+
+	ret = ctx->nr_batch;
+	ctx->flushed += ctx->nr_batch;
+	ctx->nr_batch = 0;
+
+	if (!ctx->started) {
+		occamstimer_start_device(ctx->fd);
+		ctx->started = 1;
+	}
+
+	return ret;
+}
+
+
+/**
+ * The number of nanoseconds an event loop should wait before calling
+ * occamstimer_ctx_process(): 0 if there is work to flush or the
+ * oldest workitem has become due since the device was last read,
+ * until it is due if it is not yet, or -1 if nothing is outstanding.
+ * A workitem the device is late with is polled for every
+ * CTX_OVERDUE_POLL_NS. This suits ppoll() or a timerfd.
+ */
+long long occamstimer_ctx_timeout_ns(struct occamstimer_ctx *ctx)
+{
+	struct timespec  now;
+	struct ctx_item  *item;
+	long long        ns;
+
+	if (ctx->nr_batch)
+		return 0;
+
+	if (!ctx->flushed)
+		return -1;
+
+	item = ctx_item(ctx, 0);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ns = (item->due.tv_sec - now.tv_sec) * 1000000000LL +
+		(item->due.tv_nsec - now.tv_nsec);
+	if (ns <= 0)
+		return timespec_before(&ctx->last_poll, &item->due) ? 
+			0 : CTX_OVERDUE_POLL_NS;
+
+	return ns;
+}
+
+
+/**
+ * occamstimer_ctx_timeout_ns() in milliseconds, rounded up so that
+ * the loop does not wake just before the workitem is due. This can
+ * be passed as is to epoll_wait() or poll(), or used to arm a loop's
+ * timer.
+ */
+int occamstimer_ctx_timeout(struct occamstimer_ctx *ctx)
+{
+	long long ns = occamstimer_ctx_timeout_ns(ctx);
+
+	if (ns <= 0)
+		return ns;
+
+	return (ns + 999999) / 1000000;
+}
+
+
+/**
+ * Flush any queued workitems, then take every completed workitem off
+ * the device without blocking and call its callback with the
+ * completed data, in the order the device completed them, which need
+ * not be the order they were submitted in. Completed work the context
+ * did not submit is ignored. Callbacks may submit more work.
+ *
+ * Returns the number of completions dispatched, or a negative errno
+ * if the device could not be read. A failed flush is reported to the
+ * callbacks of the workitems it dropped, as occamstimer_ctx_flush()
+ * does.
+ */
+int occamstimer_ctx_process(struct occamstimer_ctx *ctx)
+{
+	char                data[OT_MAX_WORK_SIZE];
+	unsigned long long  cookie;
+	struct ctx_item     *slot;
+	struct ctx_item     item;
+	int                 count = 0;
+
+	occamstimer_ctx_flush(ctx);
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx->last_poll);
+
+	while (ctx->flushed) {
+		if (occamstimer_get_work_cookie(ctx->fd, data, &cookie))
+			return errno == EAGAIN ? count : -errno;
+
+		if (cookie - ctx->head_cookie >= ctx->flushed)
+			continue;
+
+		slot = ctx_item(ctx, cookie - ctx->head_cookie);
+		if (slot->completed)
+			continue;
+
+		/* off the ring first, the callback may submit */
+		item = *slot;
+		slot->completed = 1;
+		ctx->nr_completed++;
+		ctx_retire(ctx);
+
+		if (item.done)
+			item.done(ctx, data, 0, item.arg);
+		count++;
+	}
+
+	return count;
+}
+
+
+/**
+ * The number of workitems submitted to @ctx whose callbacks have not
+ * been called yet.
+ */
+unsigned int occamstimer_ctx_inflight(struct occamstimer_ctx *ctx)
+{
+	return ctx->nr_items - ctx->nr_completed;
+}
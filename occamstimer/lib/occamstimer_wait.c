@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <occamstimer.h>
+
+
+/*
+ * How many times the spin loop checks the sequence page between
+ * readings of the clock.
+ */
+#define WAIT_SPINS_PER_CHECK 64
+
+/**
+ * @page: The device's completion sequence page, mapped read only,
+ *        or NULL when the waiter blocks only.
+ *
+ * @efd: The eventfd registered with the device, or -1 when the
+ *       waiter spins only.
+ */
+struct occamstimer_waiter {
+	int                                  fd;
+	enum occamstimer_wait_mode           mode;
+	long long                            spin_ns;
+	const struct occamstimer_seq_page    *page;
+	int                                  efd;
+};
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+
+static unsigned long long waiter_seq(struct occamstimer_waiter *w)
+{
+	return __atomic_load_n(&w->page->completed, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * Create a waiter for completed work on the device @fd.
+ *
+ * @mode: OT_WAIT_SPIN spins on the device's completion sequence page
+ *        until a workitem completes. OT_WAIT_BLOCK sleeps on an
+ *        eventfd the device signals. OT_WAIT_HYBRID spins for up to
+ *        @spin_ns and then sleeps.
+ *
+ * The blocking modes register an eventfd with the device, which only
+ * one open file may have at a time, so there can be one such waiter
+ * per device.
+ *
+ * Returns NULL with errno set if the page could not be mapped or the
+ * eventfd registered.
+ */
+struct occamstimer_waiter *occamstimer_waiter_create(int fd,
+						     enum occamstimer_wait_mode mode,
+						     long long spin_ns)
+{
+	struct occamstimer_waiter  *w;
+	void                       *page;
+	int                        err;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->fd = fd;
+	w->mode = mode;
+	w->spin_ns = spin_ns;
+	w->efd = -1;
+
+	if (mode != OT_WAIT_BLOCK) {
+		page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+		if (page == MAP_FAILED)
+			goto err;
+		w->page = page;
+	}
+
+	if (mode != OT_WAIT_SPIN) {
+		w->efd = eventfd(0, EFD_CLOEXEC);
+		if (w->efd < 0 || occamstimer_set_eventfd(fd, w->efd))
+			goto err;
+	}
+
+	return w;
+
+err:
+	err = errno;
+	occamstimer_waiter_destroy(w);
+	errno = err;
+	return NULL;
+}
+
+
+/**
+ * Free @w, unregistering its eventfd from the device. The device fd
+ * is left open.
+ */
+void occamstimer_waiter_destroy(struct occamstimer_waiter *w)
+{
+	if (!w)
+		return;
+
+	if (w->page)
+		munmap((void *)w->page, sysconf(_SC_PAGESIZE));
+
+	if (w->efd >= 0) {
+		occamstimer_set_eventfd(w->fd, -1);
+		close(w->efd);
+	}
+
+	free(w);
+}
+
+
+/**
+ * Spin until the completion sequence moves past @seq. Returns 0 once
+ * it has, or -1 if @deadline, in nanoseconds, passes first. A
+ * @deadline of 0 spins for as long as it takes.
+ */
+static int spin_for(struct occamstimer_waiter *w, unsigned long long seq,
+		    long long deadline)
+{
+	unsigned int i;
+
+	for (;;) {
+		for (i = 0; i < WAIT_SPINS_PER_CHECK; i++) {
+			if (waiter_seq(w) != seq)
+				return 0;
+			cpu_relax();
+		}
+
+		if (deadline && now_ns() >= deadline)
+			return -1;
+	}
+}
+
+
+/**
+ * Take the first completed workitem off the device, as
+ * occamstimer_get_work() does, waiting for one if there is none.
+ *
+ * The sequence is read before each get_work call, so a workitem that
+ * completes after the call has failed moves it and is not waited out.
+ * Likewise the eventfd is armed by that failed call. A workitem found
+ * by spinning may still have signalled the eventfd, so a hybrid
+ * waiter's next sleep can return at once; it then simply looks again.
+ *
+ * Returns 0, or -1 with errno set if the device could not be read.
+ */
+int occamstimer_wait_work(struct occamstimer_waiter *w, char *data)
+{
+	unsigned long long  seq = 0;
+	long long           deadline = 0;
+	uint64_t            count;
+
+	for (;;) {
+		if (w->page)
+			seq = waiter_seq(w);
+
+		if (!occamstimer_get_work(w->fd, data))
+			return 0;
+
+		if (errno != EAGAIN)
+			return -1;
+
+		if (w->mode == OT_WAIT_SPIN) {
+			spin_for(w, seq, 0);
+			continue;
+		}
+
+		if (w->mode == OT_WAIT_HYBRID) {
+			if (!deadline)
+				deadline = now_ns() + w->spin_ns;
+
+			if (!spin_for(w, seq, deadline))
+				continue;
+		}
+
+		if (read(w->efd, &count, sizeof(count)) < 0 && errno != EINTR)
+			return -1;
+	}
+}
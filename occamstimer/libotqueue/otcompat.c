@@ -0,0 +1,236 @@
+/*
+ * otcompat.c - timerfd backed hrtimers for the userspace build of the
+ * occamstimer workqueue core.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "otcompat.h"
+
+
+/**
+ * The CPU the calling thread is running on, or 0 if that cannot be
+ * told.
+ */
+int
+raw_smp_processor_id(void) {
+
+	int cpu = sched_getcpu();
+
+	return cpu < 0 ? 0 : cpu;
+}
+
+
+/**
+ * Arm the timerfd of @timer to expire at the absolute time @tim, or
+ * disarm it if @tim is zero.
+ */
+static void
+__hrtimer_program(struct hrtimer *timer, ktime_t tim) {
+
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = ktime_to_timespec(tim);
+
+	/*
+	 * An all zero it_value disarms the timerfd, so an expiry of
+	 * exactly zero (only possible for a 0ns interval at boot) is
+	 * nudged forward by a nanosecond.
+	 */
+	if (tim && !its.it_value.tv_sec && !its.it_value.tv_nsec)
+		its.it_value.tv_nsec = 1;
+
+	timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+
+/**
+ * The stand-in for the timer interrupt. Wait for the timerfd to
+ * expire and run the timer's function, re-arming the timerfd with the
+ * (forwarded) expiry if the function asks to be restarted and has not
+ * armed the timer itself.
+ *
+ * An expiry read after the timer was cancelled, or re-armed for later,
+ * is stale and ignored, as the kernel would have dequeued the timer.
+ */
+static void *
+__hrtimer_thread(void *arg) {
+
+	struct hrtimer        *timer = arg;
+	enum hrtimer_restart  restart;
+	uint64_t              ticks;
+
+	for (;;) {
+		if (read(timer->fd, &ticks, sizeof(ticks)) < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+
+		pthread_mutex_lock(&timer->lock);
+
+		if (timer->exiting) {
+			pthread_mutex_unlock(&timer->lock);
+			break;
+		}
+
+		if (!timer->armed ||
+		    hrtimer_cb_get_time(timer) < timer->expires) {
+			pthread_mutex_unlock(&timer->lock);
+			continue;
+		}
+
+		timer->armed = 0;
+		timer->running = 1;
+		pthread_mutex_unlock(&timer->lock);
+
+		restart = timer->function(timer);
+
+		pthread_mutex_lock(&timer->lock);
+		timer->running = 0;
+		if (restart == HRTIMER_RESTART && !timer->armed) {
+			timer->armed = 1;
+			__hrtimer_program(timer, timer->expires);
+		}
+		pthread_mutex_unlock(&timer->lock);
+	}
+
+	return NULL;
+}
+
+
+void
+hrtimer_init(struct hrtimer *timer, clockid_t clock, enum hrtimer_mode mode) {
+
+	memset(timer, 0, sizeof(*timer));
+
+	pthread_mutex_init(&timer->lock, NULL);
+	timer->clock = clock;
+	timer->fd = timerfd_create(clock, TFD_CLOEXEC);
+
+	if (timer->fd < 0) {
+		perror("timerfd_create");
+		abort();
+	}
+
+	if (pthread_create(&timer->thread, NULL, __hrtimer_thread, timer)) {
+		perror("pthread_create");
+		abort();
+	}
+}
+
+
+/**
+ * Userspace only: stop the timer thread and release the timerfd.
+ */
+void
+hrtimer_destroy(struct hrtimer *timer) {
+
+	pthread_mutex_lock(&timer->lock);
+	timer->exiting = 1;
+
+	/* Expire immediately to wake the thread up. */
+	__hrtimer_program(timer, 1);
+	pthread_mutex_unlock(&timer->lock);
+
+	pthread_join(timer->thread, NULL);
+	close(timer->fd);
+	pthread_mutex_destroy(&timer->lock);
+}
+
+
+int
+hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode) {
+
+	if (mode & HRTIMER_MODE_REL)
+		tim = ktime_add(hrtimer_cb_get_time(timer), tim);
+
+	pthread_mutex_lock(&timer->lock);
+	timer->expires = tim;
+	timer->armed = 1;
+	__hrtimer_program(timer, tim);
+	pthread_mutex_unlock(&timer->lock);
+
+	return 0;
+}
+
+
+/**
+ * The timerfd fires on time, so the slack is ignored.
+ */
+int
+hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
+		       uint64_t delta_ns, enum hrtimer_mode mode) {
+
+	return hrtimer_start(timer, tim, mode);
+}
+
+
+/**
+ * Disarm the timer. As in the kernel, returns -1 if the callback is
+ * currently running, when it may still restart the timer, 1 if the
+ * timer was armed and 0 if it was not.
+ */
+int
+hrtimer_try_to_cancel(struct hrtimer *timer) {
+
+	int ret = 0;
+
+	pthread_mutex_lock(&timer->lock);
+
+	if (timer->running) {
+		ret = -1;
+	} else if (timer->armed) {
+		timer->armed = 0;
+		__hrtimer_program(timer, 0);
+		ret = 1;
+	}
+
+	pthread_mutex_unlock(&timer->lock);
+
+	return ret;
+}
+
+
+/**
+ * Disarm the timer and wait for a running callback to finish.
+ */
+int
+hrtimer_cancel(struct hrtimer *timer) {
+
+	while (hrtimer_try_to_cancel(timer) < 0 &&
+	       !pthread_equal(pthread_self(), timer->thread))
+		sched_yield();
+
+	return 0;
+}
+
+
+/**
+ * Forward the expiry of @timer by whole multiples of @interval until
+ * it lies after @now. Returns the number of intervals added.
+ */
+uint64_t
+hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval) {
+
+	uint64_t  overruns = 0;
+	ktime_t   delta = ktime_sub(now, timer->expires);
+
+	if (delta < 0)
+		return 0;
+
+	if (interval <= 0) {
+		timer->expires = now;
+		return 1;
+	}
+
+	overruns = delta / interval + 1;
+	timer->expires = ktime_add(timer->expires, overruns * interval);
+
+	return overruns;
+}
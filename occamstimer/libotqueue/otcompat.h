@@ -0,0 +1,426 @@
+/*
+ * otcompat.h - Userspace stand-ins for the kernel interfaces used by
+ * the occamstimer workqueue core (../kmod/occamstimer_queue.c).
+ *
+ * Only the subset of each interface that the core actually uses is
+ * provided, with the same names and semantics:
+ *
+ *   - struct list_head and its helpers are a copy of the kernel's
+ *     circular doubly linked list.
+ *
+ *   - spinlock_t is a pthread spinlock. There are no interrupts to
+ *     disable so the _irq/_irqsave variants are the same as the
+ *     plain ones.
+ *
+ *   - ktime_t is a signed count of nanoseconds, and ktime_get()
+ *     reads CLOCK_MONOTONIC.
+ *
+ *   - struct hrtimer is backed by a timerfd and a thread that waits
+ *     on it and runs the timer's function when it expires, standing
+ *     in for the timer interrupt. There are no softirqs, CPU
+ *     placement or slack, so those modes and arguments are accepted
+ *     and ignored.
+ *
+ *   - There is one NUMA node, 0, which all memory is on.
+ */
+#ifndef OTCOMPAT_H
+#define OTCOMPAT_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * ===============================================
+ *             Misc. Kernel Helpers
+ * ===============================================
+ */
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+typedef struct {
+	int64_t counter;
+} atomic64_t;
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+	__atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+#define READ_ONCE(x)       __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+#define cpu_relax() sched_yield()
+
+extern int raw_smp_processor_id(void);
+
+#define nr_cpu_ids       sysconf(_SC_NPROCESSORS_CONF)
+#define cpu_online(cpu)  ((cpu) < sysconf(_SC_NPROCESSORS_ONLN))
+
+#define printk(fmt, args...) fprintf(stderr, fmt, ## args)
+
+#define WARN(condition, fmt, args...)					\
+	({								\
+		int __ret_warn_on = !!(condition);			\
+		if (unlikely(__ret_warn_on))				\
+			fprintf(stderr, "WARNING: %s:%d: " fmt,		\
+				__FILE__, __LINE__, ## args);		\
+		__ret_warn_on;						\
+	})
+
+#define BUG_ON(condition)						\
+	do {								\
+		if (unlikely(condition)) {				\
+			fprintf(stderr, "BUG: %s:%d\n",			\
+				__FILE__, __LINE__);			\
+			abort();					\
+		}							\
+	} while (0)
+
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr)           free(ptr)
+
+static inline void *kmalloc_node(size_t size, int flags, int node)
+{
+	return malloc(size);
+}
+
+static inline void *kzalloc_node(size_t size, int flags, int node)
+{
+	return calloc(1, size);
+}
+
+
+/*
+ * ===============================================
+ *             NUMA
+ * ===============================================
+ */
+
+#define NUMA_NO_NODE (-1)
+
+#define nr_node_ids        1
+#define node_online(node)  ((node) == 0)
+#define numa_node_id()     0
+#define cpu_to_node(cpu)   0
+
+#define virt_to_page(addr) (addr)
+#define page_to_nid(page)  0
+
+/*
+ * The instrumentation points compile away in userspace.
+ */
+#define OT_DEBUG(fmt, args...) do { } while (0)
+#define OT_EVENT(ename)        do { } while (0)
+#define OT_INFO(info)          do { } while (0)
+
+
+/*
+ * ===============================================
+ *             Linked Lists
+ * ===============================================
+ */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+#define LIST_HEAD(name) \
+	struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new,
+			      struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next)
+{
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void __list_splice(const struct list_head *list,
+				 struct list_head *prev,
+				 struct list_head *next)
+{
+	struct list_head *first = list->next;
+	struct list_head *last = list->prev;
+
+	first->prev = prev;
+	prev->next = first;
+
+	last->next = next;
+	next->prev = last;
+}
+
+static inline void list_splice_tail_init(struct list_head *list,
+					 struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev, head);
+		INIT_LIST_HEAD(list);
+	}
+}
+
+#define list_entry(ptr, type, member) \
+	container_of(ptr, type, member)
+
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+		n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+
+/*
+ * ===============================================
+ *             Spinlocks
+ * ===============================================
+ */
+
+typedef pthread_spinlock_t spinlock_t;
+
+#define spin_lock_init(lock) \
+	pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock_destroy(lock) pthread_spin_destroy(lock)
+
+#define spin_lock(lock)    pthread_spin_lock(lock)
+#define spin_trylock(lock) (!pthread_spin_trylock(lock))
+#define spin_unlock(lock)  pthread_spin_unlock(lock)
+
+#define SINGLE_DEPTH_NESTING 1
+#define spin_lock_nested(lock, subclass) spin_lock(lock)
+
+#define spin_lock_irq(lock)   spin_lock(lock)
+#define spin_unlock_irq(lock) spin_unlock(lock)
+
+#define spin_lock_irqsave(lock, flags) \
+	do { (flags) = 0; spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, flags) \
+	do { (void)(flags); spin_unlock(lock); } while (0)
+
+
+/*
+ * ===============================================
+ *             ktime
+ * ===============================================
+ */
+
+#define NSEC_PER_SEC 1000000000L
+
+typedef int64_t ktime_t;
+
+#define KTIME_MAX     INT64_MAX
+#define KTIME_SEC_MAX (KTIME_MAX / NSEC_PER_SEC)
+
+/*
+ * @secs seconds and @nsecs nanoseconds, saturating at KTIME_MAX.
+ */
+static inline ktime_t ktime_set(int64_t secs, unsigned long nsecs)
+{
+	if (unlikely(secs >= KTIME_SEC_MAX))
+		return KTIME_MAX;
+
+	return secs * NSEC_PER_SEC + (int64_t)nsecs;
+}
+
+static inline ktime_t ktime_add(ktime_t lhs, ktime_t rhs)
+{
+	return lhs + rhs;
+}
+
+static inline ktime_t ktime_sub(ktime_t lhs, ktime_t rhs)
+{
+	return lhs - rhs;
+}
+
+static inline int64_t ktime_to_ns(ktime_t kt)
+{
+	return kt;
+}
+
+static inline ktime_t ns_to_ktime(int64_t ns)
+{
+	return ns;
+}
+
+static inline ktime_t timespec_to_ktime(struct timespec ts)
+{
+	return (ktime_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline struct timespec ktime_to_timespec(ktime_t kt)
+{
+	struct timespec ts;
+
+	ts.tv_sec = kt / NSEC_PER_SEC;
+	ts.tv_nsec = kt % NSEC_PER_SEC;
+
+	return ts;
+}
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return timespec_to_ktime(ts);
+}
+
+
+/*
+ * ===============================================
+ *             HRTimers
+ * ===============================================
+ */
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS    = 0x00,
+	HRTIMER_MODE_REL    = 0x01,
+	HRTIMER_MODE_PINNED = 0x02,
+	HRTIMER_MODE_SOFT   = 0x04,
+};
+
+/**
+ * @function: The callback run when the timer expires, as in the
+ *            kernel.
+ *
+ * @expires: The absolute expiration time of the timer on @clock.
+ *
+ * @fd: The timerfd that is armed with @expires.
+ *
+ * @thread: Waits on @fd and runs @function on each expiry. This is
+ *          the userspace stand-in for the timer interrupt.
+ *
+ * @lock: Protects @armed, @running and @exiting, which are what the
+ *        kernel keeps in the timer base: whether the timer is queued
+ *        or its callback running.
+ *
+ * @armed: The timer is waiting to expire, i.e. it is queued.
+ *
+ * @running: Set while @function is being run by @thread.
+ *
+ * @exiting: Tells @thread to exit on the next wakeup.
+ */
+struct hrtimer {
+	enum hrtimer_restart  (*function)(struct hrtimer *);
+	ktime_t               expires;
+	clockid_t             clock;
+	int                   fd;
+	pthread_t             thread;
+	pthread_mutex_t       lock;
+	int                   armed;
+	volatile int          running;
+	volatile int          exiting;
+};
+
+extern void hrtimer_init(struct hrtimer *timer, clockid_t clock,
+			 enum hrtimer_mode mode);
+extern void hrtimer_destroy(struct hrtimer *timer);
+
+extern int hrtimer_start(struct hrtimer *timer, ktime_t tim,
+			 enum hrtimer_mode mode);
+extern int hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
+				  uint64_t delta_ns, enum hrtimer_mode mode);
+extern int hrtimer_try_to_cancel(struct hrtimer *timer);
+extern int hrtimer_cancel(struct hrtimer *timer);
+
+static inline int hrtimer_callback_running(struct hrtimer *timer)
+{
+	return timer->running;
+}
+
+/*
+ * The current time on the clock of @timer.
+ */
+static inline ktime_t hrtimer_cb_get_time(struct hrtimer *timer)
+{
+	struct timespec ts;
+
+	clock_gettime(timer->clock, &ts);
+
+	return timespec_to_ktime(ts);
+}
+
+extern uint64_t hrtimer_forward(struct hrtimer *timer, ktime_t now,
+				ktime_t interval);
+
+#endif /* OTCOMPAT_H */
@@ -0,0 +1,213 @@
+/*
+ * otqueue_bench - Microbenchmark of the occamstimer workqueue core
+ *
+ * Drives the userspace build of the workqueue state machine through
+ * the same sequence as otuser does the device: add a batch of work,
+ * start the workqueue, wait for the timer to service everything, then
+ * retrieve the completed work. Each phase is timed and reported in
+ * nanoseconds per workitem.
+ *
+ * With --queues the work is serviced by that many workqueues, but all
+ * of it is submitted to the first, the worst case of skew. The rest
+ * only get work by stealing it.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+
+#include "occamstimer_mq.h"
+
+
+#define help_string "\
+	\n\nusage %s [--items=<n>] [--interval=<ns>] [--rounds=<n>]\n\
+	[--inline=<ns>] [--clock=monotonic|realtime|boottime]\n\
+	[--queues=<n>] [--help]\n\n\
+\t--items=\t\tthe number of workitems per round (default 100000)\n\
+\t--interval=\t\tthe exec_int of each workitem in ns (default 0)\n\
+\t--rounds=\t\tthe number of rounds to run (default 5)\n\
+\t--inline=\t\tservice workitems shorter than this inline\n\
+\t\t\t\t(default 0, never)\n\
+\t--clock=\t\tthe clock the timer runs on (default monotonic)\n\
+\t--queues=\t\tthe number of workqueues (default 1)\n\
+\t--help\t\t\tthis menu\n\n"
+
+
+struct bench_params {
+	long          items;
+	long          interval;
+	int           rounds;
+	unsigned int  inline_ns;
+	clockid_t     clock;
+	unsigned int  queues;
+};
+
+struct bench_params Params = {
+	.items = 100000,
+	.interval = 0,
+	.rounds = 5,
+	.inline_ns = 0,
+	.clock = CLOCK_MONOTONIC,
+	.queues = 1,
+};
+
+
+static void process_options(int argc, char *argv[])
+{
+	int c;
+
+	static struct option long_options[] = {
+		{"items",            required_argument, NULL, 'n'},
+		{"interval",         required_argument, NULL, 'i'},
+		{"rounds",           required_argument, NULL, 'r'},
+		{"inline",           required_argument, NULL, 'l'},
+		{"clock",            required_argument, NULL, 'c'},
+		{"queues",           required_argument, NULL, 'q'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "n:i:r:l:c:q:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			Params.items = atol(optarg);
+			break;
+		case 'i':
+			Params.interval = atol(optarg);
+			break;
+		case 'r':
+			Params.rounds = atoi(optarg);
+			break;
+		case 'l':
+			Params.inline_ns = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			if (!strcmp(optarg, "monotonic"))
+				Params.clock = CLOCK_MONOTONIC;
+			else if (!strcmp(optarg, "realtime"))
+				Params.clock = CLOCK_REALTIME;
+			else if (!strcmp(optarg, "boottime"))
+				Params.clock = CLOCK_BOOTTIME;
+			else
+				Params.clock = -1;
+			break;
+		case 'q':
+			Params.queues = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			printf(help_string, argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (Params.items <= 0 || Params.rounds <= 0 || Params.interval < 0 ||
+	    Params.inline_ns >= NSEC_PER_SEC || Params.clock == -1 ||
+	    Params.queues == 0) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void report(const char *phase, int round, ktime_t elapsed)
+{
+	printf("round %d %-8s %10ld items %12.1f ns/item\n",
+	       round, phase, Params.items,
+	       (double)ktime_to_ns(elapsed) / Params.items);
+}
+
+
+static void run_round(struct occamstimer_mq *mq, int round)
+{
+	struct occamstimer_workqueue  *wq = mq->wqs[0];
+	struct occamstimer_workitem   *work_ptr;
+	enum occamstimer_status       status;
+	struct occamstimer_stats      before, after;
+	ktime_t                       begin;
+	long                          i;
+
+	occamstimer_mq_get_stats(mq, &before);
+
+	/* add: allocate and enqueue every workitem while in setup */
+	begin = ktime_get();
+	for (i = 0; i < Params.items; i++) {
+		work_ptr = occamstimer_wq_alloc_work(wq);
+		work_ptr->value.length = snprintf(work_ptr->value.data, OT_MAX_WORK_SIZE,
+						  "workitem-%ld", i);
+		work_ptr->value.exec_int.tv_sec = Params.interval / NSEC_PER_SEC;
+		work_ptr->value.exec_int.tv_nsec = Params.interval % NSEC_PER_SEC;
+
+		if (occamstimer_mq_add_work(mq, wq, work_ptr)) {
+			fprintf(stderr, "error adding work\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	report("add", round, ktime_sub(ktime_get(), begin));
+
+	/* service: run the timers until the pending queues drain */
+	begin = ktime_get();
+	occamstimer_mq_start(mq);
+	do {
+		sched_yield();
+		occamstimer_mq_get_status(mq, &status);
+	} while (status != OT_FINISHED);
+	report("service", round, ktime_sub(ktime_get(), begin));
+
+	occamstimer_mq_get_stats(mq, &after);
+	printf("round %d serviced %llu by the timer, %llu inline\n", round,
+	       after.serviced_timer - before.serviced_timer,
+	       after.serviced_inline - before.serviced_inline);
+
+	if (mq->nr > 1)
+		printf("round %d stole %llu in %llu steals, imbalance_max %llu\n",
+		       round, after.stolen - before.stolen,
+		       after.steals - before.steals, after.imbalance_max);
+
+	/* get: retrieve and free the completed work */
+	begin = ktime_get();
+	for (i = 0; i < Params.items; i++) {
+		work_ptr = occamstimer_mq_get_work(mq);
+		if (!work_ptr) {
+			fprintf(stderr, "missing completed work %ld\n", i);
+			exit(EXIT_FAILURE);
+		}
+		kfree(work_ptr);
+	}
+	report("get", round, ktime_sub(ktime_get(), begin));
+}
+
+
+int main(int argc, char **argv)
+{
+	struct occamstimer_mq            mq;
+	struct occamstimer_timer_config  cfg;
+	unsigned int                     i;
+	int                              round;
+
+	process_options(argc, argv);
+
+	if (occamstimer_mq_init(&mq, Params.queues)) {
+		fprintf(stderr, "error creating the workqueues\n");
+		exit(EXIT_FAILURE);
+	}
+
+	occamstimer_mq_set_inline(&mq, Params.inline_ns);
+
+	for (i = 0; i < mq.nr; i++) {
+		occamstimer_wq_get_timer(mq.wqs[i], &cfg);
+		cfg.clock = Params.clock;
+		occamstimer_wq_set_timer(mq.wqs[i], &cfg);
+	}
+
+	for (round = 0; round < Params.rounds; round++)
+		run_round(&mq, round);
+
+	occamstimer_mq_destroy(&mq);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,645 @@
+/*
+ * otqueue_test - Unit tests of the occamstimer workqueue core
+ *
+ * Drives the userspace build of the workqueue state machine through
+ * add, start, pause, the timer callback and get_work, and checks what
+ * comes out: the order of the completed work, that a pause keeps the
+ * pending work, that adding to a finished workqueue restarts it and
+ * that every workitem is counted as done exactly once. Then the same
+ * for the workitems serviced inline, below the inline threshold, and
+ * on each clock the timer may be set up with, and for several
+ * workqueues that steal from one another, whose work comes back
+ * with its cookie but not necessarily in order. Run by ctest; exits
+ * non-zero if any check fails.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "occamstimer_queue.h"
+#include "occamstimer_mq.h"
+
+
+/* How long a workqueue is given to finish before a test gives up. */
+#define TEST_TIMEOUT_NS (5 * NSEC_PER_SEC)
+
+static int Failures;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n",	\
+				__FILE__, __LINE__, __func__, #cond);	\
+			Failures++;					\
+		}							\
+	} while (0)
+
+
+/*
+ * Counts what the workqueue reports through its notify hook, which
+ * is called from the timer thread.
+ */
+static unsigned int Notified;
+
+static void count_notify(struct occamstimer_workqueue *wq, unsigned int count)
+{
+	__atomic_fetch_add(&Notified, count, __ATOMIC_RELAXED);
+}
+
+
+static void sleep_ns(long ns)
+{
+	struct timespec ts = { ns / NSEC_PER_SEC, ns % NSEC_PER_SEC };
+
+	nanosleep(&ts, NULL);
+}
+
+
+/*
+ * Allocate the workitem numbered @i, with @i as its cookie, to be
+ * serviced @exec_ns after the one ahead of it.
+ */
+static struct occamstimer_workitem *
+new_work(struct occamstimer_workqueue *wq, long i, long exec_ns)
+{
+	struct occamstimer_workitem *work_ptr;
+
+	work_ptr = occamstimer_wq_alloc_work(wq);
+	if (!work_ptr) {
+		perror("occamstimer_wq_alloc_work");
+		exit(EXIT_FAILURE);
+	}
+
+	work_ptr->value.length = snprintf(work_ptr->value.data, OT_MAX_WORK_SIZE,
+					  "workitem-%ld", i);
+	work_ptr->value.exec_int.tv_sec = exec_ns / NSEC_PER_SEC;
+	work_ptr->value.exec_int.tv_nsec = exec_ns % NSEC_PER_SEC;
+	work_ptr->value.cookie = i;
+
+	return work_ptr;
+}
+
+
+/* Add the workitems numbered @first to @first + @count - 1. */
+static void add_works(struct occamstimer_workqueue *wq, long first, long count,
+		      long exec_ns)
+{
+	long i;
+
+	for (i = first; i < first + count; i++)
+		CHECK(occamstimer_wq_add_work(wq, new_work(wq, i, exec_ns)) == 0);
+}
+
+
+static enum occamstimer_status get_status(struct occamstimer_workqueue *wq)
+{
+	enum occamstimer_status status;
+
+	occamstimer_wq_get_status(wq, &status);
+
+	return status;
+}
+
+
+/* Wait for the timer to drain the pending queue. */
+static int wait_finished(struct occamstimer_workqueue *wq)
+{
+	ktime_t deadline = ktime_add(ktime_get(), TEST_TIMEOUT_NS);
+
+	while (get_status(wq) != OT_FINISHED) {
+		if (ktime_get() > deadline) {
+			fprintf(stderr, "timed out waiting for the workqueue to finish\n");
+			return -1;
+		}
+		sched_yield();
+	}
+
+	return 0;
+}
+
+
+/*
+ * Take the workitems numbered @first to @first + @count - 1 off the done
+ * queue, checking that they come out in that order and that nothing
+ * follows them.
+ */
+static void check_done(struct occamstimer_workqueue *wq, long first, long count)
+{
+	struct occamstimer_workitem  *work_ptr;
+	char                         expect[OT_MAX_WORK_SIZE];
+	long                         i;
+
+	for (i = first; i < first + count; i++) {
+		work_ptr = occamstimer_wq_get_work(wq);
+		CHECK(work_ptr != NULL);
+		if (!work_ptr)
+			return;
+
+		snprintf(expect, sizeof(expect), "workitem-%ld", i);
+		CHECK(strcmp(work_ptr->value.data, expect) == 0);
+		CHECK(work_ptr->value.length == strlen(expect));
+		CHECK(work_ptr->value.cookie == (unsigned long long)i);
+		kfree(work_ptr);
+	}
+
+	CHECK(occamstimer_wq_get_work(wq) == NULL);
+	CHECK(!occamstimer_wq_has_done(wq));
+}
+
+
+static void setup(struct occamstimer_workqueue *wq)
+{
+	occamstimer_wq_init(wq);
+	wq->notify = count_notify;
+	Notified = 0;
+}
+
+
+/*
+ * ===============================================
+ *                     Tests
+ * ===============================================
+ */
+
+/* Work is completed in the order it was added, each item once. */
+static void test_order(void)
+{
+	struct occamstimer_workqueue  wq;
+	struct occamstimer_stats      stats;
+
+	setup(&wq);
+
+	CHECK(get_status(&wq) == OT_SETUP);
+	add_works(&wq, 0, 200, 10000);
+	CHECK(get_status(&wq) == OT_SETUP);
+	CHECK(!occamstimer_wq_has_done(&wq));
+
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	occamstimer_wq_get_stats(&wq, &stats);
+	CHECK(stats.serviced_timer == 200);
+	CHECK(stats.serviced_inline == 0);
+
+	check_done(&wq, 0, 200);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/* Starting an empty workqueue does nothing; starting twice fails. */
+static void test_start(void)
+{
+	struct occamstimer_workqueue wq;
+
+	setup(&wq);
+
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(get_status(&wq) == OT_SETUP);
+
+	add_works(&wq, 0, 1, NSEC_PER_SEC);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(get_status(&wq) == OT_RUNNING);
+	CHECK(occamstimer_wq_start(&wq) == -EINVAL);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/* A paused workqueue services nothing and keeps its pending work. */
+static void test_pause(void)
+{
+	struct occamstimer_workqueue wq;
+
+	setup(&wq);
+
+	/* The first workitem is far longer than it takes to pause. */
+	add_works(&wq, 0, 1, 100000000);
+	add_works(&wq, 1, 9, 1000);
+
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(occamstimer_wq_pause(&wq) == 0);
+	CHECK(get_status(&wq) == OT_STOPPED);
+
+	/* Pausing again changes nothing. */
+	CHECK(occamstimer_wq_pause(&wq) == 0);
+	CHECK(get_status(&wq) == OT_STOPPED);
+
+	sleep_ns(200000000);
+	CHECK(get_status(&wq) == OT_STOPPED);
+	CHECK(!occamstimer_wq_has_done(&wq));
+	CHECK(occamstimer_wq_get_work(&wq) == NULL);
+	CHECK(Notified == 0);
+
+	/* Work added while paused waits behind the rest. */
+	add_works(&wq, 10, 5, 1000);
+	CHECK(get_status(&wq) == OT_STOPPED);
+
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	check_done(&wq, 0, 15);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/* Adding to a finished workqueue restarts it without a start call. */
+static void test_restart(void)
+{
+	struct occamstimer_workqueue wq;
+
+	setup(&wq);
+
+	add_works(&wq, 0, 3, 1000);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+	check_done(&wq, 0, 3);
+
+	add_works(&wq, 3, 1, NSEC_PER_SEC);
+	CHECK(get_status(&wq) == OT_RUNNING);
+	CHECK(occamstimer_wq_pause(&wq) == 0);
+	check_done(&wq, 0, 0);
+
+	occamstimer_wq_destroy(&wq);
+
+	setup(&wq);
+
+	add_works(&wq, 0, 1, 1000);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	/* Each may find it running or finished again; either way. */
+	add_works(&wq, 1, 20, 1000);
+	CHECK(wait_finished(&wq) == 0);
+	check_done(&wq, 0, 21);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * The notify hook and the sequence page each count every workitem put
+ * on the done queue exactly once.
+ */
+static void test_done_count(void)
+{
+	struct occamstimer_workqueue  wq;
+	struct occamstimer_seq_page   seq = { 0 };
+	struct occamstimer_stats      stats;
+
+	setup(&wq);
+	wq.seq = &seq;
+
+	add_works(&wq, 0, 50, 10000);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	add_works(&wq, 50, 50, 10000);
+	CHECK(wait_finished(&wq) == 0);
+
+	occamstimer_wq_get_stats(&wq, &stats);
+	CHECK(stats.serviced_timer + stats.serviced_inline == 100);
+	CHECK(__atomic_load_n(&seq.completed, __ATOMIC_RELAXED) == 100);
+	CHECK(__atomic_load_n(&Notified, __ATOMIC_RELAXED) == 100);
+
+	check_done(&wq, 0, 100);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/* Destroying a workqueue frees its pending and done work. */
+static void test_destroy(void)
+{
+	struct occamstimer_workqueue wq;
+
+	setup(&wq);
+
+	add_works(&wq, 0, 2, 1000);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	add_works(&wq, 2, 10, NSEC_PER_SEC);
+	CHECK(get_status(&wq) == OT_RUNNING);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/* The inline threshold is kept, and must be under a second. */
+static void test_inline_threshold(void)
+{
+	struct occamstimer_workqueue wq;
+
+	setup(&wq);
+
+	CHECK(occamstimer_wq_get_inline(&wq) == 0);
+	CHECK(occamstimer_wq_set_inline(&wq, 5000) == 0);
+	CHECK(occamstimer_wq_get_inline(&wq) == 5000);
+	CHECK(occamstimer_wq_set_inline(&wq, NSEC_PER_SEC) == -EINVAL);
+	CHECK(occamstimer_wq_get_inline(&wq) == 5000);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * Short workitems are serviced by the start call itself, without the
+ * timer, up to the budget; the timer is armed to expire straight away
+ * for the rest. They still complete in order.
+ */
+static void test_inline(void)
+{
+	struct occamstimer_workqueue  wq;
+	struct occamstimer_stats      stats;
+
+	setup(&wq);
+	CHECK(occamstimer_wq_set_inline(&wq, 1000) == 0);
+
+	add_works(&wq, 0, 10, 500);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(get_status(&wq) == OT_FINISHED);
+	CHECK(Notified == 10);
+
+	occamstimer_wq_get_stats(&wq, &stats);
+	CHECK(stats.serviced_inline == 10);
+	CHECK(stats.serviced_timer == 0);
+	check_done(&wq, 0, 10);
+
+	/* Adding to the finished workqueue services them straight away. */
+	add_works(&wq, 10, 5, 0);
+	CHECK(get_status(&wq) == OT_FINISHED);
+	check_done(&wq, 10, 5);
+
+	/* More than the budget: the timer takes over the rest. */
+	add_works(&wq, 15, 500, 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	occamstimer_wq_get_stats(&wq, &stats);
+	CHECK(stats.serviced_inline + stats.serviced_timer == 515);
+	CHECK(stats.serviced_inline >= 15 + 64);
+	CHECK(Notified == 515);
+	check_done(&wq, 15, 500);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * Behind a workitem at or over the threshold, the short ones are
+ * serviced by the callback that services it, with no timer of their
+ * own.
+ */
+static void test_inline_mixed(void)
+{
+	struct occamstimer_workqueue  wq;
+	struct occamstimer_stats      stats;
+	long                          i;
+
+	setup(&wq);
+	CHECK(occamstimer_wq_set_inline(&wq, 1000) == 0);
+
+	for (i = 0; i < 100; i += 10) {
+		add_works(&wq, i, 1, 1000);
+		add_works(&wq, i + 1, 9, 999);
+	}
+
+	CHECK(occamstimer_wq_start(&wq) == 0);
+	CHECK(wait_finished(&wq) == 0);
+
+	occamstimer_wq_get_stats(&wq, &stats);
+	CHECK(stats.serviced_timer == 10);
+	CHECK(stats.serviced_inline == 90);
+	check_done(&wq, 0, 100);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+
+/*
+ * A timer configuration that names an unknown clock or CPU, or is
+ * changed while the workqueue is running, is refused and leaves the
+ * one in place.
+ */
+static void test_timer_config(void)
+{
+	struct occamstimer_workqueue     wq;
+	struct occamstimer_timer_config  cfg, bad;
+
+	setup(&wq);
+
+	occamstimer_wq_get_timer(&wq, &cfg);
+	CHECK(cfg.clock == CLOCK_MONOTONIC);
+	CHECK(cfg.soft == 0);
+	CHECK(cfg.cpu == -1);
+	CHECK(cfg.slack_ns == 0);
+
+	bad = cfg;
+	bad.clock = CLOCK_PROCESS_CPUTIME_ID;
+	CHECK(occamstimer_wq_set_timer(&wq, &bad) == -EINVAL);
+
+	bad = cfg;
+	bad.cpu = -2;
+	CHECK(occamstimer_wq_set_timer(&wq, &bad) == -EINVAL);
+
+	bad.cpu = nr_cpu_ids;
+	CHECK(occamstimer_wq_set_timer(&wq, &bad) == -EINVAL);
+
+	add_works(&wq, 0, 1, NSEC_PER_SEC);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+
+	bad = cfg;
+	bad.slack_ns = 1000;
+	CHECK(occamstimer_wq_set_timer(&wq, &bad) == -EBUSY);
+
+	occamstimer_wq_get_timer(&wq, &bad);
+	CHECK(memcmp(&bad, &cfg, sizeof(cfg)) == 0);
+
+	/* Paused, it may be changed again. */
+	CHECK(occamstimer_wq_pause(&wq) == 0);
+	bad.slack_ns = 1000;
+	CHECK(occamstimer_wq_set_timer(&wq, &bad) == 0);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * The work is serviced, in order, on each clock and with each of the
+ * other settings, which the userspace timer accepts and ignores.
+ */
+static void test_timer_clocks(void)
+{
+	static const clockid_t clocks[] = {
+		CLOCK_REALTIME, CLOCK_BOOTTIME, CLOCK_MONOTONIC,
+	};
+
+	struct occamstimer_workqueue     wq;
+	struct occamstimer_timer_config  cfg, got;
+	unsigned int                     i;
+
+	setup(&wq);
+
+	for (i = 0; i < ARRAY_SIZE(clocks); i++) {
+
+		cfg.clock = clocks[i];
+		cfg.soft = i & 1;
+		cfg.cpu = i == 2 ? 0 : -1;
+		cfg.slack_ns = 1000 * i;
+
+		CHECK(occamstimer_wq_set_timer(&wq, &cfg) == 0);
+		occamstimer_wq_get_timer(&wq, &got);
+		CHECK(memcmp(&got, &cfg, sizeof(cfg)) == 0);
+
+		/* Else adding would restart it on the new timer anyway. */
+		occamstimer_wq_set_status(&wq, OT_SETUP);
+
+		add_works(&wq, 0, 20, 10000);
+		CHECK(occamstimer_wq_start(&wq) == 0);
+		CHECK(wait_finished(&wq) == 0);
+		check_done(&wq, 0, 20);
+	}
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * Pausing the workqueue as the callback restarts the timer and then
+ * moving it to another clock neither loses a workitem nor leaves the
+ * old timer running under the new one.
+ */
+static void test_timer_reclock(void)
+{
+	struct occamstimer_workqueue     wq;
+	struct occamstimer_timer_config  cfg;
+	unsigned int                     i;
+
+	setup(&wq);
+	occamstimer_wq_get_timer(&wq, &cfg);
+
+	add_works(&wq, 0, 200, 10000);
+	CHECK(occamstimer_wq_start(&wq) == 0);
+
+	for (i = 0; get_status(&wq) != OT_FINISHED && i < 10000; i++) {
+		if (occamstimer_wq_pause(&wq))
+			continue;
+
+		cfg.clock = i & 1 ? CLOCK_MONOTONIC : CLOCK_BOOTTIME;
+		CHECK(occamstimer_wq_set_timer(&wq, &cfg) == 0);
+		CHECK(occamstimer_wq_start(&wq) == 0);
+	}
+
+	CHECK(wait_finished(&wq) == 0);
+	check_done(&wq, 0, 200);
+
+	occamstimer_wq_destroy(&wq);
+}
+
+
+/*
+ * Work added to one of several workqueues is spread over the rest by
+ * stealing, and each workitem comes back exactly once with the cookie
+ * it was added with, in whatever order. A single one keeps the order.
+ */
+static void test_mq_cookies(void)
+{
+	struct occamstimer_mq        mq;
+	struct occamstimer_stats     stats;
+	struct occamstimer_workitem  *work_ptr;
+	enum occamstimer_status      status;
+	char                         expect[OT_MAX_WORK_SIZE];
+	unsigned char                seen[200];
+	unsigned int                 nr;
+	ktime_t                      deadline;
+	long                         i, count;
+	LIST_HEAD(works);
+
+	for (nr = 1; nr <= 4; nr += 3) {
+		CHECK(occamstimer_mq_init(&mq, nr) == 0);
+		memset(seen, 0, sizeof(seen));
+
+		for (i = 0; i < 200; i++)
+			list_add_tail(&new_work(mq.wqs[0], i, 10000)->ent, &works);
+		CHECK(occamstimer_mq_add_work_list(&mq, mq.wqs[0], &works) == 0);
+
+		CHECK(occamstimer_mq_start(&mq) == 0);
+
+		deadline = ktime_add(ktime_get(), TEST_TIMEOUT_NS);
+		do {
+			sched_yield();
+			occamstimer_mq_get_status(&mq, &status);
+		} while (status != OT_FINISHED && ktime_get() < deadline);
+		CHECK(status == OT_FINISHED);
+
+		count = 0;
+		while ((work_ptr = occamstimer_mq_get_work(&mq)) != NULL) {
+			i = work_ptr->value.cookie;
+			CHECK(i >= 0 && i < 200);
+			if (i >= 0 && i < 200) {
+				CHECK(!seen[i]);
+				seen[i] = 1;
+
+				snprintf(expect, sizeof(expect), "workitem-%ld", i);
+				CHECK(strcmp(work_ptr->value.data, expect) == 0);
+			}
+
+			if (nr == 1)
+				CHECK(i == count);
+			count++;
+			kfree(work_ptr);
+		}
+		CHECK(count == 200);
+
+		occamstimer_mq_get_stats(&mq, &stats);
+		CHECK(stats.serviced_timer + stats.serviced_inline == 200);
+		if (nr > 1)
+			CHECK(stats.stolen > 0);
+		else
+			CHECK(stats.stolen == 0);
+
+		occamstimer_mq_destroy(&mq);
+	}
+}
+
+
+
+static const struct {
+	const char  *name;
+	void        (*run)(void);
+} Tests[] = {
+	{ "order",             test_order },
+	{ "start",             test_start },
+	{ "pause",             test_pause },
+	{ "restart",           test_restart },
+	{ "done_count",        test_done_count },
+	{ "destroy",           test_destroy },
+	{ "inline_threshold",  test_inline_threshold },
+	{ "inline",            test_inline },
+	{ "inline_mixed",      test_inline_mixed },
+	{ "timer_config",      test_timer_config },
+	{ "timer_clocks",      test_timer_clocks },
+	{ "timer_reclock",     test_timer_reclock },
+	{ "mq_cookies",        test_mq_cookies },
+};
+
+
+int main(int argc, char **argv)
+{
+	unsigned int  i;
+	int           before;
+
+	for (i = 0; i < ARRAY_SIZE(Tests); i++) {
+		before = Failures;
+		Tests[i].run();
+		printf("%-18s %s\n", Tests[i].name,
+		       Failures == before ? "ok" : "FAILED");
+	}
+
+	exit(Failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,371 @@
+/*
+ * otbench - Throughput and latency benchmark for /dev/occamstimer
+ *
+ * A configurable number of submitter threads add workitems to the
+ * device while a configurable number of consumer threads reap the
+ * completed work. Each workitem carries the time at which it was
+ * submitted in its payload, so the consumer that reaps it can record
+ * the end to end latency of the item through the device. At the end
+ * of the run the throughput, the number of device calls (IOCTLs) per
+ * workitem and the latency distribution are reported in a human
+ * readable, CSV or JSON format.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#define __USE_GNU
+#include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <linux/occamstimer.h>
+#include <occamstimer.h>
+
+#include "otbench.h"
+
+
+/* User cmd line parameters */
+struct bench_params Params = {
+	.submitters = 1,
+	.consumers = 1,
+	.items = 100000,
+	.payload = 64,
+	.interval = 0,
+	.format = OTBENCH_FORMAT_HUMAN,
+	.label = "",
+};
+
+/* The shared state of a run */
+struct bench_state State;
+
+
+static const char *format_names[] = {
+	[OTBENCH_FORMAT_HUMAN] = "human",
+	[OTBENCH_FORMAT_CSV]   = "csv",
+	[OTBENCH_FORMAT_JSON]  = "json",
+};
+
+
+/**
+ *  This subroutine processes the command line options
+ */
+void process_options (int argc, char *argv[])
+{
+	int error = 0;
+	int c, i;
+
+	static struct option long_options[] = {
+		{"submitters",       required_argument, NULL, 's'},
+		{"consumers",        required_argument, NULL, 'c'},
+		{"items",            required_argument, NULL, 'n'},
+		{"payload",          required_argument, NULL, 'p'},
+		{"interval",         required_argument, NULL, 'i'},
+		{"format",           required_argument, NULL, 'f'},
+		{"label",            required_argument, NULL, 'l'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "s:c:n:p:i:f:l:h",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			Params.submitters = atoi(optarg);
+			break;
+		case 'c':
+			Params.consumers = atoi(optarg);
+			break;
+		case 'n':
+			Params.items = atol(optarg);
+			break;
+		case 'p':
+			Params.payload = atoi(optarg);
+			break;
+		case 'i':
+			Params.interval = atol(optarg);
+			break;
+		case 'f':
+			error = 1;
+			for (i = 0; i < OTBENCH_FORMAT_MAX; i++) {
+				if (!strcmp(optarg, format_names[i])) {
+					Params.format = i;
+					error = 0;
+				}
+			}
+			break;
+		case 'l':
+			Params.label = optarg;
+			break;
+		case 'h':
+		default:
+			error = 1;
+			break;
+		}
+	}
+
+	if (Params.submitters < 1 || Params.consumers < 1 ||
+	    Params.items < 1 || Params.interval < 0 ||
+	    Params.payload < OTBENCH_MIN_PAYLOAD ||
+	    Params.payload >= OT_MAX_WORK_SIZE)
+		error = 1;
+
+	if (error) {
+		printf(help_string, argv[0], OTBENCH_MIN_PAYLOAD,
+		       OT_MAX_WORK_SIZE - 1);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * Submit this thread's share of the workitems. The payload of each
+ * workitem is the OTBENCH_TAG, the submission time and sequence
+ * number, padded out to the requested payload size.
+ */
+static void *submitter(void *arg)
+{
+	struct bench_thread *self = arg;
+	struct timespec     exec_int;
+	char                data[OT_MAX_WORK_SIZE];
+	long                seq;
+	int                 len;
+
+	exec_int.tv_sec = Params.interval / 1000000000L;
+	exec_int.tv_nsec = Params.interval % 1000000000L;
+
+	memset(data, 'x', Params.payload);
+	data[Params.payload] = '\0';
+
+	for (seq = self->id; seq < Params.items; seq += Params.submitters) {
+
+		len = snprintf(data, Params.payload, OTBENCH_TAG "%lld:%ld:",
+			       now_ns(), seq);
+		/* snprintf() terminates the header, so pad it again. */
+		if (len < Params.payload - 1)
+			data[len] = 'x';
+
+		self->calls++;
+		if (occamstimer_add_work(State.fd, data, &exec_int)) {
+			fprintf(stderr, "error adding work: %s\n", strerror(errno));
+			__sync_fetch_and_add(&State.failed, 1);
+			continue;
+		}
+
+		__sync_fetch_and_add(&State.submitted, 1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Reap completed workitems and record their latency until every
+ * successfully submitted workitem has been reaped.
+ */
+static void *consumer(void *arg)
+{
+	struct bench_thread *self = arg;
+	char                data[OT_MAX_WORK_SIZE];
+	long long           submitted_at;
+	long                seq, slot;
+
+	for (;;) {
+		if (State.reaped + State.failed >= Params.items)
+			break;
+
+		self->calls++;
+		if (occamstimer_get_work(State.fd, data)) {
+			if (errno != EAGAIN) {
+				fprintf(stderr, "error getting work: %s\n",
+					strerror(errno));
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+
+		if (sscanf(data, OTBENCH_TAG "%lld:%ld:", &submitted_at, &seq) != 2) {
+			/* Left over from someone else's run. */
+			__sync_fetch_and_add(&State.stray, 1);
+			continue;
+		}
+
+		slot = __sync_fetch_and_add(&State.reaped, 1);
+		if (slot < Params.items)
+			State.latency[slot] = now_ns() - submitted_at;
+	}
+
+	return NULL;
+}
+
+
+static int compare_ll(const void *a, const void *b)
+{
+	long long lhs = *(const long long *)a;
+	long long rhs = *(const long long *)b;
+
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+
+static long long percentile(long long *sorted, long count, double pct)
+{
+	long idx = (long)(pct / 100.0 * count);
+
+	if (idx >= count)
+		idx = count - 1;
+
+	return sorted[idx];
+}
+
+
+static void report(struct bench_result *res)
+{
+	struct utsname uts;
+
+	uname(&uts);
+
+	switch (Params.format) {
+	case OTBENCH_FORMAT_HUMAN:
+		printf("otbench %s (kernel %s)\n", Params.label, uts.release);
+		printf("----------------------------------------\n");
+		printf("submitters:\t\t%d\n", Params.submitters);
+		printf("consumers:\t\t%d\n", Params.consumers);
+		printf("payload:\t\t%d bytes\n", Params.payload);
+		printf("interval:\t\t%ld ns\n", Params.interval);
+		printf("items:\t\t\t%ld (%ld failed, %ld stray)\n",
+		       res->items, res->failed, res->stray);
+		printf("elapsed:\t\t%.3f s\n", res->elapsed_ns / 1e9);
+		printf("throughput:\t\t%.0f items/s\n", res->items_per_sec);
+		printf("syscalls/item:\t\t%.2f\n", res->calls_per_item);
+		printf("latency p50:\t\t%lld ns\n", res->p50);
+		printf("latency p99:\t\t%lld ns\n", res->p99);
+		printf("latency p99.9:\t\t%lld ns\n", res->p999);
+		printf("latency max:\t\t%lld ns\n", res->max);
+		break;
+
+	case OTBENCH_FORMAT_CSV:
+		printf("label,kernel,submitters,consumers,payload,interval_ns,"
+		       "items,failed,stray,elapsed_ns,items_per_sec,syscalls_per_item,"
+		       "p50_ns,p99_ns,p999_ns,max_ns\n");
+		printf("%s,%s,%d,%d,%d,%ld,%ld,%ld,%ld,%lld,%.0f,%.2f,%lld,%lld,%lld,%lld\n",
+		       Params.label, uts.release, Params.submitters, Params.consumers,
+		       Params.payload, Params.interval, res->items, res->failed,
+		       res->stray, res->elapsed_ns, res->items_per_sec,
+		       res->calls_per_item, res->p50, res->p99, res->p999, res->max);
+		break;
+
+	case OTBENCH_FORMAT_JSON:
+		printf("{\"label\": \"%s\", \"kernel\": \"%s\", "
+		       "\"submitters\": %d, \"consumers\": %d, \"payload\": %d, "
+		       "\"interval_ns\": %ld, \"items\": %ld, \"failed\": %ld, "
+		       "\"stray\": %ld, \"elapsed_ns\": %lld, \"items_per_sec\": %.0f, "
+		       "\"syscalls_per_item\": %.2f, \"latency_ns\": {\"p50\": %lld, "
+		       "\"p99\": %lld, \"p99.9\": %lld, \"max\": %lld}}\n",
+		       Params.label, uts.release, Params.submitters, Params.consumers,
+		       Params.payload, Params.interval, res->items, res->failed,
+		       res->stray, res->elapsed_ns, res->items_per_sec,
+		       res->calls_per_item, res->p50, res->p99, res->p999, res->max);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	struct bench_thread     *threads;
+	struct bench_result     res;
+	enum occamstimer_status status;
+	long long               begin, calls = 0;
+	int                     nthreads, i;
+
+	process_options(argc, argv);
+
+	memset(&State, 0, sizeof(State));
+	memset(&res, 0, sizeof(res));
+
+	State.latency = calloc(Params.items, sizeof(*State.latency));
+	nthreads = Params.submitters + Params.consumers;
+	threads = calloc(nthreads, sizeof(*threads));
+
+	if (!State.latency || !threads) {
+		printf("Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	State.fd = occamstimer_open();
+
+	if (State.fd < 0) {
+		printf("There was an error opening /dev/occamstimer.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	begin = now_ns();
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i].id = i < Params.submitters ? i : i - Params.submitters;
+		pthread_create(&threads[i].thread, NULL,
+			       i < Params.submitters ? submitter : consumer,
+			       &threads[i]);
+	}
+
+	/*
+	 * The device only leaves setup once it is started with work
+	 * pending, after which work added to it is serviced as it
+	 * arrives. Keep starting it until the first work shows up.
+	 */
+	do {
+		calls += 2;
+		occamstimer_start_device(State.fd);
+		occamstimer_get_status(State.fd, &status);
+	} while (status == OT_SETUP && State.submitted + State.failed < Params.items);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		calls += threads[i].calls;
+	}
+
+	res.elapsed_ns = now_ns() - begin;
+
+	occamstimer_close(State.fd);
+
+	res.items = State.reaped < Params.items ? State.reaped : Params.items;
+	res.failed = State.failed;
+	res.stray = State.stray;
+
+	if (res.items) {
+		qsort(State.latency, res.items, sizeof(*State.latency), compare_ll);
+
+		res.items_per_sec = res.items * 1e9 / res.elapsed_ns;
+		res.calls_per_item = (double)calls / res.items;
+		res.p50 = percentile(State.latency, res.items, 50.0);
+		res.p99 = percentile(State.latency, res.items, 99.0);
+		res.p999 = percentile(State.latency, res.items, 99.9);
+		res.max = State.latency[res.items - 1];
+	}
+
+	report(&res);
+
+	free(State.latency);
+	free(threads);
+
+	exit(res.failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,96 @@
+#ifndef OTBENCH_H
+#define OTBENCH_H
+
+#include <pthread.h>
+#include <linux/occamstimer.h>
+
+#define help_string "\
+	\n\nusage %s [--submitters=<n>] [--consumers=<n>] [--items=<n>]\n\
+	[--payload=<bytes>] [--interval=<ns>] [--format=human|csv|json]\n\
+	[--label=<name>] [--help]\n\n\
+\t--submitters=\t\tthe number of threads adding work (default 1)\n\
+\t--consumers=\t\tthe number of threads reaping work (default 1)\n\
+\t--items=\t\tthe total number of workitems (default 100000)\n\
+\t--payload=\t\tthe size of each workitem, %d to %d bytes (default 64)\n\
+\t--interval=\t\tthe exec_int of each workitem in ns (default 0)\n\
+\t--format=\t\tthe format of the report (default human)\n\
+\t--label=\t\ta name for this run included in the report\n\
+\t--help\t\t\tthis menu\n\n"
+
+/*
+ * Every payload starts with the tag, the submission time in ns and the
+ * sequence number of the workitem. The minimum payload has room for
+ * all three.
+ */
+#define OTBENCH_TAG "otbench:"
+#define OTBENCH_MIN_PAYLOAD 48
+
+
+enum otbench_format {
+	OTBENCH_FORMAT_HUMAN = 0,
+	OTBENCH_FORMAT_CSV,
+	OTBENCH_FORMAT_JSON,
+	OTBENCH_FORMAT_MAX,
+};
+
+
+struct bench_params {
+	int                  submitters;
+	int                  consumers;
+	long                 items;
+	int                  payload;
+	long                 interval;
+	enum otbench_format  format;
+	char                 *label;
+};
+
+
+/**
+ * @fd: The shared file descriptor to /dev/occamstimer
+ *
+ * @submitted: The number of workitems successfully added
+ *
+ * @failed: The number of workitems the device refused
+ *
+ * @reaped: The number of our workitems retrieved from the device
+ *
+ * @stray: The number of completed workitems retrieved that were not
+ *         submitted by this run
+ *
+ * @latency: The submit to reap latency in ns of each reaped workitem
+ */
+struct bench_state {
+	int                   fd;
+	volatile long         submitted;
+	volatile long         failed;
+	volatile long         reaped;
+	volatile long         stray;
+	long long             *latency;
+};
+
+
+/**
+ * @calls: The number of device calls made by this thread
+ */
+struct bench_thread {
+	pthread_t             thread;
+	int                   id;
+	long long             calls;
+};
+
+
+struct bench_result {
+	long                  items;
+	long                  failed;
+	long                  stray;
+	long long             elapsed_ns;
+	double                items_per_sec;
+	double                calls_per_item;
+	long long             p50;
+	long long             p99;
+	long long             p999;
+	long long             max;
+};
+
+
+#endif	/* OTBENCH_H */
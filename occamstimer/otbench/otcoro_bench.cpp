@@ -0,0 +1,377 @@
+/*
+ * otcoro_bench - Coroutine vs. thread-per-request submission
+ *
+ * Keeps --concurrency workitems in flight on the device at once,
+ * either as that many coroutines awaiting occamstimer::executor
+ * submissions on one thread, or as that many threads each blocking
+ * until its own workitem comes back, the way the library is usually
+ * wrapped by hand. Reports the throughput, the submit to completion
+ * latency and, for the coroutines, the heap allocations per await
+ * once the executor has warmed up.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <time.h>
+
+#include <occamstimer.hpp>
+
+
+#define help_string "\
+	\n\nusage %s [--items=<n>] [--concurrency=<n>] [--interval=<ns>]\n\
+	[--mode=coro|threads|both] [--help]\n\n\
+\t--items=\t\tthe number of workitems per run (default 100000)\n\
+\t--concurrency=\t\tthe workitems in flight at once (default 64)\n\
+\t--interval=\t\tthe exec_int of each workitem in ns (default 0)\n\
+\t--mode=\t\t\twhich to run (default both)\n\
+\t--help\t\t\tthis menu\n\n"
+
+
+struct bench_params {
+	long  items;
+	long  concurrency;
+	long  interval;
+	int   coro;
+	int   threads;
+};
+
+static struct bench_params Params = {
+	100000, 64, 0, 1, 1,
+};
+
+
+/*
+ * Every operator new is counted, so that the allocations made by a
+ * run of the executor can be told apart from the task frames.
+ */
+static std::atomic<long> nr_allocs;
+
+void *operator new(size_t size)
+{
+	void *ptr;
+
+	nr_allocs.fetch_add(1, std::memory_order_relaxed);
+
+	ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void report(const char *mode, long items, long long elapsed,
+		   std::vector<long long> &latency, double allocs)
+{
+	std::sort(latency.begin(), latency.end());
+
+	printf("%-8s items %8ld  %10.0f items/s  p50 %9lld ns  p99 %9lld ns",
+	       mode, items, items * 1e9 / elapsed,
+	       latency.empty() ? 0 : latency[(latency.size() - 1) / 2],
+	       latency.empty() ? 0 : latency[(latency.size() - 1) * 99 / 100]);
+
+	if (allocs >= 0)
+		printf("  %.3f allocs/await", allocs);
+
+	printf("\n");
+}
+
+
+/*
+ * ===============================================
+ *             Coroutines
+ * ===============================================
+ */
+
+static occamstimer::task submitter(occamstimer::executor &exec, long id, long count,
+				   std::vector<long long> &latency, long &failed)
+{
+	struct timespec  interval = { 0, Params.interval };
+	char             data[32];
+	long long        begin;
+	long             i;
+
+	for (i = 0; i < count; i++) {
+		snprintf(data, sizeof(data), "coro:%ld:%ld", id, i);
+
+		begin = now_ns();
+		if (co_await exec.submit(data, interval))
+			failed++;
+		else
+			latency.push_back(now_ns() - begin);
+	}
+}
+
+
+static long run_coro(occamstimer::executor &exec, long items,
+		     std::vector<long long> &latency)
+{
+	long failed = 0;
+	long i;
+
+	for (i = 0; i < Params.concurrency; i++) {
+		exec.spawn(submitter(exec, i, items / Params.concurrency +
+				     (i < items % Params.concurrency), latency, failed));
+	}
+
+	exec.run();
+
+	return failed;
+}
+
+
+static void bench_coro(int fd)
+{
+	occamstimer::executor   exec(fd);
+	std::vector<long long>  latency;
+	long long               begin, elapsed;
+	long                    allocs, failed;
+
+	exec.reserve(Params.concurrency);
+	latency.reserve(Params.items);
+
+	/* grow the context's ring to the concurrency first */
+	run_coro(exec, Params.concurrency * 4, latency);
+	latency.clear();
+
+	allocs = nr_allocs.load();
+	begin = now_ns();
+
+	failed = run_coro(exec, Params.items, latency);
+
+	elapsed = now_ns() - begin;
+	allocs = nr_allocs.load() - allocs - Params.concurrency;
+
+	if (failed)
+		printf("coro: %ld workitems failed\n", failed);
+
+	report("coro", Params.items, elapsed, latency,
+	       (double)allocs / Params.items);
+}
+
+
+/*
+ * ===============================================
+ *             Thread per request
+ * ===============================================
+ */
+
+/*
+ * Each thread adds one workitem tagged with its id and sleeps until
+ * the reaper, the only reader of the device, finds it completed.
+ */
+struct thread_slot {
+	std::mutex               lock;
+	std::condition_variable  cond;
+	bool                     done;
+};
+
+struct thread_bench {
+	int                       fd;
+	std::vector<thread_slot>  slots;
+	std::mutex                submit_lock;
+	std::atomic<long>         remaining;
+	std::atomic<long>         failed;
+	std::mutex                latency_lock;
+	std::vector<long long>    latency;
+
+	explicit thread_bench(int fd, long n) : fd(fd), slots(n), remaining(0), failed(0) {}
+};
+
+
+static void request_thread(thread_bench *tb, long id, long count)
+{
+	struct timespec  interval = { 0, Params.interval };
+	thread_slot      &slot = tb->slots[id];
+	char             data[32];
+	long long        begin;
+	long             i;
+	int              ret;
+
+	for (i = 0; i < count; i++) {
+		snprintf(data, sizeof(data), "thread:%ld:%ld", id, i);
+
+		std::unique_lock<std::mutex> guard(slot.lock);
+		slot.done = false;
+
+		begin = now_ns();
+		{
+			std::lock_guard<std::mutex> submit(tb->submit_lock);
+			ret = occamstimer_add_work(tb->fd, data, &interval);
+			if (!ret)
+				occamstimer_start_device(tb->fd);
+		}
+
+		if (ret) {
+			tb->failed++;
+			tb->remaining--;
+			continue;
+		}
+
+		slot.cond.wait(guard, [&slot] { return slot.done; });
+
+		std::lock_guard<std::mutex> lat(tb->latency_lock);
+		tb->latency.push_back(now_ns() - begin);
+	}
+}
+
+
+static void reap_thread(thread_bench *tb)
+{
+	struct timespec  ts = { 0, 20000 };
+	char             data[OT_MAX_WORK_SIZE];
+	long             id;
+
+	while (tb->remaining > 0) {
+		if (occamstimer_get_work(tb->fd, data)) {
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		if (sscanf(data, "thread:%ld:", &id) != 1 || id < 0 ||
+		    id >= (long)tb->slots.size())
+			continue;
+
+		thread_slot &slot = tb->slots[id];
+		{
+			std::lock_guard<std::mutex> guard(slot.lock);
+			slot.done = true;
+		}
+		slot.cond.notify_one();
+		tb->remaining--;
+	}
+}
+
+
+static void bench_threads(int fd)
+{
+	thread_bench              tb(fd, Params.concurrency);
+	std::vector<std::thread>  threads;
+	char                      data[OT_MAX_WORK_SIZE];
+	long long                 begin, elapsed;
+	long                      i;
+
+	while (!occamstimer_get_work(fd, data))
+		;
+
+	tb.remaining = Params.items;
+	tb.latency.reserve(Params.items);
+
+	begin = now_ns();
+
+	std::thread reaper(reap_thread, &tb);
+	for (i = 0; i < Params.concurrency; i++) {
+		threads.emplace_back(request_thread, &tb, i,
+				     Params.items / Params.concurrency +
+				     (i < Params.items % Params.concurrency));
+	}
+
+	for (auto &t : threads)
+		t.join();
+	reaper.join();
+
+	elapsed = now_ns() - begin;
+
+	if (tb.failed)
+		printf("threads: %ld workitems failed\n", tb.failed.load());
+
+	report("threads", Params.items, elapsed, tb.latency, -1);
+}
+
+
+static void process_options(int argc, char *argv[])
+{
+	int c;
+
+	static struct option long_options[] = {
+		{"items",            required_argument, NULL, 'n'},
+		{"concurrency",      required_argument, NULL, 'c'},
+		{"interval",         required_argument, NULL, 'i'},
+		{"mode",             required_argument, NULL, 'm'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "n:c:i:m:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			Params.items = atol(optarg);
+			break;
+		case 'c':
+			Params.concurrency = atol(optarg);
+			break;
+		case 'i':
+			Params.interval = atol(optarg);
+			break;
+		case 'm':
+			Params.coro = strcmp(optarg, "threads") != 0;
+			Params.threads = strcmp(optarg, "coro") != 0;
+			break;
+		case 'h':
+		default:
+			printf(help_string, argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (Params.items < 1 || Params.concurrency < 1 ||
+	    Params.interval < 0 || Params.interval >= 1000000000L) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	int fd;
+
+	process_options(argc, argv);
+
+	fd = occamstimer_open();
+	if (fd < 0) {
+		printf("There was an error opening /dev/occamstimer.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (Params.coro)
+		bench_coro(fd);
+
+	if (Params.threads)
+		bench_threads(fd);
+
+	occamstimer_close(fd);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,431 @@
+/*
+ * oturing_bench - io_uring passthrough vs. IOCTL submission
+ *
+ * Runs the same workload through /dev/occamstimer twice. The IOCTL
+ * run adds batches with occamstimer_add_work_batch() and polls for
+ * completed work with occamstimer_get_work(). The io_uring run
+ * issues the same calls as IORING_OP_URING_CMD submissions and keeps
+ * --depth get_work commands waiting in the kernel, so completed work
+ * arrives as CQEs without polling. Reports the throughput, system
+ * calls per workitem and the submit to reap latency of each.
+ *
+ * bench_uring() doubles as the example of driving the device from
+ * liburing: prep_cmd() is all it takes to turn an IOCTL call into a
+ * submission. Completed work carries the cookie it was added with,
+ * here its index in the workload, as from get_work.
+ *
+ * Needs a kernel whose occamstimer module implements uring_cmd, 6.8
+ * or newer with CONFIG_IO_URING.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <liburing.h>
+#include <occamstimer.h>
+
+
+#define help_string "\
+	\n\nusage %s [--items=<n>] [--depth=<n>] [--interval=<ns>]\n\
+	[--mode=ioctl|uring|both] [--help]\n\n\
+\t--items=\t\tthe number of workitems per run (default 100000)\n\
+\t--depth=\t\tthe get_work commands kept waiting (default 64)\n\
+\t--interval=\t\tthe exec_int of each workitem in ns (default 0)\n\
+\t--mode=\t\t\twhich to run (default both)\n\
+\t--help\t\t\tthis menu\n\n"
+
+#define URING_ENTRIES  256
+
+/* user_data of a batch CQE, the low bits are the batch */
+#define URING_BATCH    (1ULL << 63)
+#define URING_START    (1ULL << 62)
+
+#define PAYLOAD_SIZE   32
+
+
+struct bench_params {
+	long  items;
+	int   depth;
+	long  interval;
+	int   ioctl;
+	int   uring;
+};
+
+static struct bench_params Params = {
+	.items = 100000,
+	.depth = 64,
+	.interval = 0,
+	.ioctl = 1,
+	.uring = 1,
+};
+
+
+/*
+ * The whole workload, built before timing. Each payload holds its
+ * submission time, written just before its batch is submitted.
+ */
+struct workload {
+	char                          (*payload)[PAYLOAD_SIZE];
+	struct occamstimer_work_desc  *descs;
+	occamstimer_ioctl_batch_t     *batches;
+	long                          nr_batches;
+	long long                     *latency;
+	long                          reaped;
+	long                          failed;
+	long                          syscalls;
+};
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int workload_init(struct workload *w)
+{
+	long i;
+
+	memset(w, 0, sizeof(*w));
+
+	w->nr_batches = (Params.items + OT_MAX_WORK_BATCH - 1) / OT_MAX_WORK_BATCH;
+	w->payload = malloc(PAYLOAD_SIZE * Params.items);
+	w->descs = malloc(sizeof(*w->descs) * Params.items);
+	w->batches = malloc(sizeof(*w->batches) * w->nr_batches);
+	w->latency = malloc(sizeof(*w->latency) * Params.items);
+
+	if (!w->payload || !w->descs || !w->batches || !w->latency)
+		return -1;
+
+	for (i = 0; i < Params.items; i++) {
+		w->descs[i].data = w->payload[i];
+		w->descs[i].exec_int.tv_sec = 0;
+		w->descs[i].exec_int.tv_nsec = Params.interval;
+		w->descs[i].cookie = i;
+	}
+
+	for (i = 0; i < w->nr_batches; i++) {
+		w->batches[i].cmd = OT_ATTR_ADD;
+		w->batches[i].value = &w->descs[i * OT_MAX_WORK_BATCH];
+		w->batches[i].count = i == w->nr_batches - 1 ?
+			Params.items - i * OT_MAX_WORK_BATCH : OT_MAX_WORK_BATCH;
+	}
+
+	return 0;
+}
+
+
+static void workload_free(struct workload *w)
+{
+	free(w->payload);
+	free(w->descs);
+	free(w->batches);
+	free(w->latency);
+}
+
+
+static void stamp_batch(struct workload *w, long batch)
+{
+	long long  now = now_ns();
+	unsigned   i;
+
+	for (i = 0; i < w->batches[batch].count; i++)
+		snprintf(w->payload[batch * OT_MAX_WORK_BATCH + i], PAYLOAD_SIZE,
+			 "oturing:%lld", now);
+}
+
+
+static void reap(struct workload *w, const char *data)
+{
+	long long submitted;
+
+	if (sscanf(data, "oturing:%lld", &submitted) == 1)
+		w->latency[w->reaped] = now_ns() - submitted;
+
+	w->reaped++;
+}
+
+
+static int cmp_latency(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static void report(const char *mode, struct workload *w, long long elapsed)
+{
+	long n = w->reaped;
+
+	qsort(w->latency, n, sizeof(*w->latency), cmp_latency);
+
+	printf("%-6s items %8ld  %10.0f items/s  %6.3f syscalls/item  "
+	       "p50 %9lld ns  p99 %9lld ns\n",
+	       mode, n, n * 1e9 / elapsed, (double)w->syscalls / Params.items,
+	       n ? w->latency[(n - 1) / 2] : 0,
+	       n ? w->latency[(n - 1) * 99 / 100] : 0);
+
+	if (w->failed)
+		printf("%s: %ld workitems failed\n", mode, w->failed);
+}
+
+
+static void drain(int fd)
+{
+	char data[OT_MAX_WORK_SIZE];
+
+	while (!occamstimer_get_work(fd, data))
+		;
+}
+
+
+/*
+ * ===============================================
+ *             IOCTL
+ * ===============================================
+ */
+
+static void bench_ioctl(int fd)
+{
+	struct timespec  ts = { 0, 20000 };
+	struct workload  w;
+	char             data[OT_MAX_WORK_SIZE];
+	long long        begin;
+	long             batch;
+
+	if (workload_init(&w)) {
+		printf("error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	drain(fd);
+	begin = now_ns();
+
+	for (batch = 0; batch < w.nr_batches; batch++) {
+		stamp_batch(&w, batch);
+
+		w.syscalls++;
+		if (occamstimer_add_work_batch(fd, w.batches[batch].value,
+					       w.batches[batch].count))
+			w.failed += w.batches[batch].count;
+
+		if (batch == 0) {
+			w.syscalls++;
+			occamstimer_start_device(fd);
+		}
+
+		for (;;) {
+			w.syscalls++;
+			if (occamstimer_get_work(fd, data))
+				break;
+			reap(&w, data);
+		}
+	}
+
+	while (w.reaped + w.failed < Params.items) {
+		w.syscalls++;
+		if (occamstimer_get_work(fd, data))
+			nanosleep(&ts, NULL);
+		else
+			reap(&w, data);
+	}
+
+	report("ioctl", &w, now_ns() - begin);
+	workload_free(&w);
+}
+
+
+/*
+ * ===============================================
+ *             io_uring
+ * ===============================================
+ */
+
+static void prep_cmd(struct io_uring_sqe *sqe, int fd, unsigned int op,
+		     void *arg, unsigned long long user_data)
+{
+	struct occamstimer_uring_cmd cmd = { (unsigned long)arg };
+
+	io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+	sqe->cmd_op = op;
+	memcpy(sqe->cmd, &cmd, sizeof(cmd));
+	io_uring_sqe_set_data64(sqe, user_data);
+}
+
+
+static void bench_uring(int fd)
+{
+	struct io_uring             ring;
+	struct io_uring_sqe         *sqe;
+	struct io_uring_cqe         *cqe;
+	struct workload             w;
+	occamstimer_ioctl_work_t    *gets;
+	occamstimer_ioctl_action_t  start = { OT_ATTR_SET, OT_ACTION_START };
+	unsigned long long          data;
+	long long                   begin;
+	long                        batch = 0, waiting = 0;
+	int                         started = 0;
+	int                         i, ret;
+
+	if (workload_init(&w) ||
+	    !(gets = calloc(Params.depth, sizeof(*gets)))) {
+		printf("error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+	if (ret) {
+		printf("error: io_uring_queue_init: %s\n", strerror(-ret));
+		exit(EXIT_FAILURE);
+	}
+
+	drain(fd);
+	begin = now_ns();
+
+	for (i = 0; i < Params.depth && i < Params.items; i++) {
+		gets[i].cmd = OT_ATTR_GET;
+		prep_cmd(io_uring_get_sqe(&ring), fd, OCCAMSTIMER_IOCTL_WORK,
+			 &gets[i], i);
+		waiting++;
+	}
+
+	while (w.reaped + w.failed < Params.items) {
+
+		/* queue as many batches as the ring has room for */
+		while (batch < w.nr_batches && (sqe = io_uring_get_sqe(&ring))) {
+			stamp_batch(&w, batch);
+			prep_cmd(sqe, fd, OCCAMSTIMER_IOCTL_BATCH,
+				 &w.batches[batch], URING_BATCH | batch);
+			batch++;
+		}
+
+		w.syscalls++;
+		ret = io_uring_submit_and_wait(&ring, 1);
+		if (ret < 0) {
+			printf("error: io_uring_submit_and_wait: %s\n", strerror(-ret));
+			break;
+		}
+
+		while (!io_uring_peek_cqe(&ring, &cqe)) {
+			data = io_uring_cqe_get_data64(cqe);
+			ret = cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+
+			if (data == URING_START)
+				continue;
+
+			if (data & URING_BATCH) {
+				if (ret < 0) {
+					w.failed += w.batches[data & ~URING_BATCH].count;
+					continue;
+				}
+
+				if (!started && (sqe = io_uring_get_sqe(&ring))) {
+					prep_cmd(sqe, fd, OCCAMSTIMER_IOCTL_ACTION,
+						 &start, URING_START);
+					started = 1;
+				}
+				continue;
+			}
+
+			waiting--;
+			if (ret < 0) {
+				printf("error: get_work: %s\n", strerror(-ret));
+				w.failed++;
+			} else {
+				reap(&w, gets[data].value.data);
+			}
+
+			/* wait for the next one in the same slot */
+			if (w.reaped + w.failed + waiting < Params.items &&
+			    (sqe = io_uring_get_sqe(&ring))) {
+				prep_cmd(sqe, fd, OCCAMSTIMER_IOCTL_WORK, &gets[data], data);
+				waiting++;
+			}
+		}
+	}
+
+	report("uring", &w, now_ns() - begin);
+
+	io_uring_queue_exit(&ring);
+	workload_free(&w);
+	free(gets);
+}
+
+
+static void process_options(int argc, char *argv[])
+{
+	int c;
+
+	static struct option long_options[] = {
+		{"items",            required_argument, NULL, 'n'},
+		{"depth",            required_argument, NULL, 'd'},
+		{"interval",         required_argument, NULL, 'i'},
+		{"mode",             required_argument, NULL, 'm'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "n:d:i:m:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			Params.items = atol(optarg);
+			break;
+		case 'd':
+			Params.depth = atoi(optarg);
+			break;
+		case 'i':
+			Params.interval = atol(optarg);
+			break;
+		case 'm':
+			Params.ioctl = strcmp(optarg, "uring") != 0;
+			Params.uring = strcmp(optarg, "ioctl") != 0;
+			break;
+		case 'h':
+		default:
+			printf(help_string, argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (Params.items < 1 || Params.depth < 1 || Params.depth > URING_ENTRIES / 2 ||
+	    Params.interval < 0 || Params.interval >= 1000000000L) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	int fd;
+
+	process_options(argc, argv);
+
+	fd = occamstimer_open();
+	if (fd < 0) {
+		printf("There was an error opening /dev/occamstimer.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (Params.ioctl)
+		bench_ioctl(fd);
+
+	if (Params.uring)
+		bench_uring(fd);
+
+	occamstimer_close(fd);
+
+	exit(EXIT_SUCCESS);
+}
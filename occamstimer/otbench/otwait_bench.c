@@ -0,0 +1,212 @@
+/*
+ * otwait_bench - Spinning vs. blocking for completed work
+ *
+ * Adds one workitem at a time and waits for it to come back with an
+ * occamstimer_waiter in each of its modes: spinning on the device's
+ * completion sequence page, spinning for --spin ns and then sleeping
+ * on the device's eventfd, and only sleeping. This is done at
+ * exec_int of 1, 10 and 100 us, or the one given by --interval.
+ * Reports the submit to reap latency of each, and how much of it was
+ * spent beyond the exec_int of the workitem.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <occamstimer.h>
+
+
+#define help_string "\
+	\n\nusage %s [--items=<n>] [--interval=<ns>] [--spin=<ns>]\n\
+	[--mode=spin|hybrid|block|all] [--help]\n\n\
+\t--items=\t\tthe number of workitems per run (default 2000)\n\
+\t--interval=\t\tthe exec_int of each workitem in ns\n\
+\t\t\t\t(default 1000, 10000 and 100000 in turn)\n\
+\t--spin=\t\t\thow long the hybrid waiter spins in ns\n\
+\t\t\t\t(default OT_WAIT_SPIN_NS)\n\
+\t--mode=\t\t\twhich to run (default all)\n\
+\t--help\t\t\tthis menu\n\n"
+
+
+struct bench_params {
+	long       items;
+	long       interval;
+	long long  spin;
+	int        modes[3];
+};
+
+static struct bench_params Params = {
+	.items = 2000,
+	.interval = 0,
+	.spin = OT_WAIT_SPIN_NS,
+	.modes = { 1, 1, 1 },
+};
+
+static const char *mode_names[] = {
+	[OT_WAIT_SPIN]   = "spin",
+	[OT_WAIT_HYBRID] = "hybrid",
+	[OT_WAIT_BLOCK]  = "block",
+};
+
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int cmp_latency(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static void bench_wait(int fd, enum occamstimer_wait_mode mode, long interval,
+		       long long *latency)
+{
+	struct occamstimer_waiter  *w;
+	struct timespec            exec_int = { 0, interval };
+	char                       data[OT_MAX_WORK_SIZE];
+	char                       work[] = "otwait";
+	long long                  begin;
+	double                     sum = 0;
+	long                       i, n = 0;
+
+	w = occamstimer_waiter_create(fd, mode, Params.spin);
+	if (!w) {
+		printf("%s: cannot create waiter: %s\n", mode_names[mode],
+		       strerror(errno));
+		return;
+	}
+
+	while (!occamstimer_get_work(fd, data))
+		;
+
+	for (i = 0; i < Params.items; i++) {
+		begin = now_ns();
+
+		if (occamstimer_add_work(fd, work, &exec_int)) {
+			printf("%s: failed to add work\n", mode_names[mode]);
+			break;
+		}
+
+		/* Work added to a finished device restarts it. */
+		if (i == 0)
+			occamstimer_start_device(fd);
+
+		if (occamstimer_wait_work(w, data)) {
+			printf("%s: failed to wait for work: %s\n",
+			       mode_names[mode], strerror(errno));
+			break;
+		}
+
+		latency[n++] = now_ns() - begin;
+		sum += latency[n - 1];
+	}
+
+	occamstimer_waiter_destroy(w);
+
+	if (!n)
+		return;
+
+	qsort(latency, n, sizeof(*latency), cmp_latency);
+
+	printf("%-6s interval %6ld ns  p50 %8lld ns  p99 %8lld ns  "
+	       "mean %8.0f ns  p50 beyond interval %8lld ns\n",
+	       mode_names[mode], interval, latency[(n - 1) / 2],
+	       latency[(n - 1) * 99 / 100], sum / n,
+	       latency[(n - 1) / 2] - interval);
+}
+
+
+static void process_options(int argc, char *argv[])
+{
+	int c, m;
+
+	static struct option long_options[] = {
+		{"items",            required_argument, NULL, 'n'},
+		{"interval",         required_argument, NULL, 'i'},
+		{"spin",             required_argument, NULL, 's'},
+		{"mode",             required_argument, NULL, 'm'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "n:i:s:m:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			Params.items = atol(optarg);
+			break;
+		case 'i':
+			Params.interval = atol(optarg);
+			break;
+		case 's':
+			Params.spin = atoll(optarg);
+			break;
+		case 'm':
+			for (m = 0; m < 3; m++)
+				Params.modes[m] = !strcmp(optarg, "all") ||
+					!strcmp(optarg, mode_names[m]);
+			break;
+		case 'h':
+		default:
+			printf(help_string, argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (Params.items < 1 || Params.spin < 0 ||
+	    Params.interval < 0 || Params.interval >= 1000000000L) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	static const long  intervals[] = { 1000, 10000, 100000 };
+	long long          *latency;
+	int                fd, i, m;
+
+	process_options(argc, argv);
+
+	latency = malloc(sizeof(*latency) * Params.items);
+	if (!latency) {
+		printf("error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = occamstimer_open();
+	if (fd < 0) {
+		printf("There was an error opening /dev/occamstimer.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (Params.interval && i)
+			break;
+
+		for (m = 0; m < 3; m++) {
+			if (Params.modes[m])
+				bench_wait(fd, m, Params.interval ?
+					   Params.interval : intervals[i], latency);
+		}
+	}
+
+	occamstimer_close(fd);
+	free(latency);
+
+	exit(EXIT_SUCCESS);
+}
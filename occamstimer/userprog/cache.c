@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "workload.h"
+
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+
+/**
+ * A 64 bit hash of @len bytes at @buf, taken a word at a time so that
+ * hashing a large config costs little next to parsing it. This is
+ * not a cryptographic hash; it only has to tell versions of a config
+ * apart.
+ */
+static uint64_t hash_bytes(const unsigned char *buf, size_t len)
+{
+	const uint64_t  k1 = 0x87c37b91114253d5ULL;
+	const uint64_t  k2 = 0x4cf5ad432745937fULL;
+	uint64_t        h = len * k1;
+	uint64_t        w;
+
+	for (; len >= sizeof(w); buf += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, buf, sizeof(w));
+		h ^= rotl64(w * k1, 31) * k2;
+		h = rotl64(h, 27) * 5 + 0x52dce729;
+	}
+
+	w = 0;
+	memcpy(&w, buf, len);
+	h ^= rotl64(w * k1, 31) * k2;
+
+	/* final mix, so that every input bit affects every output bit */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb93fe53e88f9ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+
+/**
+ * Create the cache directory if needed and write its path to @dir.
+ */
+static int cache_dir(char *dir, size_t size)
+{
+	const char  *base = getenv("XDG_CACHE_HOME");
+	const char  *home = getenv("HOME");
+	int         n;
+
+	if (base && *base)
+		n = snprintf(dir, size, "%s", base);
+	else if (home && *home)
+		n = snprintf(dir, size, "%s/.cache", home);
+	else
+		return -1;
+
+	if (n < 0 || (size_t)n >= size)
+		return -1;
+
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		return -1;
+
+	n = snprintf(dir + n, size - n, "/%s", CONFIG_CACHE_DIR);
+	if (n < 0 || (size_t)n >= size)
+		return -1;
+
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Write to @path the name the parsed form of the config @filename is
+ * cached under, which changes whenever the file's contents do. The
+ * cached workload may not exist yet.
+ *
+ * Returns -1 if the config could not be read or there is no cache
+ * directory.
+ */
+int config_cache_path(const char *filename, char *path, size_t size)
+{
+	struct stat  st;
+	void         *map;
+	uint64_t     hash;
+	size_t       n;
+	int          fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	hash = hash_bytes(map, st.st_size);
+	munmap(map, st.st_size);
+
+	if (cache_dir(path, size))
+		return -1;
+
+	n = strlen(path);
+	if (snprintf(path + n, size - n, "/%016llx-%d-%d%s", 
+		     (unsigned long long)hash, CONFIG_CACHE_VERSION, 
+		     OTW_VERSION, OTW_SUFFIX) >= (int)(size - n))
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Cache the @count decoded @workspecs as the workload @path. The file
+ * is written under a temporary name and renamed into place, so other
+ * runs never see a partial cache.
+ */
+int config_cache_store(const char *path, workspec_t *workspecs, int count)
+{
+	struct otw_writer  wr;
+	char               tmp[4096];
+	int                ret = 0;
+	int                i;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) 
+	    >= (int)sizeof(tmp))
+		return -1;
+
+	if (otw_writer_open(&wr, tmp))
+		return -1;
+
+	for (i = 0; i < count && !ret; i++) {
+		ret = otw_writer_add(&wr, workspecs[i].data, 
+				     strlen(workspecs[i].data), 
+				     &workspecs[i].exec_int);
+	}
+
+	if (otw_writer_close(&wr))
+		ret = -1;
+
+	if (!ret && rename(tmp, path))
+		ret = -1;
+
+	if (ret)
+		unlink(tmp);
+
+	return ret;
+}
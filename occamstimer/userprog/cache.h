@@ -0,0 +1,24 @@
+#ifndef OTCACHE_H
+#define OTCACHE_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/*
+ * Parsed configs are cached as binary workloads (see workload.h)
+ * named by a hash of the config file's contents, so a cached workload
+ * is found again only while the file is unchanged. The cache lives in
+ * $XDG_CACHE_HOME/occamstimer, or ~/.cache/occamstimer.
+ *
+ * CONFIG_CACHE_VERSION is part of every name and must be bumped
+ * whenever the same config would decode differently, e.g. after a
+ * change to workitem.schema.
+ */
+#define CONFIG_CACHE_DIR      "occamstimer"
+#define CONFIG_CACHE_VERSION  1
+
+int config_cache_path(const char *filename, char *path, size_t size);
+int config_cache_store(const char *path, workspec_t *workspecs, int count);
+
+#endif	/* OTCACHE_H */
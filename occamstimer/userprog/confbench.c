@@ -0,0 +1,174 @@
+/*
+ * Occam's Timer config benchmark
+ *
+ * Times the stages of loading an XML config through xhashconf so
+ * that changes to the parser can be compared on large workloads.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#define __USE_GNU
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "config.h"
+#include "parallel.h"
+#include "xhashconf.h"
+
+#define help_string "\
+	\n\nusage %s --config=<filename> [--rounds=<n>] [--mapped] [--jobs=<n>]\n\
+	[--dump=<filename>] [--help]\n\n\
+\t--config=\t\tthe configuration file of work items\n\
+\t--rounds=\t\tthe number of times to load it (default 5)\n\
+\t--mapped\t\tparse with kusp_map_xml_config() instead of libxml2\n\
+\t--jobs=\t\t\tparse and decode with parallel_get_config() on\n\
+\t\t\t\tthis many threads\n\
+\t--dump=\t\t\talso time writing the parsed config back out\n\
+\t--help\t\t\tthis menu\n\n"
+
+
+static long peak_rss_kb(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ru.ru_maxrss;
+}
+
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+int main(int argc, char** argv)
+{
+	char         *filename = NULL;
+	char         *dump_file = NULL;
+	int          rounds = 5;
+	int          mapped = 0;
+	int          jobs = 0;
+	int          round, c;
+	kusp_config  *config;
+	workspec_t   *workspecs;
+	double       begin, parse, decode, dump, teardown;
+	long         rss;
+	size_t       size;
+	int          count;
+
+	static struct option long_options[] = {
+		{"config",           required_argument, NULL, 'c'},
+		{"rounds",           required_argument, NULL, 'r'},
+		{"mapped",           no_argument,       NULL, 'm'},
+		{"jobs",             required_argument, NULL, 'j'},
+		{"dump",             required_argument, NULL, 'd'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "c:r:mj:d:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			filename = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'm':
+			mapped = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'd':
+			dump_file = optarg;
+			break;
+		default:
+			printf(help_string, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!filename || rounds < 1) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (round = 0; round < (jobs ? rounds : 0); round++) {
+
+		begin = now_ms();
+		workspecs = parallel_get_config(&filename, 1, jobs, &count);
+		parse = now_ms() - begin;
+
+		if (!workspecs) {
+			printf("error: failed to parse %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+
+		begin = now_ms();
+		free_config(workspecs);
+		teardown = now_ms() - begin;
+
+		printf("round %d jobs %d parse+decode %10.2f ms teardown %10.2f ms "
+		       "%d workitems\n", round, jobs, parse, teardown, count);
+	}
+
+	for (round = 0; round < (jobs ? 0 : rounds); round++) {
+
+		begin = now_ms();
+		if (mapped)
+			config = kusp_map_xml_config(filename);
+		else
+			config = kusp_parse_xml_config(filename);
+		parse = now_ms() - begin;
+
+		if (!config) {
+			printf("error: failed to parse %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+
+		size = kusp_arena_used(config->arena);
+
+		if (dump_file) {
+			rss = peak_rss_kb();
+			begin = now_ms();
+			if (kusp_dump_config(config, dump_file))
+				exit(EXIT_FAILURE);
+			dump = now_ms() - begin;
+
+			printf("round %d dump %10.2f ms peak rss +%ld KiB\n",
+			       round, dump, peak_rss_kb() - rss);
+		}
+
+		begin = now_ms();
+		workspecs = get_config(config, &count);
+		decode = now_ms() - begin;
+
+		if (!workspecs) {
+			printf("error: failed to decode %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+
+		begin = now_ms();
+		free_config(workspecs);
+		kusp_free_config(config);
+		teardown = now_ms() - begin;
+
+		printf("round %d parse %10.2f ms decode %8.1f ns/item "
+		       "teardown %10.2f ms tree %10zu KiB\n",
+		       round, parse, count ? decode * 1e6 / count : 0.0, 
+		       teardown, size / 1024);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -2,23 +2,40 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
 
+#include <libxml/xmlreader.h>
+
 #include "config.h"
 #include "xhashconf.h"
 
 
-static workspec_t* get_new_workspec();
+#define DECODE_INVALID  -1
+#define DECODE_UNKNOWN  -2
+
+static void init_workspec(workspec_t *ws);
+static int decode_string(char *field, size_t size, const char *value, size_t len);
+static int decode_long(long *num, const char *value, size_t len, long min, long max);
+static int set_workspec_attr(workspec_t *ws, const char *name, size_t name_len,
+			     const char *value, size_t len);
+
+/* decode_workitem_attr(), generated from workitem.schema */
+#include "workitem_decoder.h"
 
 //Public:
+/**
+ * Decode the <workitem>s of @config into a single array of exactly
+ * *@t_count workspecs, in config order. The array can be handed to
+ * the device as it is and is released with free_config().
+ */
 workspec_t* get_config(kusp_config *config, int *t_count)
 {
 	
 	kusp_config *workspec_config = NULL;
 	kusp_config *kc_elem = NULL;
-	kusp_attr   *kc_attr, *kc_tmp_attr;
-	workspec_t  *wspec_list = NULL;
-	workspec_t  *wspec_elem = NULL;
+	workspec_t  *wspec_array = NULL;
+	int         count = 0;
 
 	*t_count = 0;
 	
@@ -39,79 +56,252 @@ workspec_t* get_config(kusp_config *config, int *t_count)
 	}
 
 
-	DL_FOREACH(workspec_config, kc_elem){
+	DL_FOREACH(workspec_config, kc_elem) {
+		count++;
+	}
 
-		wspec_elem = get_new_workspec();				
+	wspec_array = malloc(sizeof(workspec_t) * count);
+	if (!wspec_array) {
+		printf("error: out of memory for %d workitems\n", count);
+		return NULL;
+	}
 
-		HASH_ITER(hh, kc_elem->attributes, kc_attr, kc_tmp_attr) {
+	DL_FOREACH(workspec_config, kc_elem){
 
-			if (!strcmp(kc_attr->name, "data"))
-				 strcpy(wspec_elem->data, kc_attr->value);
-			else if (!strcmp(kc_attr->name, "tv_sec"))
-				wspec_elem->exec_int.tv_sec = atol(kc_attr->value);
-			else if (!strcmp(kc_attr->name, "tv_nsec"))
-				wspec_elem->exec_int.tv_nsec = atol(kc_attr->value);
-			else
-				printf("warning: unknown workspec_t attribute %s", 
-				       kc_attr->name);
+		if (decode_workspec(kc_elem, &wspec_array[*t_count])) {
+			printf("error: workitem %d is invalid\n", *t_count);
+			free_config(wspec_array);
+			*t_count = 0;
+			return NULL;
 		}
 
 		(*t_count)++;
-		DL_APPEND(wspec_list, wspec_elem);
 
 	}
 
-	return wspec_list;
+	return wspec_array;
 }
 
-void free_config(workspec_t *head)
+/**
+ * Parse the workitems of the config file @filename with a streaming
+ * xmlTextReader instead of building the whole document, the
+ * kusp_config tree and the workspec_t list first. Workitems are
+ * handed to @fn in batches of up to @batch_size as soon as each batch
+ * has been read, so memory use does not grow with the size of the
+ * workload and the caller can start submitting right away.
+ *
+ * The workspecs passed to @fn are only valid for the duration of the
+ * call. If @fn returns non-zero the parse is stopped and that value
+ * returned. Returns -1 if the file could not be parsed, otherwise 0.
+ *
+ * @t_count: Set to the number of workitems handed to @fn.
+ */
+int stream_config(char *filename, int batch_size,
+		  workspec_batch_fn fn, void *arg, int *t_count)
 {
-	workspec_t *cur = NULL, *next = NULL;
+	xmlTextReaderPtr  reader;
+	workspec_t        *batch;
+	const char        *name, *value;
+	int               count = 0;
+	int               ret = 0;
+	int               rd;
+
+	*t_count = 0;
+
+	/* initialize the library and check for ABI mismatches */
+	LIBXML_TEST_VERSION
+
+	batch = malloc(sizeof(workspec_t) * batch_size);
+	if (!batch) {
+		printf("error: out of memory\n");
+		return -1;
+	}
 
-	DL_FOREACH_SAFE(head, cur, next){
-		DL_DELETE(head, cur);
+	reader = xmlReaderForFile(filename, NULL, 0);
+	if (!reader) {
+		printf("error: failed to open configuration file %s\n", filename);
+		free(batch);
+		return -1;
 	}
+
+	while ((rd = xmlTextReaderRead(reader)) == 1) {
+
+		if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+		    strcmp((const char *)xmlTextReaderConstName(reader), 
+			   CONFIG_WORKSPEC_NAME))
+			continue;
+
+		init_workspec(&batch[count]);
+
+		while (ret == 0 && 
+		       xmlTextReaderMoveToNextAttribute(reader) == 1) {
+			name = (const char *)xmlTextReaderConstName(reader);
+			value = (const char *)xmlTextReaderConstValue(reader);
+			ret = set_workspec_attr(&batch[count], name, strlen(name),
+						value, strlen(value));
+		}
+
+		if (ret) {
+			printf("error: workitem %d is invalid\n", *t_count);
+			break;
+		}
+
+		(*t_count)++;
+
+		if (++count == batch_size) {
+			ret = fn(batch, count, arg);
+			count = 0;
+			if (ret)
+				break;
+		}
+	}
+
+	if (rd < 0) {
+		printf("error: failed to parse configuration file %s\n", filename);
+		ret = -1;
+	} else if (!ret && count) {
+		ret = fn(batch, count, arg);
+	}
+
+	xmlFreeTextReader(reader);
+	xmlCleanupParser();
+	free(batch);
+
+	return ret;
+}
+
+
+void free_config(workspec_t *workspecs)
+{
+	free(workspecs);
 }
 
 
 /**
  *
  */
-void pprint_workspec(workspec_t *head){
+void pprint_workspec(workspec_t *workspecs, int count){
  	
  	workspec_t *ws;
-	int count = 0;
+	int i;
 	
-	DL_FOREACH(head, ws) {
+	for (i = 0; i < count; i++) {
 
-		printf("[%d] workspec_t\n", count);
+		ws = &workspecs[i];
+
+		printf("[%d] workspec_t\n", i);
 		printf("-----------------\n");
 		printf("data:\t\t%s\n", ws->data);
 		printf("exec interval:\t%lds %ldns\n", 
 		       (unsigned long)ws->exec_int.tv_sec, ws->exec_int.tv_nsec);  
 
-		printf("has next:\t%s\n", ws->next != NULL ? "yes" : "no");		
 		printf("\n");       	       
-		
-		count++;
 	}
 	
 	printf("workspec count: %d\n\n", count); 	
 }
 
 
-static workspec_t* get_new_workspec()
+static void init_workspec(workspec_t *ws)
 {
-	workspec_t *ws = (workspec_t*)malloc(sizeof(workspec_t));     
-
 	strcpy(ws->data, "");
 	ws->exec_int.tv_sec = 0;
 	ws->exec_int.tv_nsec = 0;
+}
+
+
+/**
+ * Copy the @len bytes of @value into the string @field of @size
+ * bytes, truncating it with a warning if it does not fit.
+ */
+static int decode_string(char *field, size_t size, const char *value, size_t len)
+{
+	if (len >= size) {
+		printf("warning: workitem data truncated to %zu bytes\n",
+		       size - 1);
+		len = size - 1;
+	}
+
+	memcpy(field, value, len);
+	field[len] = '\0';
+
+	return 0;
+}
+
+
+/**
+ * Parse the @len bytes of @value, which need not be NUL terminated,
+ * as a decimal integer in [@min, @max]. Unlike atol(), anything else
+ * is rejected, including an empty value, whitespace and overflow.
+ */
+static int decode_long(long *num, const char *value, size_t len, long min, long max)
+{
+	const char     *end = value + len;
+	unsigned long  limit = LONG_MAX;
+	unsigned long  n = 0;
+	unsigned int   digit;
+	int            neg = 0;
+
+	if (value < end && (*value == '-' || *value == '+')) {
+		neg = *value++ == '-';
+		if (neg)
+			limit = (unsigned long)LONG_MAX + 1;
+	}
+
+	if (value == end)
+		return -1;
+
+	for (; value < end; value++) {
+		digit = (unsigned char)*value - '0';
+		if (digit > 9 || n > (limit - digit) / 10)
+			return -1;
+		n = n * 10 + digit;
+	}
+
+	*num = neg ? (long)(0 - n) : (long)n;
 
+	return *num < min || *num > max ? -1 : 0;
+}
+
+
+/**
+ * Set the field of @ws named by the workitem attribute @name to the
+ * @len bytes of @value.
+ */
+static int set_workspec_attr(workspec_t *ws, const char *name, size_t name_len,
+			     const char *value, size_t len)
+{
+	switch (decode_workitem_attr(ws, name, name_len, value, len)) {
+	case DECODE_INVALID:
+		printf("error: invalid workitem %.*s \"%.*s\"\n", 
+		       (int)name_len, name, (int)len, value);
+		return -1;
+	case DECODE_UNKNOWN:
+		printf("warning: unknown workspec_t attribute %.*s\n", 
+		       (int)name_len, name);
+		break;
+	}
 
-	ws->next = NULL;
-	ws->prev = NULL;
-	return ws;
+	return 0;
 }
 
 
+/**
+ * Decode the attributes of the <workitem> node @workitem into @ws.
+ * Returns -1 if any of them is invalid.
+ */
+int decode_workspec(kusp_config *workitem, workspec_t *ws)
+{
+	kusp_attr *kc_attr;
+
+	init_workspec(ws);
+
+	for (kc_attr = workitem->attributes; 
+	     kc_attr < workitem->attributes + workitem->nr_attributes; kc_attr++) {
+		if (set_workspec_attr(ws, kc_attr->name, kc_attr->name_len,
+				      kc_attr->value, kc_attr->value_len))
+			return -1;
+	}
+
+	return 0;
+}
@@ -10,14 +10,20 @@ typedef struct workspec_s {
 	
 	char              data[OT_MAX_WORK_SIZE];
 	struct timespec   exec_int;
-	
-	struct workspec_s *next;	
-	struct workspec_s *prev;
 
 } workspec_t;
 
+/*
+ * Called by stream_config() with each batch of workspecs as it is
+ * parsed. A non-zero return stops the parse.
+ */
+typedef int (*workspec_batch_fn)(workspec_t *batch, int count, void *arg);
+
 workspec_t *get_config(kusp_config *config, int *t_count);
-void free_config(workspec_t *head);
-void pprint_workspec(workspec_t *head);
+int decode_workspec(kusp_config *workitem, workspec_t *ws);
+int stream_config(char *filename, int batch_size,
+		  workspec_batch_fn fn, void *arg, int *t_count);
+void free_config(workspec_t *workspecs);
+void pprint_workspec(workspec_t *workspecs, int count);
 
 #endif	/* OTCONF_H */
@@ -0,0 +1,629 @@
+/*
+ * conftest - Regression tests of the config parsers
+ *
+ * A config is parsed by libxml2 (kusp_parse_xml_config()) and by the
+ * in-place scanner (kusp_map_xml_config()), which must agree: on
+ * every config of the corpus below, both must either decode the same
+ * workspecs, in the same order, or both reject it. Every truncation
+ * of each valid config is tried as well.
+ *
+ * parallel_get_config_chunked() must agree with them too, on any
+ * number of threads and with chunk boundaries falling anywhere in
+ * the config. Run by ctest; exits non-zero if any check fails.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <libxml/parser.h>
+
+#include "config.h"
+#include "parallel.h"
+#include "xhashconf.h"
+
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static int Failures;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n",	\
+				__FILE__, __LINE__, __func__, #cond);	\
+			Failures++;					\
+		}							\
+	} while (0)
+
+
+/*
+ * @valid: Whether the config is well formed with valid workitems. A
+ *         few are well formed but have none, and are rejected by
+ *         get_config() either way.
+ */
+struct conf_case {
+	const char  *name;
+	int         valid;
+	const char  *xml;
+};
+
+static const struct conf_case Corpus[] = {
+	{ "plain", 1,
+	  "<params>\n"
+	  "  <workitem data=\"hello\" tv_sec=\"0\" tv_nsec=\"1000000\" />\n"
+	  "  <workitem data=\"world\" tv_sec=\"1\" tv_nsec=\"0\"/>\n"
+	  "</params>\n" },
+
+	{ "quoting", 1,
+	  "<params>\n"
+	  "  <workitem data='single' tv_sec='2' tv_nsec='3'/>\n"
+	  "  <workitem data = \"spaced\"\ttv_sec =\n'4'  tv_nsec= \"5\" />\n"
+	  "  <workitem data='has \"double\" quotes'/>\n"
+	  "  <workitem data=\"has 'single' quotes\"/>\n"
+	  "  <workitem data=\"a > b /> c\" tv_nsec=\"6\"></workitem>\n"
+	  "  <workitem data=\"\"/>\n"
+	  "</params>" },
+
+	{ "entities", 1,
+	  "<params>\n"
+	  "  <workitem data=\"&amp;&lt;&gt;&quot;&apos;\"/>\n"
+	  "  <workitem data=\"a &amp;amp; b\"/>\n"
+	  "  <workitem data=\"&#65;&#x42;&#x20AC;&#128512;\"/>\n"
+	  "  <workitem data=\"&#x9;tab&#10;nl&#13;cr\"/>\n"
+	  "</params>\n" },
+
+	{ "whitespace", 1,
+	  "<params>\r\n"
+	  "  <workitem data=\"tab\there\" tv_sec=\"1\"/>\r\n"
+	  "  <workitem data=\"line\nbreak\r\nand\rcr\"/>\r\n"
+	  "  <workitem data=\"  leading and trailing  \"/>\r\n"
+	  "</params>\r\n" },
+
+	{ "comments", 1,
+	  "<!-- before the root -->\n"
+	  "<params>\n"
+	  "  <!-- <workitem data=\"commented out\"/> -->\n"
+	  "  <workitem data=\"one\"/><!-- between -->"
+	  "<workitem data=\"two\"/>\n"
+	  "  <!---->\n"
+	  "  <!-- a > b < c - d -->\n"
+	  "</params>\n"
+	  "<!-- after the root -->\n" },
+
+	{ "cdata", 1,
+	  "<params>\n"
+	  "  <![CDATA[<workitem data=\"in cdata\"/>]]>\n"
+	  "  <workitem data=\"one\"/>\n"
+	  "  <![CDATA[ ]] > ]]>\n"
+	  "  <workitem data=\"two\"/>\n"
+	  "</params>\n" },
+
+	{ "prolog", 1,
+	  "\xef\xbb\xbf<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  "<!DOCTYPE params [\n"
+	  "  <!ELEMENT params ANY>\n"
+	  "  <!ATTLIST workitem data CDATA #IMPLIED>\n"
+	  "]>\n"
+	  "<?occamstimer some > instruction?>\n"
+	  "<params>\n"
+	  "  <?inside?>\n"
+	  "  <workitem data=\"after a PI\"/>\n"
+	  "</params>\n" },
+
+	{ "doctype_literals", 1,
+	  "<!DOCTYPE params SYSTEM \"no]such>.dtd\" [\n"
+	  "  <!-- a ] and a > -->\n"
+	  "  <!ATTLIST workitem data CDATA 'x]>y'>\n"
+	  "  <?pi ]>?>\n"
+	  "]>\n"
+	  "<?xml-stylesheet href=\"x\"?>\n"
+	  "<params><workitem data=\"x\"/></params>\n" },
+
+	{ "content", 1,
+	  "<params>\n"
+	  "  some text > with /> in it &amp; &#x41; ]]\n"
+	  "  <workitem data=\"one\">text of its own</workitem>\n"
+	  "  <group><workitem data=\"nested, not a workitem\"/></group>\n"
+	  "  <workitem data=\"two\"><child/></workitem>\n"
+	  "</params>\n" },
+
+	{ "unknown_attr", 1,
+	  "<params>\n"
+	  "  <workitem data=\"x\" colour=\"blue\" tv_sec=\"1\"/>\n"
+	  "</params>\n" },
+
+	{ "many_attrs", 1,
+	  "<params>\n"
+	  "  <workitem a=\"1\" b=\"2\" c=\"3\" d=\"4\" e=\"5\" f=\"6\" g=\"7\""
+	  " h=\"8\" i=\"9\" data=\"ten\" tv_sec=\"1\" tv_nsec=\"2\"/>\n"
+	  "</params>\n" },
+
+	{ "utf8", 1,
+	  "<params>\n"
+	  "  <workitem data=\"caf\xc3\xa9 \xe2\x82\xac\"/>\n"
+	  "  <w\xc3\xa9rk data=\"not a workitem\"/>\n"
+	  "</params>\n" },
+
+	{ "empty_root", 1,
+	  "<params/>\n" },
+
+	{ "no_workitems", 1,
+	  "<params><other/></params>\n" },
+
+	/* Malformed configs, which both must reject. */
+	{ "mismatched", 0,
+	  "<params><workitem data=\"x\"></params></workitem>\n" },
+
+	{ "unclosed_root", 0,
+	  "<params><workitem data=\"x\"/>\n" },
+
+	{ "duplicate_attr", 0,
+	  "<params><workitem data=\"x\" data=\"y\"/></params>\n" },
+
+	{ "duplicate_many", 0,
+	  "<params><workitem a=\"1\" b=\"2\" c=\"3\" d=\"4\" e=\"5\" f=\"6\""
+	  " g=\"7\" h=\"8\" i=\"9\" a=\"10\"/></params>\n" },
+
+	{ "unquoted", 0,
+	  "<params><workitem data=x/></params>\n" },
+
+	{ "no_equals", 0,
+	  "<params><workitem data \"x\"/></params>\n" },
+
+	{ "no_space", 0,
+	  "<params><workitem data=\"x\"tv_sec=\"1\"/></params>\n" },
+
+	{ "lt_in_value", 0,
+	  "<params><workitem data=\"a < b\"/></params>\n" },
+
+	{ "unknown_entity", 0,
+	  "<params><workitem data=\"&nbsp;\"/></params>\n" },
+
+	{ "bare_amp", 0,
+	  "<params><workitem data=\"a & b\"/></params>\n" },
+
+	{ "bad_charref", 0,
+	  "<params><workitem data=\"&#xZZ;\"/></params>\n" },
+
+	{ "nul_charref", 0,
+	  "<params><workitem data=\"&#0;\"/></params>\n" },
+
+	{ "ctrl_charref", 0,
+	  "<params><workitem data=\"&#1;\"/></params>\n" },
+
+	{ "surrogate_charref", 0,
+	  "<params><workitem data=\"&#xD800;\"/></params>\n" },
+
+	{ "text_entity", 0,
+	  "<params>&nbsp;<workitem data=\"x\"/></params>\n" },
+
+	{ "text_amp", 0,
+	  "<params>a & b<workitem data=\"x\"/></params>\n" },
+
+	{ "text_cdata_end", 0,
+	  "<params>a ]]> b<workitem data=\"x\"/></params>\n" },
+
+	{ "two_roots", 0,
+	  "<params/><params/>\n" },
+
+	{ "content_after_root", 0,
+	  "<params/>trailing\n" },
+
+	{ "double_hyphen", 0,
+	  "<params><!-- a -- b --><workitem data=\"x\"/></params>\n" },
+
+	{ "triple_hyphen", 0,
+	  "<params><!-- a ---><workitem data=\"x\"/></params>\n" },
+
+	{ "cdata_in_prolog", 0,
+	  "<![CDATA[x]]><params><workitem data=\"x\"/></params>\n" },
+
+	{ "doctype_in_root", 0,
+	  "<params><!DOCTYPE params><workitem data=\"x\"/></params>\n" },
+
+	{ "doctype_after_root", 0,
+	  "<params><workitem data=\"x\"/></params><!DOCTYPE params>\n" },
+
+	{ "two_doctypes", 0,
+	  "<!DOCTYPE params><!DOCTYPE params>"
+	  "<params><workitem data=\"x\"/></params>\n" },
+
+	{ "late_xml_decl", 0,
+	  "<!-- x --><?xml version=\"1.0\"?>"
+	  "<params><workitem data=\"x\"/></params>\n" },
+
+	{ "declared_entity", 0,
+	  "<!DOCTYPE params [ <!ENTITY e \"expanded\"> ]>\n"
+	  "<params><workitem data=\"&e;\"/></params>\n" },
+
+	{ "declared_pentity", 0,
+	  "<!DOCTYPE params [ <!ENTITY % p \"\"> ]>\n"
+	  "<params><workitem data=\"x\"/></params>\n" },
+
+	{ "external_entity", 0,
+	  "<!DOCTYPE params SYSTEM \"no-such.dtd\">\n"
+	  "<params><workitem data=\"&e;\"/></params>\n" },
+
+	{ "unnamed_doctype", 0,
+	  "<!DOCTYPE><params><workitem data=\"x\"/></params>\n" },
+
+	{ "upper_xml_pi", 0,
+	  "<params><?XML x?><workitem data=\"x\"/></params>\n" },
+
+	{ "bad_name", 0,
+	  "<params><1workitem data=\"x\"/></params>\n" },
+
+	{ "bad_tv_nsec", 0,
+	  "<params><workitem data=\"x\" tv_nsec=\"1000000000\"/></params>\n" },
+
+	{ "bad_tv_sec", 0,
+	  "<params><workitem data=\"x\" tv_sec=\"-1\"/></params>\n" },
+
+	{ "not_a_number", 0,
+	  "<params><workitem data=\"x\" tv_sec=\"12abc\"/></params>\n" },
+
+	{ "empty_file", 0,
+	  "" },
+};
+
+
+/*
+ * The outcome of parsing a config one way: its workspecs, or NULL if
+ * it was rejected.
+ */
+struct conf_result {
+	workspec_t  *workspecs;
+	int         count;
+};
+
+
+static char Filename[] = "/tmp/conftest-XXXXXX";
+
+
+static void write_config(const char *xml, size_t len)
+{
+	FILE *fp;
+
+	fp = fopen(Filename, "w");
+	if (!fp || fwrite(xml, 1, len, fp) != len || fclose(fp)) {
+		perror(Filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void parse_config(kusp_config *(*parse)(char *filename),
+			 struct conf_result *res)
+{
+	kusp_config *config;
+
+	res->workspecs = NULL;
+	res->count = 0;
+
+	config = parse(Filename);
+	if (config)
+		res->workspecs = get_config(config, &res->count);
+
+	kusp_free_config(config);
+}
+
+
+static void free_result(struct conf_result *res)
+{
+	free_config(res->workspecs);
+}
+
+
+static int same_workspecs(const struct conf_result *a, const struct conf_result *b)
+{
+	int i;
+
+	if (!a->workspecs || !b->workspecs)
+		return a->workspecs == b->workspecs;
+
+	if (a->count != b->count)
+		return 0;
+
+	for (i = 0; i < a->count; i++) {
+		if (strcmp(a->workspecs[i].data, b->workspecs[i].data) ||
+		    a->workspecs[i].exec_int.tv_sec != b->workspecs[i].exec_int.tv_sec ||
+		    a->workspecs[i].exec_int.tv_nsec != b->workspecs[i].exec_int.tv_nsec)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static void report(const char *name, const char *how,
+		   const struct conf_result *res)
+{
+	int i;
+
+	fprintf(stderr, "  %s %s: ", name, how);
+	if (!res->workspecs) {
+		fprintf(stderr, "rejected\n");
+		return;
+	}
+
+	fprintf(stderr, "%d workspecs\n", res->count);
+	for (i = 0; i < res->count; i++)
+		fprintf(stderr, "    [%d] \"%s\" %lds %ldns\n", i, res->workspecs[i].data,
+			(long)res->workspecs[i].exec_int.tv_sec,
+			(long)res->workspecs[i].exec_int.tv_nsec);
+}
+
+
+/*
+ * Parse the first @len bytes of @c's config both ways and check that
+ * they agree. Returns whether the config was accepted.
+ */
+static int compare_parsers(const struct conf_case *c, size_t len)
+{
+	struct conf_result  xml, mapped;
+	int                 same, accepted;
+
+	write_config(c->xml, len);
+
+	parse_config(kusp_parse_xml_config, &xml);
+	parse_config(kusp_map_xml_config, &mapped);
+
+	same = same_workspecs(&xml, &mapped);
+	accepted = xml.workspecs != NULL;
+
+	if (!same) {
+		fprintf(stderr, "%s: the parsers disagree on %zu of %zu bytes\n",
+			c->name, len, strlen(c->xml));
+		report("libxml2", "parse", &xml);
+		report("mapped", "parse", &mapped);
+	}
+	CHECK(same);
+
+	free_result(&xml);
+	free_result(&mapped);
+
+	return accepted;
+}
+
+
+/*
+ * Parse the config written last with parallel_get_config_chunked() on
+ * @jobs threads in chunks of about @chunk bytes, and check that it
+ * agrees with the single-threaded parse @ref.
+ */
+static void compare_parallel(const char *name, const struct conf_result *ref,
+			     int jobs, size_t chunk)
+{
+	struct conf_result  par;
+	char                *filenames[] = { Filename };
+	int                 same;
+
+	par.workspecs = parallel_get_config_chunked(filenames, 1, jobs, chunk,
+						    &par.count);
+
+	same = same_workspecs(ref, &par);
+	if (!same) {
+		fprintf(stderr, "%s: %d jobs in %zu byte chunks disagree with "
+			"one thread\n", name, jobs, chunk);
+		report("libxml2", "parse", ref);
+		report("parallel", "parse", &par);
+	}
+	CHECK(same);
+
+	free_result(&par);
+}
+
+
+/*
+ * ===============================================
+ *                     Tests
+ * ===============================================
+ */
+
+/*
+ * Each config of the corpus is decoded alike by both parsers, and is
+ * accepted only if it is valid.
+ */
+static void test_corpus(void)
+{
+	const struct conf_case *c;
+
+	for (c = Corpus; c < Corpus + ARRAY_SIZE(Corpus); c++) {
+		if (compare_parsers(c, strlen(c->xml)) != (c->valid &&
+		    strstr(c->xml, "<workitem") != NULL)) {
+			fprintf(stderr, "%s: expected it to be %s\n", c->name,
+				c->valid ? "accepted" : "rejected");
+			Failures++;
+		}
+	}
+}
+
+
+/*
+ * Every truncation of each valid config is handled alike by both
+ * parsers: cut inside a tag, an attribute value, a reference, a
+ * comment or a CDATA section it is rejected by both.
+ */
+static void test_truncated(void)
+{
+	const struct conf_case  *c;
+	size_t                  len;
+
+	for (c = Corpus; c < Corpus + ARRAY_SIZE(Corpus); c++) {
+		if (!c->valid)
+			continue;
+
+		for (len = 1; len < strlen(c->xml); len++)
+			compare_parsers(c, len);
+	}
+}
+
+
+/*
+ * A config larger than a workspec's data is truncated alike by both.
+ */
+static void test_long_data(void)
+{
+	static const char  head[] = "<params><workitem data=\"";
+	static const char  tail[] = "\" tv_nsec=\"7\"/></params>\n";
+	struct conf_case   c = { "long_data", 1, NULL };
+	char               *xml;
+	size_t             len = OT_MAX_WORK_SIZE + 100;
+
+	xml = malloc(sizeof(head) + len + sizeof(tail));
+	if (!xml) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(xml, head);
+	memset(xml + strlen(head), 'x', len);
+	strcpy(xml + strlen(head) + len, tail);
+
+	c.xml = xml;
+	CHECK(compare_parsers(&c, strlen(xml)));
+
+	free(xml);
+}
+
+
+/*
+ * Each config of the corpus is decoded alike in parallel, with
+ * however many threads and chunks.
+ */
+static void test_parallel(void)
+{
+	static const int     jobs[] = { 1, 2, 4 };
+	static const size_t  chunks[] = { 0, 1, 2, 3, 5, 8, 13, 21, 64 };
+	const struct conf_case  *c;
+	struct conf_result      ref;
+	unsigned int            i, j;
+
+	for (c = Corpus; c < Corpus + ARRAY_SIZE(Corpus); c++) {
+		write_config(c->xml, strlen(c->xml));
+		parse_config(kusp_parse_xml_config, &ref);
+
+		for (i = 0; i < ARRAY_SIZE(jobs); i++) {
+			for (j = 0; j < ARRAY_SIZE(chunks); j++)
+				compare_parallel(c->name, &ref, jobs[i], chunks[j]);
+		}
+
+		free_result(&ref);
+	}
+}
+
+
+/*
+ * The root's children of the config that test_split() splits, each
+ * printed with its index twice. The splitter must not take the tags
+ * in comments, CDATA, processing instructions, attribute values or
+ * text for children of the root.
+ */
+static const char *Split_children[] = {
+	"  <workitem data=\"plain %d\" tv_nsec=\"%d\"/>\n",
+	"  <workitem data='gt > and /> %d' tv_sec=\"%d\"></workitem>\n",
+	"  <!-- <workitem data=\"commented %d\"/> - %d > -->\n",
+	"  <group a=\"/>\">text /> %d<workitem data=\"nested %d\"/></group>\n",
+	"  <![CDATA[<workitem data=\"cdata %d\"/> </a %d]]>\n",
+	"  <?pi <workitem data=\"pi %d\"/> %d?>\n",
+	"  text > %d &amp; %d\n",
+	"  <workitem\n    data=\"multi\nline %d\"\n    tv_nsec='%d'\n  >x/></workitem>\n",
+	"  <workitem data=\"&lt;workitem/&gt; %d\" tv_sec='%d' />\n",
+};
+
+#define SPLIT_CHILDREN 45
+
+/*
+ * A config is decoded alike in parallel with its chunks split at
+ * every offset.
+ */
+static void test_split(void)
+{
+	static const int    jobs[] = { 1, 3, 8 };
+	struct conf_result  ref;
+	char                xml[8192];
+	size_t              len, chunk;
+	unsigned int        i;
+	int                 n;
+
+	len = snprintf(xml, sizeof(xml), "<params>\n");
+	for (n = 0; n < SPLIT_CHILDREN; n++)
+		len += snprintf(xml + len, sizeof(xml) - len, 
+				Split_children[n % ARRAY_SIZE(Split_children)], 
+				n, n);
+	len += snprintf(xml + len, sizeof(xml) - len, "</params>\n");
+	CHECK(len < sizeof(xml));
+
+	write_config(xml, len);
+	parse_config(kusp_parse_xml_config, &ref);
+
+	/* the plain, gt, multi and lt ones of each round */
+	CHECK(ref.workspecs && ref.count == 4 * SPLIT_CHILDREN / 
+	      (int)ARRAY_SIZE(Split_children));
+
+	for (chunk = 1; chunk <= len; chunk++)
+		compare_parallel("split", &ref, 2, chunk);
+
+	for (i = 0; i < ARRAY_SIZE(jobs); i++) {
+		for (chunk = 1; chunk <= len; chunk += 37)
+			compare_parallel("split", &ref, jobs[i], chunk);
+	}
+
+	free_result(&ref);
+}
+
+
+static void silent(void *ctx, const char *msg, ...)
+{
+}
+
+
+static const struct {
+	const char  *name;
+	void        (*run)(void);
+} Tests[] = {
+	{ "corpus",            test_corpus },
+	{ "truncated",         test_truncated },
+	{ "long_data",         test_long_data },
+	{ "parallel",          test_parallel },
+	{ "split",             test_split },
+};
+
+
+int main(int argc, char **argv)
+{
+	unsigned int  i;
+	int           before;
+	int           fd;
+
+	fd = mkstemp(Filename);
+	if (fd < 0) {
+		perror(Filename);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/*
+	 * Both parsers report what they reject on stdout and libxml2 on
+	 * stderr as well; only the test's own report is wanted.
+	 */
+	if (!freopen("/dev/null", "w", stdout)) {
+		perror("/dev/null");
+		exit(EXIT_FAILURE);
+	}
+	xmlSetGenericErrorFunc(NULL, silent);
+
+	for (i = 0; i < ARRAY_SIZE(Tests); i++) {
+		before = Failures;
+		Tests[i].run();
+		fprintf(stderr, "%-18s %s\n", Tests[i].name,
+			Failures == before ? "ok" : "FAILED");
+	}
+
+	unlink(Filename);
+
+	exit(Failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
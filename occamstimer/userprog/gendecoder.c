@@ -0,0 +1,229 @@
+/*
+ * Occam's Timer workitem decoder generator
+ *
+ * Reads the workitem schema (workitem.schema) and writes the
+ * decode_workitem_attr() that config.c uses to turn the attributes of
+ * a <workitem> into a workspec_t. Attribute names are dispatched by
+ * switching on their length and then comparing the few names of that
+ * length, so no attribute costs more than one memcmp().
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_ATTRS       32
+#define MAX_TOKEN       64
+#define MAX_LINE        256
+
+struct schema_attr {
+	char    name[MAX_TOKEN];
+	char    type[MAX_TOKEN];
+	char    field[MAX_TOKEN];
+	char    min[MAX_TOKEN];
+	char    max[MAX_TOKEN];
+	size_t  len;
+};
+
+static struct schema_attr attrs[MAX_ATTRS];
+static int nr_attrs;
+
+
+static int read_schema(const char *filename)
+{
+	struct schema_attr  *attr;
+	char                line[MAX_LINE];
+	FILE                *fp;
+	int                 lineno = 0;
+	int                 n, i;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		n = strspn(line, " \t");
+		if (line[n] == '#' || line[n] == '\n' || line[n] == '\0')
+			continue;
+
+		if (nr_attrs == MAX_ATTRS) {
+			printf("%s:%d: too many attributes\n", filename, lineno);
+			goto fail;
+		}
+
+		attr = &attrs[nr_attrs];
+		memset(attr, 0, sizeof(*attr));
+
+		/* MAX_TOKEN - 1 */
+		n = sscanf(line, "%63s %63s %63s %63s %63s", attr->name, 
+			   attr->type, attr->field, attr->min, attr->max);
+
+		if (n != 3 && n != 5) {
+			printf("%s:%d: expected <attribute> <type> <field> "
+			       "[<min> <max>]\n", filename, lineno);
+			goto fail;
+		}
+
+		if (strcmp(attr->type, "string") && strcmp(attr->type, "long")) {
+			printf("%s:%d: unknown type %s\n", filename, lineno, 
+			       attr->type);
+			goto fail;
+		}
+
+		if (n == 5 && strcmp(attr->type, "long")) {
+			printf("%s:%d: only long attributes have a range\n", 
+			       filename, lineno);
+			goto fail;
+		}
+
+		if (n == 3 && !strcmp(attr->type, "long")) {
+			strcpy(attr->min, "LONG_MIN");
+			strcpy(attr->max, "LONG_MAX");
+		}
+
+		for (i = 0; i < nr_attrs; i++) {
+			if (!strcmp(attrs[i].name, attr->name)) {
+				printf("%s:%d: duplicate attribute %s\n", 
+				       filename, lineno, attr->name);
+				goto fail;
+			}
+		}
+
+		attr->len = strlen(attr->name);
+		nr_attrs++;
+	}
+
+	fclose(fp);
+
+	return 0;
+
+fail:
+	fclose(fp);
+
+	return -1;
+}
+
+
+static void write_decode(FILE *fp, struct schema_attr *attr, const char *indent)
+{
+	if (!strcmp(attr->type, "string")) {
+		fprintf(fp, "%sreturn decode_string(ws->%s, sizeof(ws->%s), value, len);\n",
+			indent, attr->field, attr->field);
+		return;
+	}
+
+	fprintf(fp, "%sif (decode_long(&num, value, len, %s, %s))\n", 
+		indent, attr->min, attr->max);
+	fprintf(fp, "%s\treturn DECODE_INVALID;\n", indent);
+	fprintf(fp, "%sws->%s = num;\n", indent, attr->field);
+	fprintf(fp, "%sreturn 0;\n", indent);
+}
+
+
+static int write_decoder(const char *schema, const char *filename)
+{
+	FILE    *fp;
+	size_t  len, max_len = 0;
+	int     has_long = 0;
+	int     i;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	for (i = 0; i < nr_attrs; i++) {
+		if (attrs[i].len > max_len)
+			max_len = attrs[i].len;
+		if (!strcmp(attrs[i].type, "long"))
+			has_long = 1;
+	}
+
+	fprintf(fp, 
+		"/*\n"
+		" * Generated by gendecoder from %s. Do not edit.\n"
+		" */\n"
+		"#ifndef WORKITEM_DECODER_H\n"
+		"#define WORKITEM_DECODER_H\n"
+		"\n"
+		"#define WORKITEM_ATTR_COUNT %d\n"
+		"\n"
+		"/**\n"
+		" * Decode the @len bytes of @value into the field of @ws named by\n"
+		" * the workitem attribute @name of @name_len bytes.\n"
+		" *\n"
+		" * Returns 0, DECODE_INVALID if the value is not valid for the\n"
+		" * attribute or DECODE_UNKNOWN if there is no such attribute.\n"
+		" */\n"
+		"static inline int decode_workitem_attr(workspec_t *ws,\n"
+		"\t\t\t\t       const char *name, size_t name_len,\n"
+		"\t\t\t\t       const char *value, size_t len)\n"
+		"{\n",
+		schema, nr_attrs);
+
+	if (has_long)
+		fprintf(fp, "\tlong num;\n\n");
+
+	fprintf(fp, "\tswitch (name_len) {\n");
+
+	for (len = 1; len <= max_len; len++) {
+		int found = 0;
+
+		for (i = 0; i < nr_attrs; i++) {
+			if (attrs[i].len != len)
+				continue;
+
+			if (!found++)
+				fprintf(fp, "\tcase %zu:\n", len);
+
+			fprintf(fp, "\t\tif (!memcmp(name, \"%s\", %zu)) {\n", 
+				attrs[i].name, len);
+			write_decode(fp, &attrs[i], "\t\t\t");
+			fprintf(fp, "\t\t}\n");
+		}
+
+		if (found)
+			fprintf(fp, "\t\tbreak;\n");
+	}
+
+	fprintf(fp, 
+		"\t}\n"
+		"\n"
+		"\treturn DECODE_UNKNOWN;\n"
+		"}\n"
+		"\n"
+		"#endif\t/* WORKITEM_DECODER_H */\n");
+
+	if (fclose(fp)) {
+		perror(filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		printf("usage %s <schema> <output>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (read_schema(argv[1]))
+		exit(EXIT_FAILURE);
+
+	if (write_decoder(strrchr(argv[1], '/') ? strrchr(argv[1], '/') + 1 : argv[1], 
+			  argv[2])) {
+		remove(argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -21,18 +21,30 @@
 
 /* User cmd line parameters */
 struct user_params Params = {
+	.config_file = NULL,
+	.workload_file = NULL,
 	.workspec_config = NULL,
 	.workspec_count = 0,
-	.pprint = 0
+	.pprint = 0,
+	.stream = 0,
+	.no_cache = 0,
+	.cache_file = NULL,
+	.jobs = 0,
 };
 
 
+static workspec_t *parse_configs(char **filenames, int nr_files, int *count);
+
+
 /**
  *  This subroutine processes the command line options 
  */
 void process_options (int argc, char *argv[])
 {
+	static char cache_path[4096];
 
+	struct otw_file cached;
+	int use_cache = 0;
 	int error = 0;
 	int c;
 	for (;;) {
@@ -40,7 +52,11 @@ void process_options (int argc, char *argv[])
 
 		static struct option long_options[] = {
 			{"config",           required_argument, NULL, 'c'},
+			{"jobs",             required_argument, NULL, 'j'},
+			{"workload",         required_argument, NULL, 'w'},
 			{"pprint",           no_argument,       NULL, 'p'},
+			{"stream",           no_argument,       NULL, 's'},
+			{"no-cache",         no_argument,       NULL, 'n'},
 			{"help",             no_argument,       NULL, 'h'},
 			{NULL, 0, NULL, 0}
 		};
@@ -49,7 +65,7 @@ void process_options (int argc, char *argv[])
 		 * c contains the last in the lists above corresponding to
 		 * the long argument the user used.
 		 */
-		c = getopt_long(argc, argv, "c:p", long_options, &option_index);
+		c = getopt_long(argc, argv, "c:j:w:psn", long_options, &option_index);
 
 		if (c == -1)
 			break;
@@ -64,27 +80,31 @@ void process_options (int argc, char *argv[])
 			break;
 			
 		case 'c':
-			/* Parse the whole config using the standard config parser */
-			Params.config = kusp_parse_xml_config(optarg);
-
-			/* Get the thread section for ease of use */
-			Params.workspec_config = \
-				get_config(Params.config, &Params.workspec_count);
-
-			if (!Params.workspec_config || !Params.workspec_count){
-				
-				printf("parse config: failed to parse any"
-                                        "workspec from config file %s (config is"
-                                        "null? %s) \n", 
-				       optarg, 
-				       Params.workspec_config == NULL ? "yes" : "no");
-			}
-			
+			if (glob(optarg, GLOB_NOCHECK | 
+				 (Params.config_file ? GLOB_APPEND : 0), 
+				 NULL, &Params.config_files))
+				error = 1;
+			Params.config_file = Params.config_files.gl_pathv[0];
 			break;
+		case 'j':
+			Params.jobs = atoi(optarg);
+			break;
+		case 'w':
+			Params.workload_file = optarg;
+			break;
+
 		case 'p':
 			Params.pprint = 1;
 			break;
 
+		case 's':
+			Params.stream = 1;
+			break;
+
+		case 'n':
+			Params.no_cache = 1;
+			break;
+
 		case 'h':
 			error = 1;
 			break;
@@ -92,10 +112,215 @@ void process_options (int argc, char *argv[])
 		}
 	}
 	
-	if (error) {
+	if (error || !Params.config_file == !Params.workload_file ||
+	    (Params.stream && Params.config_files.gl_pathc > 1)) {
 		printf(help_string, argv[0]);
 		exit(EXIT_FAILURE);
 	}
+
+	if (Params.jobs < 1)
+		Params.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* 
+	 * When streaming the config is parsed as the work is
+	 * submitted, and binary workloads are not parsed at all.
+	 */
+	if (Params.stream || Params.workload_file)
+		return;
+
+	/*
+	 * A config that has been parsed before, with the same
+	 * contents, is submitted from its cached binary workload
+	 * instead. --pprint needs the parsed config.
+	 */
+	if (!Params.no_cache && Params.config_files.gl_pathc == 1 &&
+	    !config_cache_path(Params.config_file, cache_path, sizeof(cache_path))) {
+
+		use_cache = 1;
+
+		if (!Params.pprint && !access(cache_path, R_OK)) {
+			if (!otw_open(&cached, cache_path)) {
+				otw_close(&cached);
+				Params.workload_file = cache_path;
+				return;
+			}
+
+			/* corrupt, replace it below */
+			unlink(cache_path);
+		}
+	}
+
+	/*
+	 * --pprint prints the whole workload before any of it is
+	 * submitted, so parse it all now. Otherwise the configs are
+	 * parsed one at a time by the pipeline, so that the first is
+	 * being serviced while the next is parsed.
+	 */
+	if (use_cache)
+		Params.cache_file = cache_path;
+
+	if (Params.pprint)
+		Params.workspec_config = parse_configs(Params.config_files.gl_pathv,
+						       Params.config_files.gl_pathc,
+						       &Params.workspec_count);
+}
+
+
+/**
+ * Parse @nr_files configs in place on a pool of threads, large ones
+ * split into chunks. The workitems come back in file order. A single
+ * config is cached if Params.cache_file is set.
+ */
+static workspec_t *parse_configs(char **filenames, int nr_files, int *count)
+{
+	workspec_t *workspecs;
+
+	workspecs = parallel_get_config(filenames, nr_files, Params.jobs, count);
+
+	if (!workspecs || !*count){
+				
+		printf("parse config: failed to parse any "
+		       "workspec from config file %s%s\n", 
+		       filenames[0], nr_files > 1 ? " and others" : "");
+
+	} else if (Params.cache_file && 
+		   config_cache_store(Params.cache_file, workspecs, *count)) {
+		printf("warning: failed to cache %s as %s\n", 
+		       filenames[0], Params.cache_file);
+	}
+
+	return workspecs;
+}
+
+
+/**
+ * Add an array of parsed workitems to the pipeline. They are not
+ * copied, so the caller must pipeline_drain() before freeing them.
+ */
+static int add_workspecs(struct pipeline *pipe, workspec_t *workspecs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (pipeline_add(pipe, workspecs[i].data, &workspecs[i].exec_int, 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Feed the pipeline from the XML configs, either already parsed for
+ * --pprint or one config at a time.
+ */
+static int produce_configs(struct pipeline *pipe, void *arg)
+{
+	workspec_t  *workspecs;
+	int         count, i;
+	int         ret = 0;
+
+	if (Params.workspec_config) {
+		ret = add_workspecs(pipe, Params.workspec_config, Params.workspec_count);
+		if (pipeline_drain(pipe))
+			ret = -1;
+		return ret;
+	}
+
+	for (i = 0; i < Params.config_files.gl_pathc && !ret; i++) {
+		workspecs = parse_configs(&Params.config_files.gl_pathv[i], 1, &count);
+		if (!workspecs) {
+			ret = -1;
+			break;
+		}
+
+		ret = add_workspecs(pipe, workspecs, count);
+		Params.workspec_count += count;
+
+		/* the submitter has to be done with them before they go */
+		if (pipeline_drain(pipe))
+			ret = -1;
+		free_config(workspecs);
+	}
+
+	return ret;
+}
+
+
+/**
+ * Add a batch read by stream_config(), which is only valid for the
+ * duration of the call, by copying it into the pipeline.
+ */
+static int stream_batch(workspec_t *batch, int count, void *arg)
+{
+	struct pipeline *pipe = arg;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (pipeline_add(pipe, batch[i].data, &batch[i].exec_int, 1))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int produce_stream(struct pipeline *pipe, void *arg)
+{
+	if (stream_config(Params.config_file, OT_MAX_WORK_BATCH,
+			  stream_batch, pipe, &Params.workspec_count)) {
+		printf("error streaming config %s\n", Params.config_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Feed the pipeline every record of the binary workload
+ * Params.workload_file. The payloads are handed to the device
+ * straight out of the mapped file.
+ */
+static int produce_workload(struct pipeline *pipe, void *arg)
+{
+	struct otw_file          w;
+	const struct otw_record  *rec;
+	const char               *data;
+	struct timespec          exec_int;
+	uint64_t                 i;
+	int                      ret = 0;
+
+	if (otw_open(&w, Params.workload_file)) {
+		printf("error: failed to open workload %s\n", Params.workload_file);
+		return -1;
+	}
+
+	for (i = 0; i < w.header->count && !ret; i++) {
+		rec = &w.records[i];
+
+		data = otw_payload(&w, rec);
+		if (!data) {
+			printf("error: workitem %lu of %s is corrupt\n",
+			       (unsigned long)i, Params.workload_file);
+			ret = -1;
+			break;
+		}
+
+		exec_int.tv_sec = rec->tv_sec;
+		exec_int.tv_nsec = rec->tv_nsec;
+
+		ret = pipeline_add(pipe, data, &exec_int, 0);
+	}
+
+	Params.workspec_count = w.header->count;
+
+	if (pipeline_drain(pipe))
+		ret = -1;
+
+	otw_close(&w);
+
+	return ret;
 }
 
 
@@ -103,13 +328,15 @@ void process_options (int argc, char *argv[])
 
 int main(int argc, char** argv){
 	
-        int fd;
-	workspec_t *workitem;
+	struct pipeline_stats  stats;
+	pipeline_produce_fn    produce;
+        int                    fd;
+	int                    failed;
 	
 	process_options(argc, argv);		
 	
-	if (Params.pprint)
-		pprint_workspec(Params.workspec_config);
+	if (Params.pprint && Params.workspec_config)
+		pprint_workspec(Params.workspec_config, Params.workspec_count);
 
 
 	fd = occamstimer_open();
@@ -119,21 +346,39 @@ int main(int argc, char** argv){
 		printf("There was an error opening /dev/occamstimer.\n");
 		exit(EXIT_FAILURE);
 	}
-	
-	workitem = Params.workspec_config; 
-	while(workitem) {
 
-		if(!occamstimer_add_work(fd, workitem->data, &workitem->exec_int))
-			printf("error adding work\n");
-		else
-			printf("added work\n");
+	if (Params.workload_file)
+		produce = produce_workload;
+	else if (Params.stream)
+		produce = produce_stream;
+	else
+		produce = produce_configs;
 
-		workitem = workitem->next;
-	}
+	/*
+	 * Parse, submit and reap concurrently. The device is started
+	 * by the pipeline once the first batch is in.
+	 */
+	failed = pipeline_run(fd, produce, NULL, &stats) != 0;
+	if (failed)
+		printf("error running workload from %s\n", 
+		       Params.workload_file ? Params.workload_file : Params.config_file);
 
-	
-	/* start the timer */
-	occamstimer_start_device(fd);
+	printf("workspec count: %d\n", Params.workspec_count);
+
+	if (stats.stale)
+		printf("discarded %d workitems completed before this run\n", 
+		       stats.stale);
+
+	printf("submitted %d, reaped %d in %.2f ms\n", 
+	       stats.submitted, stats.reaped, stats.wall_ms);
+
+	if (stats.reaped)
+		printf("latency ns: min %lld p50 %lld p99 %lld max %lld mean %.0f\n",
+		       stats.lat_min, stats.lat_p50, stats.lat_p99, 
+		       stats.lat_max, stats.lat_mean);
+
+	if (stats.eventfd)
+		printf("reaper woken %d times by the device\n", stats.wakeups);
 	
 
 	if (occamstimer_close(fd)) {
@@ -142,6 +387,11 @@ int main(int argc, char** argv){
 
 		exit(EXIT_FAILURE);
 	}
+
+	free_config(Params.workspec_config);
+	if (Params.config_file)
+		globfree(&Params.config_files);
 	
-	exit(EXIT_SUCCESS);
+	/* The stats above are those of the part that did run. */
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
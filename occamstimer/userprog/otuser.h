@@ -1,23 +1,46 @@
 #ifndef OTUSER_H
 #define OTUSER_H
 
+#include <glob.h>
 #include <linux/occamstimer.h>
 
+#include "cache.h"
 #include "config.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "workload.h"
 #include "xhashconf.h"
 
 #define help_string "\
-	\n\nusage %s --config=<filename>  [--pprint] [--help]\n\n\
-\t--config=\t\tthe configuration file of work items\n\
+	\n\nusage %s (--config=<filename>... | --workload=<filename>)\n\
+	[--jobs=<n>] [--pprint] [--stream] [--no-cache] [--help]\n\n\
+\t--config=\t\tthe configuration file of work items, may be\n\
+\t\t\t\tgiven more than once and may be a glob; the\n\
+\t\t\t\twork items are submitted in file order\n\
+\t--workload=\t\ta binary workload file made by otwconv\n\
+\t--jobs=\t\t\tthe number of threads to parse with\n\
+\t\t\t\t(default: one per online cpu)\n\
 \t--pprint\t\tpretty print the confiugration after parsing\n\
+\t--stream\t\tsubmit work items in batches while the\n\
+\t\t\t\tconfiguration is read (ignores --pprint,\n\
+\t\t\t\tone configuration only)\n\
+\t--no-cache\t\tparse the configuration even if it has been\n\
+\t\t\t\tcached, and do not cache it (only a single\n\
+\t\t\t\tconfiguration is cached)\n\
 \t--help\t\t\tthis menu\n\n"
 
 
 struct user_params {
-	kusp_config  *config;
+	char         *config_file;
+	glob_t       config_files;
+	char         *workload_file;
 	workspec_t   *workspec_config;
         int           workspec_count;	
 	int           pprint;	
+	int           stream;
+	int           no_cache;
+	char         *cache_file;
+	int           jobs;
 };
 
 
@@ -0,0 +1,175 @@
+/*
+ * Occam's Timer workload converter
+ *
+ * Converts <workitem data= tv_sec= tv_nsec= /> XML configs to the
+ * binary workload format read by otuser --workload, and back.
+ *
+ * Author: Dillon Hicks (hhicks@ittc.ku.edu)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#define __USE_GNU
+#include <getopt.h>
+#include <string.h>
+#include <linux/occamstimer.h>
+
+#include "config.h"
+#include "workload.h"
+
+#define help_string "\
+	\n\nusage %s (--to-binary | --to-xml) <input> <output> [--help]\n\n\
+\t--to-binary\t\tconvert an XML config to a binary workload\n\
+\t--to-xml\t\tconvert a binary workload to an XML config\n\
+\t--help\t\t\tthis menu\n\n"
+
+
+static int write_batch(workspec_t *batch, int count, void *arg)
+{
+	struct otw_writer *wr = arg;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (otw_writer_add(wr, batch[i].data, strlen(batch[i].data),
+				   &batch[i].exec_int))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int xml_to_binary(char *input, char *output)
+{
+	struct otw_writer wr;
+	int count;
+	int ret;
+
+	if (otw_writer_open(&wr, output)) {
+		perror(output);
+		return -1;
+	}
+
+	ret = stream_config(input, OT_MAX_WORK_BATCH, write_batch, &wr, &count);
+
+	if (otw_writer_close(&wr))
+		ret = -1;
+
+	if (!ret)
+		printf("wrote %d workitems to %s\n", count, output);
+
+	return ret;
+}
+
+
+/**
+ * Write @str as the value of an XML attribute, escaping the
+ * characters that cannot appear in one literally.
+ */
+static void fputs_xml_attr(const char *str, FILE *fp)
+{
+	for (; *str; str++) {
+		switch (*str) {
+		case '&':  fputs("&amp;", fp);  break;
+		case '<':  fputs("&lt;", fp);   break;
+		case '>':  fputs("&gt;", fp);   break;
+		case '"':  fputs("&quot;", fp); break;
+		default:   fputc(*str, fp);     break;
+		}
+	}
+}
+
+
+static int binary_to_xml(char *input, char *output)
+{
+	struct otw_file         w;
+	const struct otw_record *rec;
+	const char              *data;
+	FILE                    *fp;
+	uint64_t                i;
+	int                     ret = 0;
+
+	if (otw_open(&w, input)) {
+		printf("error: failed to open workload %s\n", input);
+		return -1;
+	}
+
+	fp = fopen(output, "w");
+	if (!fp) {
+		perror(output);
+		otw_close(&w);
+		return -1;
+	}
+
+	fprintf(fp, "<params>\n");
+
+	for (i = 0; i < w.header->count; i++) {
+		rec = &w.records[i];
+		data = otw_payload(&w, rec);
+
+		if (!data) {
+			printf("error: workitem %lu of %s is corrupt\n",
+			       (unsigned long)i, input);
+			ret = -1;
+			break;
+		}
+
+		fprintf(fp, "  <workitem data=\"");
+		fputs_xml_attr(data, fp);
+		fprintf(fp, "\" tv_sec=\"%ld\" tv_nsec=\"%ld\" />\n",
+			(long)rec->tv_sec, (long)rec->tv_nsec);
+	}
+
+	fprintf(fp, "</params>\n");
+
+	if (fclose(fp))
+		ret = -1;
+
+	if (!ret)
+		printf("wrote %lu workitems to %s\n",
+		       (unsigned long)w.header->count, output);
+
+	otw_close(&w);
+
+	return ret;
+}
+
+
+int main(int argc, char** argv)
+{
+	int to_binary = -1;
+	int c;
+
+	static struct option long_options[] = {
+		{"to-binary",        no_argument,       NULL, 'b'},
+		{"to-xml",           no_argument,       NULL, 'x'},
+		{"help",             no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "bxh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			to_binary = 1;
+			break;
+		case 'x':
+			to_binary = 0;
+			break;
+		default:
+			printf(help_string, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (to_binary < 0 || argc - optind != 2) {
+		printf(help_string, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (to_binary)
+		c = xml_to_binary(argv[optind], argv[optind + 1]);
+	else
+		c = binary_to_xml(argv[optind], argv[optind + 1]);
+
+	exit(c ? EXIT_FAILURE : EXIT_SUCCESS);
+}
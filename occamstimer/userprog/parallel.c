@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "parallel.h"
+#include "xhashconf.h"
+
+
+/**
+ * A config file mapped for the duration of the parse. Every chunk's
+ * attribute values point into @map until they are decoded.
+ */
+struct parse_file {
+	char    *filename;
+	void    *map;
+	size_t  size;
+};
+
+/**
+ * One chunk of a config, scanned and decoded by one thread.
+ *
+ * @start, @end: The byte range of the chunk in @file. It holds
+ *               whole children of the root element.
+ *
+ * @first: The index within the file of the chunk's first workitem,
+ *         for error messages.
+ *
+ * @elements: The scanned children of the root in the chunk.
+ *
+ * @workitems, @count: The <workitem> nodes of @elements.
+ *
+ * @workspecs: Where the chunk's workitems are decoded to, within the
+ *             merged array.
+ */
+struct parse_task {
+	struct parse_file  *file;
+	size_t             start;
+	size_t             end;
+	int                first;
+
+	kusp_config        *elements;
+	kusp_config        *workitems;
+	int                count;
+
+	workspec_t         *workspecs;
+	int                error;
+};
+
+/*
+ * The tasks are run twice by the pool's threads: first to scan every
+ * chunk and count its workitems, so that the merged array can be
+ * allocated, then to decode each chunk into its place in the array.
+ */
+struct parse_pool {
+	struct parse_task  *tasks;
+	int                nr_tasks;
+	int                max_tasks;
+	int                next;
+	void               (*run)(struct parse_task *task);
+};
+
+
+static int add_task(struct parse_pool *pool, struct parse_file *file,
+		    size_t start, size_t end, int first)
+{
+	struct parse_task *tasks;
+
+	if (pool->nr_tasks == pool->max_tasks) {
+		pool->max_tasks = pool->max_tasks ? 2 * pool->max_tasks : 64;
+		tasks = realloc(pool->tasks, sizeof(*tasks) * pool->max_tasks);
+		if (!tasks)
+			return -1;
+		pool->tasks = tasks;
+	}
+
+	tasks = &pool->tasks[pool->nr_tasks++];
+	memset(tasks, 0, sizeof(*tasks));
+	tasks->file = file;
+	tasks->start = start;
+	tasks->end = end;
+	tasks->first = first;
+
+	return 0;
+}
+
+
+static int is_workitem_tag(const char *p, const char *end)
+{
+	size_t len = strlen(CONFIG_WORKSPEC_NAME);
+
+	if ((size_t)(end - p) <= len + 1 || 
+	    memcmp(p + 1, CONFIG_WORKSPEC_NAME, len))
+		return 0;
+
+	p += len + 1;
+
+	return *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || 
+		*p == '/' || *p == '>';
+}
+
+
+/**
+ * Split the root content [@start, @end) of @file into tasks of about
+ * @chunk bytes, each starting at a child of the root element.
+ *
+ * Children are found by a quick walk over the tags that tracks depth
+ * and checks nothing else; the chunks are then scanned properly. A tag
+ * ends at the first '>' outside its quoted attribute values, and
+ * comments, CDATA sections and processing instructions are skipped
+ * whole, so that text and markup inside them are never taken for
+ * tags.
+ */
+static int split_file(struct parse_pool *pool, struct parse_file *file,
+		      size_t start, size_t end, size_t chunk)
+{
+	const char  *buf = file->map;
+	const char  *p, *lim, *gt;
+	size_t      chunk_start = start;
+	int         chunk_first = 0;
+	int         workitems = 0;
+	int         depth = 0;
+
+	if (end - start <= chunk)
+		return add_task(pool, file, start, end, 0);
+
+	for (p = buf + start; 
+	     (p = memchr(p, '<', buf + end - p)) != NULL; p = lim) {
+
+		if (p + 1 < buf + end && p[1] == '/') {
+			depth--;
+			lim = p + 1;
+			continue;
+		}
+
+		if (p + 1 < buf + end && (p[1] == '!' || p[1] == '?')) {
+			if (p + 4 <= buf + end && !memcmp(p, "<!--", 4))
+				lim = memmem(p + 4, buf + end - (p + 4), "-->", 3);
+			else if (p[1] == '!')
+				lim = memmem(p + 2, buf + end - (p + 2), "]]>", 3);
+			else
+				lim = memmem(p + 2, buf + end - (p + 2), "?>", 2);
+			if (!lim)
+				break;	/* malformed, the scan will say where */
+			continue;
+		}
+
+		if (depth == 0) {
+			if ((size_t)(p - (buf + chunk_start)) >= chunk) {
+				if (add_task(pool, file, chunk_start, p - buf, 
+					     chunk_first))
+					return -1;
+				chunk_start = p - buf;
+				chunk_first = workitems;
+			}
+
+			if (is_workitem_tag(p, buf + end))
+				workitems++;
+		}
+
+		for (gt = p + 1; gt < buf + end && *gt != '>'; gt++) {
+			if (*gt == '"' || *gt == '\'') {
+				gt = memchr(gt + 1, *gt, buf + end - (gt + 1));
+				if (!gt)
+					break;
+			}
+		}
+
+		if (!gt || gt == buf + end)
+			break;	/* malformed, the scan will say where */
+
+		if (gt[-1] != '/')
+			depth++;
+		lim = gt + 1;
+	}
+
+	return add_task(pool, file, chunk_start, end, chunk_first);
+}
+
+
+static void scan_task(struct parse_task *task)
+{
+	kusp_config *elem;
+
+	if (kusp_scan_xml_elements(task->file->filename, task->file->map,
+				   task->start, task->end, &task->elements)) {
+		task->error = 1;
+		return;
+	}
+
+	if (!task->elements)
+		return;
+
+	HASH_FIND_STR(task->elements, CONFIG_WORKSPEC_NAME, task->workitems);
+
+	DL_FOREACH(task->workitems, elem) {
+		task->count++;
+	}
+}
+
+
+static void decode_task(struct parse_task *task)
+{
+	kusp_config *elem;
+	int i = 0;
+
+	DL_FOREACH(task->workitems, elem) {
+		if (decode_workspec(elem, &task->workspecs[i])) {
+			printf("error: workitem %d of %s is invalid\n", 
+			       task->first + i, task->file->filename);
+			task->error = 1;
+			break;
+		}
+		i++;
+	}
+
+	/* the workspecs are copies, the scanned nodes can go */
+	kusp_free_config(task->elements);
+	task->elements = NULL;
+}
+
+
+static void *parse_thread(void *arg)
+{
+	struct parse_pool *pool = arg;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->nr_tasks)
+		pool->run(&pool->tasks[i]);
+
+	return NULL;
+}
+
+
+/**
+ * Run every task of @pool through @run on @jobs threads, the calling
+ * thread included.
+ */
+static void run_pool(struct parse_pool *pool, pthread_t *threads, int jobs,
+		     void (*run)(struct parse_task *task))
+{
+	int nr_threads = 0;
+	int i;
+
+	pool->run = run;
+	pool->next = 0;
+
+	for (i = 1; i < jobs && i < pool->nr_tasks; i++) {
+		if (pthread_create(&threads[nr_threads], NULL, parse_thread, pool))
+			break;
+		nr_threads++;
+	}
+
+	parse_thread(pool);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+
+static int map_file(struct parse_file *file, char *filename)
+{
+	struct stat st;
+	int fd;
+
+	file->filename = filename;
+	file->map = NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		printf("error: failed to read configuration file %s\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	file->size = st.st_size;
+	file->map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file->map == MAP_FAILED) {
+		perror(filename);
+		file->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Parse and decode the workitems of the @nr_files configs @filenames
+ * on up to @jobs threads. Large configs are split into chunks so that
+ * a single file is parsed in parallel too.
+ *
+ * Each file is split into chunks of about @chunk bytes, or if @chunk
+ * is 0 into about PARSE_CHUNKS_PER_JOB chunks per thread of at least
+ * PARSE_CHUNK_MIN bytes.
+ *
+ * The result is one array of *@t_count workspecs, released with
+ * free_config(), in the same order as parsing the files one after
+ * the other with get_config(): by file, then by position in the file.
+ * Returns NULL if any file fails to parse or has an invalid workitem,
+ * or if there are no workitems at all.
+ */
+workspec_t *parallel_get_config_chunked(char **filenames, int nr_files,
+					int jobs, size_t chunk, int *t_count)
+{
+	struct parse_pool  pool;
+	struct parse_file  *files;
+	pthread_t          *threads;
+	workspec_t         *workspecs = NULL;
+	size_t             start, end, size;
+	int                error = 0;
+	int                count = 0;
+	int                i;
+
+	*t_count = 0;
+	memset(&pool, 0, sizeof(pool));
+
+	if (jobs < 1)
+		jobs = 1;
+
+	files = calloc(nr_files, sizeof(*files));
+	threads = calloc(jobs, sizeof(*threads));
+	if (!files || !threads) {
+		printf("error: out of memory\n");
+		error = 1;
+		goto out;
+	}
+
+	for (i = 0; i < nr_files && !error; i++) {
+		if (map_file(&files[i], filenames[i]) ||
+		    kusp_xml_root_content(filenames[i], files[i].map, 
+					  files[i].size, &start, &end)) {
+			error = 1;
+			break;
+		}
+
+		size = chunk;
+		if (!size) {
+			size = (end - start) / (jobs * PARSE_CHUNKS_PER_JOB);
+			if (size < PARSE_CHUNK_MIN)
+				size = PARSE_CHUNK_MIN;
+		}
+
+		if (split_file(&pool, &files[i], start, end, size)) {
+			printf("error: out of memory\n");
+			error = 1;
+		}
+	}
+
+	if (error)
+		goto out;
+
+	run_pool(&pool, threads, jobs, scan_task);
+
+	for (i = 0; i < pool.nr_tasks; i++) {
+		error |= pool.tasks[i].error;
+		count += pool.tasks[i].count;
+	}
+
+	if (error)
+		goto out;
+
+	if (!count) {
+		printf("error: failed to find an workitems in config\n");
+		goto out;
+	}
+
+	workspecs = malloc(sizeof(workspec_t) * count);
+	if (!workspecs) {
+		printf("error: out of memory for %d workitems\n", count);
+		goto out;
+	}
+
+	/* each chunk goes after all of the chunks before it */
+	count = 0;
+	for (i = 0; i < pool.nr_tasks; i++) {
+		pool.tasks[i].workspecs = &workspecs[count];
+		count += pool.tasks[i].count;
+	}
+
+	run_pool(&pool, threads, jobs, decode_task);
+
+	for (i = 0; i < pool.nr_tasks; i++)
+		error |= pool.tasks[i].error;
+
+	if (error) {
+		free_config(workspecs);
+		workspecs = NULL;
+		goto out;
+	}
+
+	*t_count = count;
+
+out:
+	for (i = 0; i < pool.nr_tasks; i++)
+		kusp_free_config(pool.tasks[i].elements);
+	free(pool.tasks);
+
+	for (i = 0; files && i < nr_files; i++) {
+		if (files[i].map)
+			munmap(files[i].map, files[i].size);
+	}
+
+	free(files);
+	free(threads);
+
+	return workspecs;
+}
+
+
+workspec_t *parallel_get_config(char **filenames, int nr_files, int jobs,
+				int *t_count)
+{
+	return parallel_get_config_chunked(filenames, nr_files, jobs, 0, t_count);
+}
@@ -0,0 +1,20 @@
+#ifndef OTPARALLEL_H
+#define OTPARALLEL_H
+
+#include "config.h"
+
+/*
+ * Configs are split between the children of their root element into
+ * chunks of at least PARSE_CHUNK_MIN bytes, and about
+ * PARSE_CHUNKS_PER_JOB chunks per thread so that the threads finish
+ * close together.
+ */
+#define PARSE_CHUNK_MIN       (1024 * 1024)
+#define PARSE_CHUNKS_PER_JOB  4
+
+workspec_t *parallel_get_config(char **filenames, int nr_files, int jobs,
+				int *t_count);
+workspec_t *parallel_get_config_chunked(char **filenames, int nr_files,
+					int jobs, size_t chunk, int *t_count);
+
+#endif	/* OTPARALLEL_H */
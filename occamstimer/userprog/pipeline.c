@@ -0,0 +1,706 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <occamstimer.h>
+
+#include "pipeline.h"
+
+
+/**
+ * A bounded single producer, single consumer ring of fixed size
+ * elements. Each index is written by one side only and read by the
+ * other with acquire semantics, so neither side takes a lock. The
+ * indices run freely and are masked when used.
+ */
+struct spsc_ring {
+	char          *slots;
+	size_t        elem_size;
+	unsigned int  mask;
+
+	/* written by the consumer */
+	unsigned int  head __attribute__((aligned(64)));
+
+	/* written by the producer */
+	unsigned int  tail __attribute__((aligned(64)));
+};
+
+/*
+ * The workitems of one batch IOCTL. The descriptors point either at
+ * memory the producer keeps alive until pipeline_drain(), or into
+ * @store when the producer asked for its data to be copied.
+ */
+struct pipe_batch {
+	int                           count;
+	struct occamstimer_work_desc  descs[OT_MAX_WORK_BATCH];
+	char                          (*store)[OT_MAX_WORK_SIZE];
+};
+
+/*
+ * When the submitter added the @count workitems of one batch. Each
+ * was added with the cookie PIPE_COOKIE() of the batch's place among
+ * those submitted and its own place in the batch, since a device with
+ * several workqueues may complete them out of order. A @count of 0
+ * ends the pipeline.
+ */
+struct pipe_stamp {
+	int              count;
+	struct timespec  submitted;
+};
+
+#define PIPE_COOKIE(batch, i) \
+	((unsigned long long)(batch) * OT_MAX_WORK_BATCH + (i))
+
+/**
+ * @full: Batches from the parser to the submitter. NULL ends them.
+ *
+ * @free: Batches the submitter is done with, back to the parser.
+ *
+ * @stamps: Submitted batches, from the submitter to the reaper.
+ *
+ * @sent: The stamps of every batch the reaper has been told of, by
+ *        the batch's place among them, with @count the number of its
+ *        workitems still to be reaped. @unreaped is their sum, and
+ *        @ended is set once the submitter has ended the pipeline.
+ *
+ * @failed: Set by any stage that fails. The others then stop
+ *          producing, but keep consuming so that no stage is left
+ *          waiting on a ring.
+ *
+ * The remaining members are each used by one stage only.
+ */
+struct pipeline {
+	int                  fd;
+	struct pipe_batch    *batches;
+	struct spsc_ring     full;
+	struct spsc_ring     free;
+	struct spsc_ring     stamps;
+	int                  failed;
+
+	/* parser */
+	struct pipe_batch    *cur;
+	struct pipe_batch    *spare[PIPE_BATCHES];
+	int                  nr_spare;
+	int                  outstanding;
+
+	/* submitter */
+	int                  submitted;
+	int                  nr_batches;
+
+	/* reaper */
+	struct pipe_stamp    *sent;
+	int                  nr_sent;
+	int                  max_sent;
+	int                  unreaped;
+	int                  ended;
+	int                  stale;
+	long long            *latencies;
+	int                  reaped;
+	int                  max_latencies;
+	int                  efd;
+	int                  wakeups;
+};
+
+
+/*
+ * ===============================================
+ *             Rings
+ * ===============================================
+ */
+
+static int ring_init(struct spsc_ring *ring, unsigned int size, size_t elem_size)
+{
+	ring->slots = malloc(elem_size * size);
+	ring->elem_size = elem_size;
+	ring->mask = size - 1;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return ring->slots ? 0 : -1;
+}
+
+
+static int ring_push(struct spsc_ring *ring, const void *elem)
+{
+	unsigned int tail = ring->tail;
+
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+		return -1;
+
+	memcpy(ring->slots + (tail & ring->mask) * ring->elem_size, elem,
+	       ring->elem_size);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+static int ring_pop(struct spsc_ring *ring, void *elem)
+{
+	unsigned int head = ring->head;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+		return -1;
+
+	memcpy(elem, ring->slots + (head & ring->mask) * ring->elem_size,
+	       ring->elem_size);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+/**
+ * Wait a little before trying again, yielding at first and then
+ * sleeping, so that a stage that is stalled does not take a CPU
+ * from the stages it waits on.
+ */
+static void backoff(unsigned int *tries)
+{
+	struct timespec ts = { 0, PIPE_POLL_NS };
+
+	if ((*tries)++ < PIPE_SPINS)
+		sched_yield();
+	else
+		nanosleep(&ts, NULL);
+}
+
+
+static void ring_put(struct spsc_ring *ring, const void *elem)
+{
+	unsigned int tries = 0;
+
+	while (ring_push(ring, elem))
+		backoff(&tries);
+}
+
+
+static void ring_get(struct spsc_ring *ring, void *elem)
+{
+	unsigned int tries = 0;
+
+	while (ring_pop(ring, elem))
+		backoff(&tries);
+}
+
+
+static void pipe_fail(struct pipeline *pipe)
+{
+	__atomic_store_n(&pipe->failed, 1, __ATOMIC_RELAXED);
+}
+
+
+static int pipe_failed(struct pipeline *pipe)
+{
+	return __atomic_load_n(&pipe->failed, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * ===============================================
+ *             Parser
+ * ===============================================
+ */
+
+static struct pipe_batch *get_batch(struct pipeline *pipe)
+{
+	struct pipe_batch *batch;
+
+	if (pipe->nr_spare)
+		return pipe->spare[--pipe->nr_spare];
+
+	ring_get(&pipe->free, &batch);
+	pipe->outstanding--;
+
+	return batch;
+}
+
+
+static void send_batch(struct pipeline *pipe)
+{
+	if (!pipe->cur)
+		return;
+
+	ring_put(&pipe->full, &pipe->cur);
+	pipe->outstanding++;
+	pipe->cur = NULL;
+}
+
+
+/**
+ * Add a workitem to the pipeline, to be submitted with the workitems
+ * around it in one batch IOCTL. Unless @copy is set @data must stay
+ * valid until pipeline_drain() returns.
+ *
+ * Returns -1 if the pipeline has failed and no more work should be
+ * added.
+ */
+int pipeline_add(struct pipeline *pipe, const char *data,
+		 const struct timespec *exec_int, int copy)
+{
+	struct occamstimer_work_desc *desc;
+	size_t len;
+
+	if (pipe_failed(pipe))
+		return -1;
+
+	if (!pipe->cur) {
+		pipe->cur = get_batch(pipe);
+		pipe->cur->count = 0;
+	}
+
+	desc = &pipe->cur->descs[pipe->cur->count];
+	desc->data = data;
+	desc->exec_int.tv_sec = exec_int->tv_sec;
+	desc->exec_int.tv_nsec = exec_int->tv_nsec;
+
+	if (copy) {
+		if (!pipe->cur->store) {
+			pipe->cur->store = malloc(OT_MAX_WORK_BATCH * OT_MAX_WORK_SIZE);
+			if (!pipe->cur->store) {
+				printf("error: out of memory\n");
+				pipe_fail(pipe);
+				return -1;
+			}
+		}
+
+		len = strnlen(data, OT_MAX_WORK_SIZE - 1);
+		memcpy(pipe->cur->store[pipe->cur->count], data, len);
+		pipe->cur->store[pipe->cur->count][len] = '\0';
+		desc->data = pipe->cur->store[pipe->cur->count];
+	}
+
+	if (++pipe->cur->count == OT_MAX_WORK_BATCH)
+		send_batch(pipe);
+
+	return 0;
+}
+
+
+/**
+ * Send the workitems added so far and wait until the submitter is
+ * done with all of them, after which the producer may release the
+ * memory they were added from.
+ */
+int pipeline_drain(struct pipeline *pipe)
+{
+	struct pipe_batch *batch;
+
+	send_batch(pipe);
+
+	while (pipe->outstanding) {
+		ring_get(&pipe->free, &batch);
+		pipe->outstanding--;
+		pipe->spare[pipe->nr_spare++] = batch;
+	}
+
+	return pipe_failed(pipe) ? -1 : 0;
+}
+
+
+/*
+ * ===============================================
+ *             Submitter
+ * ===============================================
+ */
+
+/**
+ * Add each batch to the device as it arrives. The device is started
+ * after the first batch so that it services the work while the rest
+ * of the workload is still being read.
+ */
+static void *submit_thread(void *arg)
+{
+	struct pipeline    *pipe = arg;
+	struct pipe_batch  *batch;
+	struct pipe_stamp  stamp;
+	int                started = 0;
+	int                i;
+
+	for (;;) {
+		ring_get(&pipe->full, &batch);
+		if (!batch)
+			break;
+
+		if (!pipe_failed(pipe)) {
+			for (i = 0; i < batch->count; i++)
+				batch->descs[i].cookie = PIPE_COOKIE(pipe->nr_batches, i);
+
+			if (occamstimer_add_work_batch(pipe->fd, batch->descs,
+						       batch->count)) {
+				printf("error adding work\n");
+				pipe_fail(pipe);
+			} else {
+				clock_gettime(CLOCK_MONOTONIC, &stamp.submitted);
+				stamp.count = batch->count;
+
+				printf("added %d work\n", batch->count);
+
+				if (!started) {
+					occamstimer_start_device(pipe->fd);
+					started = 1;
+				}
+
+				ring_put(&pipe->stamps, &stamp);
+				pipe->submitted += batch->count;
+				pipe->nr_batches++;
+			}
+		}
+
+		ring_put(&pipe->free, &batch);
+	}
+
+	/* start the timer even if there was nothing to add */
+	if (!started)
+		occamstimer_start_device(pipe->fd);
+
+	stamp.count = 0;
+	ring_put(&pipe->stamps, &stamp);
+
+	return NULL;
+}
+
+
+/*
+ * ===============================================
+ *             Reaper
+ * ===============================================
+ */
+
+static long long elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000LL +
+		(to->tv_nsec - from->tv_nsec);
+}
+
+
+static int record_latency(struct pipeline *pipe, long long ns)
+{
+	long long *latencies;
+
+	if (pipe->reaped == pipe->max_latencies) {
+		pipe->max_latencies = pipe->max_latencies ? 2 * pipe->max_latencies : 4096;
+		latencies = realloc(pipe->latencies,
+				    sizeof(*latencies) * pipe->max_latencies);
+		if (!latencies)
+			return -1;
+		pipe->latencies = latencies;
+	}
+
+	pipe->latencies[pipe->reaped++] = ns;
+
+	return 0;
+}
+
+
+/**
+ * Sleep until the device signals that completed work is waiting.
+ */
+static int wait_eventfd(struct pipeline *pipe)
+{
+	uint64_t count;
+
+	while (read(pipe->efd, &count, sizeof(count)) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	pipe->wakeups++;
+
+	return 0;
+}
+
+
+/**
+ * Take the stamp of the next batch the submitter added, waiting for
+ * it if @wait is set. Returns 1 if there is none yet or the pipeline
+ * has ended, or -1 if out of memory.
+ */
+static int take_stamp(struct pipeline *pipe, int wait)
+{
+	struct pipe_stamp  stamp;
+	struct pipe_stamp  *sent;
+
+	if (pipe->ended)
+		return 1;
+
+	if (wait)
+		ring_get(&pipe->stamps, &stamp);
+	else if (ring_pop(&pipe->stamps, &stamp))
+		return 1;
+
+	if (!stamp.count) {
+		pipe->ended = 1;
+		return 1;
+	}
+
+	if (pipe->nr_sent == pipe->max_sent) {
+		pipe->max_sent = pipe->max_sent ? 2 * pipe->max_sent : 256;
+		sent = realloc(pipe->sent, sizeof(*sent) * pipe->max_sent);
+		if (!sent)
+			return -1;
+		pipe->sent = sent;
+	}
+
+	pipe->sent[pipe->nr_sent++] = stamp;
+	pipe->unreaped += stamp.count;
+
+	return 0;
+}
+
+
+/**
+ * Take one completed workitem off the device and record how long
+ * after the submission of its batch that was, found by its cookie.
+ * The reaper sleeps on the device's eventfd while it waits for a
+ * workitem, or polls if the device has none.
+ *
+ * Returns 1 once every workitem the submitter added has been reaped,
+ * or -1 on failure.
+ */
+static int reap_one(struct pipeline *pipe)
+{
+	struct timespec     now;
+	char                data[OT_MAX_WORK_SIZE];
+	unsigned long long  cookie, batch;
+	unsigned int        tries = 0;
+	int                 ret;
+
+	/* take what has been submitted, or wait until something is */
+	while (!(ret = take_stamp(pipe, !pipe->unreaped)))
+		;
+	if (ret < 0)
+		goto oom;
+	if (!pipe->unreaped)
+		return 1;
+
+	while (occamstimer_get_work_cookie(pipe->fd, data, &cookie)) {
+		if (errno != EAGAIN) {
+			perror("error reaping work");
+			return -1;
+		}
+
+		if (pipe->efd < 0) {
+			backoff(&tries);
+		} else if (wait_eventfd(pipe)) {
+			perror("error waiting for work");
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* it may complete before the submitter has sent its stamp */
+	batch = cookie / OT_MAX_WORK_BATCH;
+	while (batch >= (unsigned long long)pipe->nr_sent) {
+		ret = take_stamp(pipe, 1);
+		if (ret < 0)
+			goto oom;
+		if (ret)
+			break;
+	}
+
+	/* left over from an earlier run */
+	if (batch >= (unsigned long long)pipe->nr_sent || 
+	    !pipe->sent[batch].count) {
+		pipe->stale++;
+		return 0;
+	}
+
+	pipe->sent[batch].count--;
+	pipe->unreaped--;
+
+	if (record_latency(pipe, elapsed_ns(&pipe->sent[batch].submitted, &now)))
+		goto oom;
+
+	return 0;
+
+oom:
+	printf("error: out of memory\n");
+	return -1;
+}
+
+
+/**
+ * Take every workitem the submitter added back off the device's done
+ * queue as it completes. On failure the stamps are still taken until
+ * the submitter ends the pipeline, so that it is never left waiting
+ * on a full ring.
+ */
+static void *reap_thread(void *arg)
+{
+	struct pipeline    *pipe = arg;
+	struct pipe_stamp  stamp;
+	int                ret;
+
+	while (!(ret = reap_one(pipe)))
+		;
+
+	if (ret < 0) {
+		pipe_fail(pipe);
+
+		while (!pipe->ended) {
+			ring_get(&pipe->stamps, &stamp);
+			pipe->ended = !stamp.count;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * ===============================================
+ *             Pipeline
+ * ===============================================
+ */
+
+static int cmp_latency(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static void fill_stats(struct pipeline *pipe, struct pipeline_stats *stats)
+{
+	long long  *lat = pipe->latencies;
+	int        n = pipe->reaped;
+	double     sum = 0;
+	int        i;
+
+	stats->submitted = pipe->submitted;
+	stats->reaped = n;
+	stats->stale = pipe->stale;
+	stats->eventfd = pipe->efd >= 0;
+	stats->wakeups = pipe->wakeups;
+
+	if (!n)
+		return;
+
+	qsort(lat, n, sizeof(*lat), cmp_latency);
+
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+
+	stats->lat_min = lat[0];
+	stats->lat_p50 = lat[(n - 1) / 2];
+	stats->lat_p99 = lat[(long)(n - 1) * 99 / 100];
+	stats->lat_max = lat[n - 1];
+	stats->lat_mean = sum / n;
+}
+
+
+/**
+ * Run the workload through three concurrent stages: @produce, on the
+ * calling thread, parses workitems and adds them with
+ * pipeline_add(); a submitter thread adds them to the device in
+ * batches, starting it after the first; and a reaper thread takes
+ * them back off the device as they complete. Returns once every
+ * workitem that was submitted has been reaped.
+ *
+ * Completed work left on the device by an earlier run is discarded
+ * first. Work of an earlier run that completes during this one is
+ * counted with it when its cookie names no workitem of this run still
+ * to be reaped.
+ *
+ * Returns 0 if every stage succeeded.
+ */
+int pipeline_run(int fd, pipeline_produce_fn produce, void *arg,
+		 struct pipeline_stats *stats)
+{
+	struct pipeline    pipe;
+	struct pipe_batch  *end = NULL;
+	struct pipe_stamp  stamp;
+	struct timespec    begin, finish;
+	pthread_t          submitter, reaper;
+	char               data[OT_MAX_WORK_SIZE];
+	int                ret = -1;
+	int                i;
+
+	memset(&pipe, 0, sizeof(pipe));
+	memset(stats, 0, sizeof(*stats));
+	pipe.fd = fd;
+	pipe.efd = -1;
+
+	pipe.batches = calloc(PIPE_BATCHES, sizeof(*pipe.batches));
+	if (!pipe.batches ||
+	    ring_init(&pipe.full, PIPE_BATCHES, sizeof(struct pipe_batch *)) ||
+	    ring_init(&pipe.free, PIPE_BATCHES, sizeof(struct pipe_batch *)) ||
+	    ring_init(&pipe.stamps, PIPE_STAMPS, sizeof(struct pipe_stamp))) {
+		printf("error: out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < PIPE_BATCHES; i++)
+		pipe.spare[pipe.nr_spare++] = &pipe.batches[i];
+
+	while (!occamstimer_get_work(fd, data))
+		pipe.stale++;
+
+	/* A module without eventfd support leaves the reaper polling. */
+	pipe.efd = eventfd(0, EFD_CLOEXEC);
+	if (pipe.efd >= 0 && occamstimer_set_eventfd(fd, pipe.efd)) {
+		close(pipe.efd);
+		pipe.efd = -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	if (pthread_create(&reaper, NULL, reap_thread, &pipe)) {
+		printf("error: failed to start the reaper\n");
+		goto out;
+	}
+
+	if (pthread_create(&submitter, NULL, submit_thread, &pipe)) {
+		printf("error: failed to start the submitter\n");
+		stamp.count = 0;
+		ring_put(&pipe.stamps, &stamp);
+		pthread_join(reaper, NULL);
+		goto out;
+	}
+
+	ret = produce(&pipe, arg);
+
+	send_batch(&pipe);
+	ring_put(&pipe.full, &end);
+
+	pthread_join(submitter, NULL);
+	pthread_join(reaper, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	stats->wall_ms = elapsed_ns(&begin, &finish) / 1e6;
+
+	if (pipe.failed)
+		ret = -1;
+
+	fill_stats(&pipe, stats);
+
+out:
+	if (pipe.efd >= 0) {
+		occamstimer_set_eventfd(fd, -1);
+		close(pipe.efd);
+	}
+
+	if (pipe.batches) {
+		for (i = 0; i < PIPE_BATCHES; i++)
+			free(pipe.batches[i].store);
+	}
+
+	free(pipe.batches);
+	free(pipe.full.slots);
+	free(pipe.free.slots);
+	free(pipe.stamps.slots);
+	free(pipe.sent);
+	free(pipe.latencies);
+
+	return ret;
+}
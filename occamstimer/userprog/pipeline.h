@@ -0,0 +1,64 @@
+#ifndef OTPIPELINE_H
+#define OTPIPELINE_H
+
+#include <time.h>
+#include <linux/occamstimer.h>
+
+/*
+ * Workitems travel from the parser to the submitter in batches of up
+ * to OT_MAX_WORK_BATCH, at most PIPE_BATCHES of them in flight. The
+ * submitter tells the reaper when each batch went in through a ring
+ * of PIPE_STAMPS entries, which bounds how far submission can run
+ * ahead of the completions that have been reaped. Both must be powers
+ * of two.
+ */
+#define PIPE_BATCHES  64
+#define PIPE_STAMPS   4096
+
+/*
+ * A stage that finds its ring empty or full yields PIPE_SPINS times
+ * before it starts sleeping PIPE_POLL_NS between tries. The reaper
+ * sleeps on an eventfd the device signals when work completes, or if
+ * the device cannot, polls for completions the same way, in which
+ * case PIPE_POLL_NS is also the resolution of the latencies once the
+ * device has fallen behind.
+ */
+#define PIPE_SPINS    64
+#define PIPE_POLL_NS  20000
+
+struct pipeline;
+
+/*
+ * Run on the parser thread by pipeline_run() to produce every
+ * workitem with pipeline_add(). A non-zero return is reported as a
+ * failure of the pipeline.
+ */
+typedef int (*pipeline_produce_fn)(struct pipeline *pipe, void *arg);
+
+/**
+ * What pipeline_run() measured. Latencies are from the return of the
+ * batch IOCTL that submitted a workitem to the reaper seeing it
+ * completed, in nanoseconds. @wakeups counts the times the device's
+ * eventfd woke the reaper, if @eventfd says it had one.
+ */
+struct pipeline_stats {
+	int        submitted;
+	int        reaped;
+	int        stale;
+	int        eventfd;
+	int        wakeups;
+	long long  lat_min;
+	long long  lat_p50;
+	long long  lat_p99;
+	long long  lat_max;
+	double     lat_mean;
+	double     wall_ms;
+};
+
+int pipeline_run(int fd, pipeline_produce_fn produce, void *arg,
+		 struct pipeline_stats *stats);
+int pipeline_add(struct pipeline *pipe, const char *data,
+		 const struct timespec *exec_int, int copy);
+int pipeline_drain(struct pipeline *pipe);
+
+#endif	/* OTPIPELINE_H */
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "workload.h"
+
+
+/**
+ * Map the workload file @filename and check that its header and
+ * record array lie within the file. Records are not checked here;
+ * see otw_payload().
+ *
+ * Returns 0 on success, otherwise -1 with nothing left mapped.
+ */
+int otw_open(struct otw_file *w, const char *filename)
+{
+	struct stat              st;
+	const struct otw_header  *hdr;
+	int                      fd;
+
+	memset(w, 0, sizeof(*w));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	w->size = st.st_size;
+	w->map = mmap(NULL, w->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (w->map == MAP_FAILED) {
+		w->map = NULL;
+		return -1;
+	}
+
+	hdr = w->map;
+
+	if (hdr->magic != OTW_MAGIC || hdr->version != OTW_VERSION ||
+	    hdr->records_offset < sizeof(*hdr) ||
+	    hdr->records_offset > w->size ||
+	    hdr->count > (w->size - hdr->records_offset) / sizeof(struct otw_record) ||
+	    hdr->payload_offset > w->size ||
+	    hdr->payload_size > w->size - hdr->payload_offset) {
+		printf("error: %s is not a valid workload file\n", filename);
+		otw_close(w);
+		return -1;
+	}
+
+	w->header = hdr;
+	w->records = (const struct otw_record *)((char *)w->map + hdr->records_offset);
+	w->payload = (const char *)w->map + hdr->payload_offset;
+
+	/* We walk the records front to back exactly once. */
+	madvise(w->map, w->size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+
+void otw_close(struct otw_file *w)
+{
+	if (w->map)
+		munmap(w->map, w->size);
+
+	memset(w, 0, sizeof(*w));
+}
+
+
+/**
+ * Return the NUL-terminated payload of @rec, or NULL if the record
+ * points outside of the payload area.
+ */
+const char *otw_payload(const struct otw_file *w, const struct otw_record *rec)
+{
+	if (rec->offset >= w->header->payload_size ||
+	    rec->length >= w->header->payload_size - rec->offset ||
+	    w->payload[rec->offset + rec->length] != '\0')
+		return NULL;
+
+	return w->payload + rec->offset;
+}
+
+
+/**
+ * Create the workload file @filename. Records are added with
+ * otw_writer_add() and the file is completed by otw_writer_close().
+ */
+int otw_writer_open(struct otw_writer *wr, const char *filename)
+{
+	memset(wr, 0, sizeof(*wr));
+
+	wr->header.magic = OTW_MAGIC;
+	wr->header.version = OTW_VERSION;
+	wr->header.records_offset = sizeof(wr->header);
+
+	wr->fp = fopen(filename, "w+b");
+	if (!wr->fp)
+		return -1;
+
+	wr->payload_fp = tmpfile();
+	if (!wr->payload_fp) {
+		fclose(wr->fp);
+		return -1;
+	}
+
+	/* A placeholder until the counts are known. */
+	if (fwrite(&wr->header, sizeof(wr->header), 1, wr->fp) != 1) {
+		otw_writer_close(wr);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int otw_writer_add(struct otw_writer *wr, const char *data, size_t length,
+		   const struct timespec *exec_int)
+{
+	struct otw_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.tv_sec = exec_int->tv_sec;
+	rec.tv_nsec = exec_int->tv_nsec;
+	rec.length = length;
+	rec.offset = wr->header.payload_size;
+
+	if (fwrite(&rec, sizeof(rec), 1, wr->fp) != 1 ||
+	    fwrite(data, 1, length, wr->payload_fp) != length ||
+	    fputc('\0', wr->payload_fp) == EOF)
+		return -1;
+
+	wr->header.count++;
+	wr->header.payload_size += length + 1;
+
+	return 0;
+}
+
+
+/**
+ * Append the payload area after the records and write the final
+ * header. Returns 0 if the whole file was written.
+ */
+int otw_writer_close(struct otw_writer *wr)
+{
+	char    buf[BUFSIZ];
+	size_t  len;
+	int     ret = 0;
+
+	wr->header.payload_offset = wr->header.records_offset +
+		wr->header.count * sizeof(struct otw_record);
+
+	rewind(wr->payload_fp);
+	while ((len = fread(buf, 1, sizeof(buf), wr->payload_fp)) > 0) {
+		if (fwrite(buf, 1, len, wr->fp) != len) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ferror(wr->payload_fp))
+		ret = -1;
+
+	rewind(wr->fp);
+	if (fwrite(&wr->header, sizeof(wr->header), 1, wr->fp) != 1)
+		ret = -1;
+
+	if (fclose(wr->fp))
+		ret = -1;
+	fclose(wr->payload_fp);
+
+	memset(wr, 0, sizeof(*wr));
+
+	return ret;
+}
@@ -0,0 +1,81 @@
+#ifndef OTWORKLOAD_H
+#define OTWORKLOAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * The binary workload format. A workload file is laid out as
+ *
+ *   struct otw_header
+ *   struct otw_record [count]
+ *   payload bytes     [payload_size]
+ *
+ * Each record describes one workitem. Its payload is the
+ * NUL-terminated string of @length bytes (not counting the NUL) at
+ * @offset from the start of the payload area. All fields are in the
+ * byte order of the machine that wrote the file, which is checked
+ * through the magic number.
+ *
+ * The format is meant to be mmap'd and handed to the device as is,
+ * so it contains nothing that needs to be parsed.
+ */
+#define OTW_MAGIC    0x4c57544fU /* "OTWL" little-endian */
+#define OTW_VERSION  1
+#define OTW_SUFFIX   ".otw"
+
+struct otw_header {
+	uint32_t  magic;
+	uint32_t  version;
+	uint64_t  count;
+	uint64_t  records_offset;
+	uint64_t  payload_offset;
+	uint64_t  payload_size;
+};
+
+struct otw_record {
+	int64_t   tv_sec;
+	int32_t   tv_nsec;
+	uint32_t  length;
+	uint64_t  offset;
+};
+
+
+/**
+ * A workload file mapped into memory by otw_open().
+ */
+struct otw_file {
+	void                      *map;
+	size_t                    size;
+	const struct otw_header   *header;
+	const struct otw_record   *records;
+	const char                *payload;
+};
+
+
+/**
+ * A workload file being written by otw_writer_*().
+ *
+ * @fp: The output file. Records are written straight to it.
+ *
+ * @payload_fp: A temporary file holding the payload area until every
+ *              record has been written.
+ */
+struct otw_writer {
+	FILE                      *fp;
+	FILE                      *payload_fp;
+	struct otw_header         header;
+};
+
+
+int otw_open(struct otw_file *w, const char *filename);
+void otw_close(struct otw_file *w);
+const char *otw_payload(const struct otw_file *w, const struct otw_record *rec);
+
+int otw_writer_open(struct otw_writer *wr, const char *filename);
+int otw_writer_add(struct otw_writer *wr, const char *data, size_t length,
+		   const struct timespec *exec_int);
+int otw_writer_close(struct otw_writer *wr);
+
+#endif	/* OTWORKLOAD_H */
@@ -1,9 +1,15 @@
 #ifndef XHASHCONF_C
 #define XHASHCONF_C
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <libxml/tree.h>
 #include <libxml/parser.h>
@@ -11,23 +17,50 @@
 #include "uthash/utlist.h"
 #include "xhashconf.h"
 
-static kusp_config* traverse_config(xmlNode *node);
-static kusp_config* alloc_config(xmlNode *node);
+/*
+ * The hash tables of a parsed config are allocated from the arena of
+ * the config being built by this thread, and so are never freed
+ * individually.
+ */
+static __thread kusp_arena *uthash_arena;
+
+#undef uthash_malloc
+#undef uthash_free
+#define uthash_malloc(sz) kusp_arena_alloc(uthash_arena, sz)
+#define uthash_free(ptr, sz)
+
+/*
+ * Most tables hold the children of a single node, or the handful of
+ * names of a config, so start them small rather than at uthash's 32
+ * buckets. They still grow as usual when a node has many children.
+ */
+#undef HASH_INITIAL_NUM_BUCKETS
+#undef HASH_INITIAL_NUM_BUCKETS_LOG2
+#define HASH_INITIAL_NUM_BUCKETS 4
+#define HASH_INITIAL_NUM_BUCKETS_LOG2 2
+
+#define KUSP_ARENA_ALIGN 16
+
+static kusp_config* traverse_config(kusp_arena *arena, xmlNode *node);
+static kusp_config* alloc_config(kusp_arena *arena, xmlNode *node);
+static kusp_config* new_config(kusp_arena *arena, const char *name);
 static kusp_config* add_config(kusp_config *root, kusp_config *child);
-static xmlNodePtr build_xml_config(kusp_config *config, xmlNodePtr node);
+static int set_attributes(kusp_arena *arena, kusp_config *config,
+			  kusp_attr *attrs, unsigned int nr_attrs);
 
 
 
 static void __kusp_pprint_config_R(kusp_config *elem, int level) {
 	
 	kusp_config *child_list, *tmp_child_list, *child_elem ;
-	kusp_attr *attr, *tmp_attr;
+	kusp_attr *attr;
 	
 	printf("[%d] %s\n", level, elem->name);
 
 	
-	HASH_ITER(hh, elem->attributes, attr, tmp_attr) {
-		printf("       %s = %s\n", attr->name, attr->value);
+	for (attr = elem->attributes; 
+	     attr < elem->attributes + elem->nr_attributes; attr++) {
+		printf("       %s = %.*s\n", attr->name, (int)attr->value_len, attr->value);
 	}	       
 
 	HASH_ITER(hh, elem->children, child_list, tmp_child_list) {
@@ -39,12 +72,182 @@ static void __kusp_pprint_config_R(kusp_config *elem, int level) {
 	
 }
 
+kusp_arena *kusp_arena_create(void)
+{
+	kusp_arena *arena = malloc(sizeof(kusp_arena));
+
+	if (arena) {
+		arena->blocks = NULL;
+		arena->interned = NULL;
+		arena->map = NULL;
+		arena->map_size = 0;
+	}
+
+	return arena;
+}
+
+/**
+ * Return @size bytes aligned to @align from the current block of
+ * @arena, starting a new block when it is full. Requests larger than
+ * a block get a block of their own. Exits if memory is exhausted, as
+ * uthash does.
+ */
+static void *arena_alloc(kusp_arena *arena, size_t size, size_t align)
+{
+	kusp_arena_block *block = arena->blocks;
+	uintptr_t start = 0;
+	size_t block_size;
+
+	if (block) {
+		start = ((uintptr_t)(block->data + block->used) + align - 1) 
+			& ~(uintptr_t)(align - 1);
+	}
+
+	if (!block || start + size > (uintptr_t)(block->data + block->size)) {
+
+		block_size = KUSP_ARENA_BLOCK_SIZE;
+		if (size + align > block_size)
+			block_size = size + align;
+
+		/*
+		 * Blocks are mapped directly rather than malloc'd so
+		 * that tearing down a large config is a handful of
+		 * munmap()s, instead of malloc coalescing and trimming
+		 * the heap that libxml2 has just fragmented.
+		 */
+		block = mmap(NULL, sizeof(kusp_arena_block) + block_size,
+			     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			     -1, 0);
+		if (block == MAP_FAILED) {
+			printf("error: out of memory\n");
+			exit(-1);
+		}
+
+		block->size = block_size;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		start = ((uintptr_t)block->data + align - 1) 
+			& ~(uintptr_t)(align - 1);
+	}
+
+	block->used = start + size - (uintptr_t)block->data;
+
+	return (void *)start;
+}
+
+void *kusp_arena_alloc(kusp_arena *arena, size_t size)
+{
+	return arena_alloc(arena, size, KUSP_ARENA_ALIGN);
+}
+
+/**
+ * Copy the @len bytes at @str into @arena and NUL terminate them.
+ * Strings are packed without alignment padding.
+ */
+char *kusp_arena_strndup(kusp_arena *arena, const char *str, size_t len)
+{
+	char *dup = arena_alloc(arena, len + 1, 1);
+
+	memcpy(dup, str, len);
+	dup[len] = '\0';
+
+	return dup;
+}
+
+char *kusp_arena_strdup(kusp_arena *arena, const char *str)
+{
+	return kusp_arena_strndup(arena, str, strlen(str));
+}
+
+/**
+ * Return the NUL terminated copy of the @len bytes at @str that is
+ * shared by every node of @arena, adding it on first use. Interned
+ * strings can be compared by pointer within one config.
+ */
+const char *kusp_arena_intern(kusp_arena *arena, const char *str, size_t len)
+{
+	kusp_intern *intern;
+
+	HASH_FIND(hh, arena->interned, str, len, intern);
+	if (intern)
+		return intern->str;
+
+	intern = kusp_arena_alloc(arena, sizeof(kusp_intern) + len + 1);
+	memcpy(intern->str, str, len);
+	intern->str[len] = '\0';
+	HASH_ADD_KEYPTR(hh, arena->interned, intern->str, len, intern);
+
+	return intern->str;
+}
+
+/**
+ * The number of bytes handed out by @arena, including alignment
+ * padding but not the unused tail of each block.
+ */
+size_t kusp_arena_used(kusp_arena *arena)
+{
+	kusp_arena_block *block;
+	size_t used = 0;
+
+	for (block = arena->blocks; block; block = block->next)
+		used += block->used;
+
+	return used;
+}
+
+void kusp_arena_destroy(kusp_arena *arena)
+{
+	kusp_arena_block *block, *next;
+
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		munmap(block, sizeof(kusp_arena_block) + block->size);
+	}
+
+	if (arena->map)
+		munmap(arena->map, arena->map_size);
+
+	free(arena);
+}
+
+
 void kusp_pprint_config(kusp_config *config){
 	__kusp_pprint_config_R(config, 0);
 }
 
+/*
+ * Whether an entity reference is left under @node. libxml2 leaves
+ * references to entities it could not find when there is an external
+ * DTD subset, which it does not load.
+ */
+static int has_entity_refs(xmlNode *node)
+{
+	xmlAttr *attr;
+
+	for (; node; node = node->next) {
+		if (node->type == XML_ENTITY_REF_NODE)
+			return 1;
+
+		if (node->type != XML_ELEMENT_NODE)
+			continue;
+
+		for (attr = node->properties; attr; attr = attr->next) {
+			if (has_entity_refs(attr->children))
+				return 1;
+		}
+
+		if (has_entity_refs(node->children))
+			return 1;
+	}
+
+	return 0;
+}
+
 kusp_config* kusp_parse_xml_config(char *filename){
 	kusp_config *config = NULL;
+	kusp_arena *arena = NULL;
 	/* stores the parsed document tree */
 	xmlDoc *doc = NULL;
 
@@ -64,7 +267,15 @@ kusp_config* kusp_parse_xml_config(char *filename){
 		printf("error: failed to parse configuration file %s\n", filename);
 #endif	/* XHASHCONF_DEBUG */
 
- 	} else {
+ 	} else if (doc->intSubset && (doc->intSubset->entities || 
+				      doc->intSubset->pentities)) {
+		/* kusp_map_xml_config() cannot expand them either */
+		printf("error: %s: entity declarations are not supported\n", filename);
+
+	} else if (has_entity_refs(xmlDocGetRootElement(doc))) {
+		printf("error: %s: unknown entity\n", filename);
+
+	} else {
 		/* we need the root element from the document tree */
 		root = xmlDocGetRootElement(doc);
 
@@ -72,7 +283,14 @@ kusp_config* kusp_parse_xml_config(char *filename){
 		 * our <thread/> items, so we traverse the children
 		 * instead 
 		 */
-		config = traverse_config(root);
+		arena = kusp_arena_create();
+		uthash_arena = arena;
+
+		config = traverse_config(arena, root);
+
+		uthash_arena = NULL;
+		if (!config)
+			kusp_arena_destroy(arena);
  	}
 
 	/* free resources libxml2 has allocated throughout the course here */
@@ -82,6 +300,825 @@ kusp_config* kusp_parse_xml_config(char *filename){
 } 
 
 
+
+/*
+ * ===============================================
+ *             Mapped Parsing
+ * ===============================================
+ *
+ * kusp_map_xml_config() mmaps the config file and scans it in place
+ * rather than through libxml2, so that attribute values can be left
+ * as pointer/length views into the mapping. Only values containing
+ * entity or character references, or whitespace that XML normalizes
+ * to spaces, are decoded into the arena.
+ *
+ * The scanner handles the XML that configs are written in: elements,
+ * attributes, comments, processing instructions, CDATA sections and a
+ * DOCTYPE without entity declarations. Text content is skipped, as
+ * kusp_parse_xml_config() does, once its references are checked. The
+ * config is taken to be UTF-8; unlike libxml2 the scanner does not
+ * check that its bytes are valid UTF-8 or XML characters.
+ * Anything malformed is an error.
+ */
+
+struct xml_scan {
+	kusp_arena  *arena;
+	const char  *filename;
+	const char  *buf;
+	const char  *pos;
+	const char  *end;
+};
+
+static int scan_error(struct xml_scan *sc, const char *what)
+{
+	const char *p;
+	int line = 1;
+
+	for (p = sc->buf; p < sc->pos && p < sc->end; p++) {
+		if (*p == '\n')
+			line++;
+	}
+
+	printf("error: %s:%d: %s\n", sc->filename, line, what);
+
+	return -1;
+}
+
+static int scan_starts(struct xml_scan *sc, const char *str)
+{
+	size_t len = strlen(str);
+
+	return (size_t)(sc->end - sc->pos) >= len && !memcmp(sc->pos, str, len);
+}
+
+/**
+ * Move past the next @terminator.
+ */
+static int scan_past(struct xml_scan *sc, const char *terminator)
+{
+	size_t len = strlen(terminator);
+	const char *p = memmem(sc->pos, sc->end - sc->pos, terminator, len);
+
+	if (!p)
+		return scan_error(sc, "unterminated markup");
+
+	sc->pos = p + len;
+
+	return 0;
+}
+
+/**
+ * Skip whitespace, returning how much there was.
+ */
+static int scan_space(struct xml_scan *sc)
+{
+	const char *start = sc->pos;
+
+	while (sc->pos < sc->end && (*sc->pos == ' ' || *sc->pos == '\t' ||
+				     *sc->pos == '\n' || *sc->pos == '\r'))
+		sc->pos++;
+
+	return sc->pos - start;
+}
+
+static int is_name_char(unsigned char c, int first)
+{
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || 
+	    c == '_' || c == ':' || c >= 0x80)
+		return 1;
+
+	return !first && ((c >= '0' && c <= '9') || c == '-' || c == '.');
+}
+
+static int scan_name(struct xml_scan *sc, const char **name, size_t *len)
+{
+	const char *start = sc->pos;
+
+	if (sc->pos >= sc->end || !is_name_char(*sc->pos, 1))
+		return scan_error(sc, "expected a name");
+
+	while (sc->pos < sc->end && is_name_char(*sc->pos, 0))
+		sc->pos++;
+
+	*name = start;
+	*len = sc->pos - start;
+
+	return 0;
+}
+
+/**
+ * Skip the comment at the current position, which may not contain
+ * "--".
+ */
+static int scan_comment(struct xml_scan *sc)
+{
+	const char *p;
+
+	sc->pos += strlen("<!--");
+	p = memmem(sc->pos, sc->end - sc->pos, "--", 2);
+	if (!p)
+		return scan_error(sc, "unterminated comment");
+
+	sc->pos = p;
+	if (!scan_starts(sc, "-->"))
+		return scan_error(sc, "'--' in a comment");
+	sc->pos += 3;
+
+	return 0;
+}
+
+/**
+ * Skip the processing instruction at the current position. Its target
+ * may not be "xml", which only starts an XML declaration.
+ */
+static int scan_pi(struct xml_scan *sc)
+{
+	const char *name;
+	size_t len;
+
+	sc->pos += 2;
+	if (scan_name(sc, &name, &len))
+		return -1;
+
+	if (len == 3 && !strncasecmp(name, "xml", 3))
+		return scan_error(sc, "misplaced XML declaration");
+
+	return scan_past(sc, "?>");
+}
+
+/**
+ * Skip the DOCTYPE at the current position. Its internal subset may
+ * declare elements and attributes but not entities, which the scanner
+ * does not expand; kusp_parse_xml_config() rejects them too.
+ */
+static int scan_doctype(struct xml_scan *sc)
+{
+	const char *name, *p;
+	size_t len;
+	int subset = 0;
+
+	sc->pos += strlen("<!DOCTYPE");
+	if (!scan_space(sc) || scan_name(sc, &name, &len))
+		return scan_error(sc, "expected the DOCTYPE's name");
+
+	while (sc->pos < sc->end) {
+		if (*sc->pos == '"' || *sc->pos == '\'') {
+			/* literals may contain any of the markup below */
+			p = memchr(sc->pos + 1, *sc->pos, sc->end - sc->pos - 1);
+			if (!p)
+				break;
+			sc->pos = p + 1;
+		} else if (subset && scan_starts(sc, "<!--")) {
+			if (scan_comment(sc))
+				return -1;
+		} else if (subset && scan_starts(sc, "<?")) {
+			if (scan_pi(sc))
+				return -1;
+		} else if (subset && scan_starts(sc, "<!ENTITY")) {
+			return scan_error(sc, "entity declarations are not supported");
+		} else if (*sc->pos == '[' && !subset) {
+			subset = 1;
+			sc->pos++;
+		} else if (*sc->pos == ']' && subset) {
+			subset = 0;
+			sc->pos++;
+		} else if (*sc->pos == '>' && !subset) {
+			sc->pos++;
+			return 0;
+		} else {
+			sc->pos++;
+		}
+	}
+
+	return scan_error(sc, "unterminated DOCTYPE");
+}
+
+/**
+ * Skip the comments and processing instructions at the current
+ * position, and CDATA sections too if @cdata, i.e. within an element.
+ */
+static int scan_misc(struct xml_scan *sc, int cdata)
+{
+	for (;;) {
+		if (scan_starts(sc, "<!--")) {
+			if (scan_comment(sc))
+				return -1;
+		} else if (cdata && scan_starts(sc, "<![CDATA[")) {
+			if (scan_past(sc, "]]>"))
+				return -1;
+		} else if (scan_starts(sc, "<?")) {
+			if (scan_pi(sc))
+				return -1;
+		} else {
+			return 0;
+		}
+	}
+}
+
+/**
+ * Skip whitespace and any comments and processing instructions around
+ * the root element, and before it (@doctype) a DOCTYPE.
+ */
+static int scan_prolog(struct xml_scan *sc, int doctype)
+{
+	const char *last;
+
+	do {
+		scan_space(sc);
+		last = sc->pos;
+		if (scan_misc(sc, 0))
+			return -1;
+		if (doctype && scan_starts(sc, "<!DOCTYPE")) {
+			if (scan_doctype(sc))
+				return -1;
+			doctype = 0;
+		}
+	} while (sc->pos != last);
+
+	return 0;
+}
+
+/**
+ * Skip the byte order mark and XML declaration that may start the
+ * document, and the prolog before its root element.
+ */
+static int scan_start(struct xml_scan *sc)
+{
+	if (scan_starts(sc, "\xef\xbb\xbf"))
+		sc->pos += 3;
+
+	if (scan_starts(sc, "<?xml") && sc->pos + 5 < sc->end && 
+	    strchr(" \t\r\n", sc->pos[5]) && scan_past(sc, "?>"))
+		return -1;
+
+	return scan_prolog(sc, 1);
+}
+
+static void put_utf8(char **out, unsigned long cp)
+{
+	char *p = *out;
+
+	if (cp < 0x80) {
+		*p++ = cp;
+	} else if (cp < 0x800) {
+		*p++ = 0xc0 | (cp >> 6);
+		*p++ = 0x80 | (cp & 0x3f);
+	} else if (cp < 0x10000) {
+		*p++ = 0xe0 | (cp >> 12);
+		*p++ = 0x80 | ((cp >> 6) & 0x3f);
+		*p++ = 0x80 | (cp & 0x3f);
+	} else {
+		*p++ = 0xf0 | (cp >> 18);
+		*p++ = 0x80 | ((cp >> 12) & 0x3f);
+		*p++ = 0x80 | ((cp >> 6) & 0x3f);
+		*p++ = 0x80 | (cp & 0x3f);
+	}
+
+	*out = p;
+}
+
+/**
+ * Decode the entity or character reference at *@ref, which ends before
+ * @end, into *@out and move *@ref to its ';'.
+ */
+static int scan_reference(struct xml_scan *sc, const char **ref,
+			  const char *end, char **out)
+{
+	const char *p = *ref + 1, *semi;
+	unsigned long cp;
+
+	semi = memchr(p, ';', end - p);
+	if (!semi)
+		return scan_error(sc, "unterminated reference");
+
+	if (*p == '#') {
+		if (p[1] == 'x' && isxdigit((unsigned char)p[2]))
+			cp = strtoul(p + 2, (char **)&p, 16);
+		else if (isdigit((unsigned char)p[1]))
+			cp = strtoul(p + 1, (char **)&p, 10);
+		else
+			return scan_error(sc, "bad character reference");
+		/* only the characters XML allows */
+		if (p != semi || (cp < 0x20 && cp != '\t' && cp != '\n' && 
+				  cp != '\r') || (cp >= 0xd800 && cp < 0xe000) || 
+		    cp == 0xfffe || cp == 0xffff || cp > 0x10ffff)
+			return scan_error(sc, "bad character reference");
+		put_utf8(out, cp);
+	} else if (semi - p == 3 && !memcmp(p, "amp", 3)) {
+		*(*out)++ = '&';
+	} else if (semi - p == 2 && !memcmp(p, "lt", 2)) {
+		*(*out)++ = '<';
+	} else if (semi - p == 2 && !memcmp(p, "gt", 2)) {
+		*(*out)++ = '>';
+	} else if (semi - p == 4 && !memcmp(p, "quot", 4)) {
+		*(*out)++ = '"';
+	} else if (semi - p == 4 && !memcmp(p, "apos", 4)) {
+		*(*out)++ = '\'';
+	} else {
+		return scan_error(sc, "unknown entity");
+	}
+
+	*ref = semi;
+
+	return 0;
+}
+
+/**
+ * Set @attr's value to the @len raw bytes at @raw. They are used in
+ * place unless they need decoding, which never makes them longer.
+ */
+static int scan_attr_value(struct xml_scan *sc, kusp_attr *attr,
+			   const char *raw, size_t len)
+{
+	const char *p, *end = raw + len;
+	char *copy, *out;
+
+	for (p = raw; p < end; p++) {
+		if (*p == '&' || *p == '\t' || *p == '\n' || *p == '\r')
+			break;
+		if (*p == '<')
+			return scan_error(sc, "'<' in attribute value");
+	}
+
+	if (p == end) {
+		attr->value = raw;
+		attr->value_len = len;
+		return 0;
+	}
+
+	copy = out = arena_alloc(sc->arena, len + 1, 1);
+
+	for (p = raw; p < end; p++) {
+		switch (*p) {
+		case '<':
+			return scan_error(sc, "'<' in attribute value");
+		case '\r':
+			if (p + 1 < end && p[1] == '\n')
+				p++;
+			/* fall through */
+		case '\t':
+		case '\n':
+			*out++ = ' ';
+			break;
+		case '&':
+			if (scan_reference(sc, &p, end, &out))
+				return -1;
+			break;
+		default:
+			*out++ = *p;
+			break;
+		}
+	}
+
+	*out = '\0';
+	attr->value = copy;
+	attr->value_len = out - copy;
+
+	return 0;
+}
+
+/**
+ * Skip the text content up to the next '<', or the end, checking its
+ * references as kusp_parse_xml_config() does.
+ */
+static int scan_text(struct xml_scan *sc)
+{
+	const char *lt, *p;
+	char ch[4], *out;
+
+	lt = memchr(sc->pos, '<', sc->end - sc->pos);
+	if (!lt)
+		lt = sc->end;
+
+	for (p = sc->pos; (p = memchr(p, '&', lt - p)); p++) {
+		out = ch;
+		if (scan_reference(sc, &p, lt, &out))
+			return -1;
+	}
+
+	if (memmem(sc->pos, lt - sc->pos, "]]>", 3))
+		return scan_error(sc, "']]>' in text");
+
+	sc->pos = lt;
+
+	return 0;
+}
+
+/**
+ * Scan the attributes of the element whose name has just been read
+ * into @config. Returns 1 if the element closed itself with "/>".
+ *
+ * Attributes are gathered on the stack, or in a heap buffer past
+ * KUSP_INLINE_ATTRS of them, and then copied to an exactly sized
+ * array in the arena.
+ */
+static int scan_attrs(struct xml_scan *sc, kusp_config *config)
+{
+	kusp_attr local[KUSP_INLINE_ATTRS];
+	kusp_attr *attrs = local, *attr, *grown;
+	unsigned int nr_attrs = 0, max_attrs = KUSP_INLINE_ATTRS, i;
+	const char *name, *raw;
+	size_t len;
+	char quote;
+	int ret;
+
+	for (;;) {
+		len = scan_space(sc);
+
+		if (sc->pos >= sc->end) {
+			ret = scan_error(sc, "unterminated element");
+			break;
+		}
+
+		if (*sc->pos == '>') {
+			sc->pos++;
+			ret = 0;
+			break;
+		}
+
+		if (scan_starts(sc, "/>")) {
+			sc->pos += 2;
+			ret = 1;
+			break;
+		}
+
+		ret = -1;
+
+		if (!len) {
+			scan_error(sc, "expected whitespace before attribute");
+			break;
+		}
+
+		if (scan_name(sc, &name, &len))
+			break;
+
+		if (nr_attrs == max_attrs) {
+			max_attrs *= 2;
+			grown = malloc(sizeof(kusp_attr) * max_attrs);
+			if (!grown) {
+				printf("error: out of memory\n");
+				exit(-1);
+			}
+			memcpy(grown, attrs, sizeof(kusp_attr) * nr_attrs);
+			if (attrs != local)
+				free(attrs);
+			attrs = grown;
+		}
+
+		attr = &attrs[nr_attrs];
+		attr->name = kusp_arena_intern(sc->arena, name, len);
+		attr->name_len = len;
+
+		/* names are interned, larger sets are checked by the index */
+		if (nr_attrs < KUSP_INLINE_ATTRS) {
+			for (i = 0; i < nr_attrs && attrs[i].name != attr->name; i++)
+				;
+			if (i < nr_attrs) {
+				scan_error(sc, "duplicate attribute");
+				break;
+			}
+		}
+
+		scan_space(sc);
+		if (sc->pos >= sc->end || *sc->pos != '=') {
+			scan_error(sc, "expected '='");
+			break;
+		}
+		sc->pos++;
+		scan_space(sc);
+
+		if (sc->pos >= sc->end || (*sc->pos != '"' && *sc->pos != '\'')) {
+			scan_error(sc, "expected a quoted value");
+			break;
+		}
+
+		quote = *sc->pos++;
+		raw = sc->pos;
+		sc->pos = memchr(raw, quote, sc->end - raw);
+		if (!sc->pos) {
+			sc->pos = raw;
+			scan_error(sc, "unterminated attribute value");
+			break;
+		}
+
+		if (scan_attr_value(sc, attr, raw, sc->pos - raw))
+			break;
+		sc->pos++;
+
+		nr_attrs++;
+	}
+
+	if (ret >= 0 && set_attributes(sc->arena, config, attrs, nr_attrs))
+		ret = scan_error(sc, "duplicate attribute");
+
+	if (attrs != local)
+		free(attrs);
+
+	return ret;
+}
+
+/**
+ * Scan the element starting at the current '<' and everything in it.
+ */
+static int scan_element(struct xml_scan *sc, kusp_config **out)
+{
+	kusp_config *config, *child;
+	const char *name;
+	size_t len;
+	int ret;
+
+	sc->pos++;
+	if (scan_name(sc, &name, &len))
+		return -1;
+
+	config = new_config(sc->arena, kusp_arena_intern(sc->arena, name, len));
+	*out = config;
+
+	ret = scan_attrs(sc, config);
+	if (ret)
+		return ret < 0 ? -1 : 0;
+
+	for (;;) {
+		/* text content is skipped */
+		if (scan_text(sc))
+			return -1;
+		if (sc->pos == sc->end)
+			return scan_error(sc, "unterminated element");
+
+		if (scan_starts(sc, "</"))
+			break;
+
+		if (sc->pos + 1 < sc->end && 
+		    (sc->pos[1] == '!' || sc->pos[1] == '?')) {
+			name = sc->pos;
+			if (scan_misc(sc, 1))
+				return -1;
+			if (sc->pos == name)
+				return scan_error(sc, "unexpected markup");
+			continue;
+		}
+
+		if (scan_element(sc, &child))
+			return -1;
+
+		config->children = add_config(config->children, child);
+	}
+
+	sc->pos += 2;
+	if (scan_name(sc, &name, &len))
+		return -1;
+
+	if (len != strlen(config->name) || memcmp(name, config->name, len))
+		return scan_error(sc, "mismatched closing tag");
+
+	scan_space(sc);
+	if (sc->pos >= sc->end || *sc->pos != '>')
+		return scan_error(sc, "expected '>'");
+	sc->pos++;
+
+	return 0;
+}
+
+/**
+ * Parse the config file @filename like kusp_parse_xml_config(), but
+ * with attribute values pointing into a private read-only mapping of
+ * the file instead of being copied. The mapping lives as long as the
+ * config and is released by kusp_free_config().
+ */
+kusp_config* kusp_map_xml_config(char *filename)
+{
+	struct xml_scan sc;
+	struct stat st;
+	kusp_config *root = NULL;
+	kusp_arena *arena;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror(filename);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		printf("error: failed to read configuration file %s\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		perror(filename);
+		return NULL;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	arena = kusp_arena_create();
+	arena->map = map;
+	arena->map_size = st.st_size;
+	uthash_arena = arena;
+
+	sc.arena = arena;
+	sc.filename = filename;
+	sc.buf = sc.pos = map;
+	sc.end = sc.buf + st.st_size;
+
+	if (scan_start(&sc))
+		goto fail;
+
+	if (!scan_starts(&sc, "<")) {
+		scan_error(&sc, "expected the root element");
+		goto fail;
+	}
+
+	if (scan_element(&sc, &root))
+		goto fail;
+
+	if (scan_prolog(&sc, 0))
+		goto fail;
+
+	if (sc.pos != sc.end) {
+		scan_error(&sc, "content after the root element");
+		goto fail;
+	}
+
+	root = add_config(NULL, root);
+	uthash_arena = NULL;
+
+	return root;
+
+fail:
+	uthash_arena = NULL;
+	kusp_arena_destroy(arena);
+
+	return NULL;
+}
+
+
+/**
+ * Find the content of the root element of the config @filename, which
+ * the caller has mapped at @buf, and set [@start, @end) to its offsets.
+ * The root element's attributes are checked but not kept.
+ *
+ * Together with kusp_scan_xml_elements() this lets a large config be
+ * split between its root's children and the parts scanned separately.
+ */
+int kusp_xml_root_content(char *filename, const char *buf, size_t size,
+			  size_t *start, size_t *end)
+{
+	struct xml_scan sc;
+	kusp_config *root;
+	const char *p, *name;
+	size_t len;
+	int ret;
+
+	sc.arena = kusp_arena_create();
+	sc.filename = filename;
+	sc.buf = sc.pos = buf;
+	sc.end = buf + size;
+	uthash_arena = sc.arena;
+
+	ret = -1;
+	if (scan_start(&sc))
+		goto out;
+
+	if (!scan_starts(&sc, "<")) {
+		scan_error(&sc, "expected the root element");
+		goto out;
+	}
+
+	sc.pos++;
+	if (scan_name(&sc, &name, &len))
+		goto out;
+
+	root = new_config(sc.arena, kusp_arena_intern(sc.arena, name, len));
+
+	ret = scan_attrs(&sc, root);
+	if (ret < 0)
+		goto out;
+
+	*start = sc.pos - buf;
+
+	if (ret) {
+		/* <root/> */
+		*end = *start;
+		ret = scan_prolog(&sc, 0);
+		goto out;
+	}
+
+	/* the last closing tag of the root that only misc follows */
+	ret = -1;
+	for (p = sc.end; p > buf + *start; p--) {
+
+		p = memrchr(buf + *start, '<', p - (buf + *start));
+		if (!p)
+			break;
+
+		sc.pos = p;
+		if (!scan_starts(&sc, "</"))
+			continue;
+
+		sc.pos += 2;
+		if (scan_name(&sc, &name, &len) || len != strlen(root->name) || 
+		    memcmp(name, root->name, len))
+			continue;
+
+		scan_space(&sc);
+		if (!scan_starts(&sc, ">"))
+			continue;
+		sc.pos++;
+
+		if (scan_prolog(&sc, 0) || sc.pos != sc.end)
+			continue;
+
+		*end = p - buf;
+		ret = 0;
+		break;
+	}
+
+	if (ret)
+		printf("error: %s: the root element is not closed\n", filename);
+
+out:
+	uthash_arena = NULL;
+	kusp_arena_destroy(sc.arena);
+
+	return ret;
+}
+
+/**
+ * Scan the sibling elements at [@start, @end) of the config @filename,
+ * which the caller has mapped at @buf, into *@elements, a hash of
+ * nodes like the children of a node. Text between them is skipped.
+ * *@elements is NULL if there were none.
+ *
+ * Attribute values point into the caller's mapping, which must outlive
+ * the result. Each call has its own arena, so different parts of a
+ * file can be scanned by different threads.
+ */
+int kusp_scan_xml_elements(char *filename, const char *buf,
+			   size_t start, size_t end, kusp_config **elements)
+{
+	struct xml_scan sc;
+	kusp_config *child;
+	const char *last;
+
+	*elements = NULL;
+
+	sc.arena = kusp_arena_create();
+	sc.filename = filename;
+	sc.buf = buf;
+	sc.pos = buf + start;
+	sc.end = buf + end;
+	uthash_arena = sc.arena;
+
+	for (;;) {
+		if (scan_text(&sc))
+			goto fail;
+		if (sc.pos == sc.end)
+			break;
+
+		if (scan_starts(&sc, "</")) {
+			scan_error(&sc, "unexpected closing tag");
+			goto fail;
+		}
+
+		if (sc.pos + 1 < sc.end && (sc.pos[1] == '!' || sc.pos[1] == '?')) {
+			last = sc.pos;
+			if (scan_misc(&sc, 1))
+				goto fail;
+			if (sc.pos == last) {
+				scan_error(&sc, "unexpected markup");
+				goto fail;
+			}
+			continue;
+		}
+
+		if (scan_element(&sc, &child))
+			goto fail;
+
+		*elements = add_config(*elements, child);
+	}
+
+	uthash_arena = NULL;
+
+	if (!*elements)
+		kusp_arena_destroy(sc.arena);
+
+	return 0;
+
+fail:
+	uthash_arena = NULL;
+	kusp_arena_destroy(sc.arena);
+	*elements = NULL;
+
+	return -1;
+}
+
+
 kusp_config* kusp_get_node(kusp_config *node, char *node_name)
 { 
 	kusp_config *temp;
@@ -94,100 +1131,174 @@ kusp_config* kusp_get_node(kusp_config *node, char *node_name)
 
 kusp_attr* kusp_get_attr(kusp_config *node, char *attr_name)
 {
-	kusp_attr *attr;
+	kusp_attr_index *index;
+	unsigned int i;
 	
 	if (node->attributes == NULL) {
 		return NULL;
 	}
 
-	HASH_FIND_STR(node->attributes, attr_name, attr);
+	if (node->attr_index) {
+		HASH_FIND_STR(node->attr_index, attr_name, index);
+		return index ? index->attr : NULL;
+	}
 
-	return attr;
+	for (i = 0; i < node->nr_attributes; i++) {
+		if (!strcmp(node->attributes[i].name, attr_name))
+			return &node->attributes[i];
+	}
+
+	return NULL;
  }
 
 
-void kusp_dump_config(kusp_config *config, char *filename)
+/*
+ * ===============================================
+ *             Dumping
+ * ===============================================
+ *
+ * kusp_dump_config() writes the tree out directly through a buffered
+ * stream rather than building a libxml2 document of it first, so the
+ * only memory it needs beyond the tree is the stream's buffer and a
+ * stack frame per level of nesting.
+ */
+
+#define KUSP_DUMP_BUFFER_SIZE  (64 * 1024)
+#define KUSP_DUMP_INDENT       "  "
+
+/**
+ * Write the @len bytes of @str, escaping what cannot appear literally
+ * in text or, with @attr, in a double quoted attribute value.
+ */
+static void dump_escaped(FILE *fp, const char *str, size_t len, int attr)
+{
+	const char *end = str + len;
+	const char *run = str;
+
+	for (; str < end; str++) {
+		const char *esc;
+
+		switch (*str) {
+		case '&':  esc = "&amp;";  break;
+		case '<':  esc = "&lt;";   break;
+		case '>':  esc = "&gt;";   break;
+		case '"':  esc = attr ? "&quot;" : NULL; break;
+		case '\n': esc = attr ? "&#10;" : NULL;  break;
+		case '\r': esc = "&#13;";  break;
+		case '\t': esc = attr ? "&#9;" : NULL;   break;
+		default:   esc = NULL;     break;
+		}
+
+		if (!esc)
+			continue;
+
+		fwrite(run, 1, str - run, fp);
+		fputs(esc, fp);
+		run = str + 1;
+	}
+
+	fwrite(run, 1, str - run, fp);
+}
+
+static void dump_indent(FILE *fp, int level)
 {
-	xmlDocPtr doc;
-	xmlNodePtr root_node = NULL;	
-	kusp_attr *temp_attr = NULL;	
+	while (level--)
+		fputs(KUSP_DUMP_INDENT, fp);
+}
 
-	if (config == NULL) {
+static void dump_node(FILE *fp, kusp_config *node, int level)
+{
+	kusp_config *name_list, *child;
+	kusp_attr *attr;
+
+	dump_indent(fp, level);
+	fprintf(fp, "<%s", node->name);
+
+	for (attr = node->attributes; 
+	     attr < node->attributes + node->nr_attributes; attr++) {
+		fprintf(fp, " %s=\"", attr->name);
+		dump_escaped(fp, attr->value, attr->value_len, 1);
+		fputc('"', fp);
+	}
+
+	if (!node->children && !node->content) {
+		fputs("/>\n", fp);
 		return;
 	}
 
-	doc = xmlNewDoc(BAD_CAST "1.0");
-	root_node = xmlNewNode(NULL, BAD_CAST config->name);
+	fputc('>', fp);
 
+	if (node->content)
+		dump_escaped(fp, node->content, strlen(node->content), 0);
 
-	if (config->attributes != NULL)	{
-		for (temp_attr = config->attributes; temp_attr != NULL; 
-		                temp_attr = temp_attr->hh.next) {
+	if (node->children) {
+		fputc('\n', fp);
 
-			xmlNewProp(root_node, BAD_CAST temp_attr->name, 
-				  BAD_CAST temp_attr->value);
+		/* for each name at this level, each node of that name */
+		for (name_list = node->children; name_list; 
+		     name_list = name_list->hh.next) {
+			DL_FOREACH(name_list, child) {
+				dump_node(fp, child, level + 1);
+			}
 		}
+
+		dump_indent(fp, level);
 	}
-#ifdef XHASHCONF_DEBUG
-	printf("before children\n");
-#endif	/* XHASHCONF_DEBUG */
-	if (config->children != NULL) {
-#ifdef XHASHCONF_DEBUG
-		printf("decending\n");
-#endif	/* XHASHCONF_DEBUG */
-		root_node = build_xml_config(config->children, root_node);
+
+	fprintf(fp, "</%s>\n", node->name);
+}
+
+/**
+ * Write @config, and everything under it, to @filename as an XML
+ * document. Returns 0 if the whole document was written.
+ */
+int kusp_dump_config(kusp_config *config, char *filename)
+{
+	FILE *fp;
+	int ret = 0;
+
+	if (config == NULL) {
+		return -1;
 	}
 
-	xmlDocSetRootElement(doc, root_node);
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror(filename);
+		return -1;
+	}
 
-	xmlSaveFormatFileEnc(filename, doc, "UTF-8", 1);
-	xmlFreeDoc(doc);
+	setvbuf(fp, NULL, _IOFBF, KUSP_DUMP_BUFFER_SIZE);
 
-	xmlCleanupParser();
-}
+	fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", fp);
+	dump_node(fp, config, 0);
 
-void kusp_free_config(kusp_config *config)
-{
-	kusp_config *current, *temp, *inner, *inner_temp;
-	kusp_attr *attr_current, *attr_temp;
+	if (ferror(fp))
+		ret = -1;
 
-	HASH_ITER(hh, config, current, temp) {
+	if (fclose(fp))
+		ret = -1;
 
-		DL_FOREACH_SAFE(current, inner, inner_temp) {
-			if (inner->children != NULL) {
-				kusp_free_config(inner->children);
-			}
-			if (inner->attributes != NULL) {
-				HASH_ITER(hh, inner->attributes, attr_current, attr_temp) {
-					HASH_DEL(inner->attributes, attr_current);
-					free(attr_current);
-				}
-			}
-			
-			DL_DELETE(current, inner);
-			if (inner != config) {
-				free(inner);
-				inner = NULL;
-			}
-		}
+	if (ret)
+		printf("error: failed to write %s\n", filename);
 
-		if (current != NULL && current != config) {
-			HASH_DEL(config, current);
-			free(current);
-			current = NULL;
-		}
+	return ret;
+}
+
+/**
+ * Free a config returned by kusp_parse_xml_config(). Every node,
+ * attribute, string and hash table of the config was allocated from
+ * its arena, so this is a single walk over the arena's blocks.
+ */
+void kusp_free_config(kusp_config *config)
+{
+	if (config == NULL) {
+		return;
 	}
 
-	/* a side effect of HASH_CLEAR is that config is set to null, but we */
-	/* still havn't cleaned up config yet so we keep a pointer
-	 * around to it 
-	 */
-	temp = config;
-	HASH_CLEAR(hh, config);
-	free(temp);
+	kusp_arena_destroy(config->arena);
 }
 
-static kusp_config* traverse_config(xmlNode *node)
+static kusp_config* traverse_config(kusp_arena *arena, xmlNode *node)
 {
 	struct _xmlAttr *ptr = NULL;
 	xmlNode *cur = NULL;
@@ -195,6 +1306,7 @@ static kusp_config* traverse_config(xmlNode *node)
 
 	kusp_config *root_config = NULL, *config = NULL;
 	kusp_attr *attr = NULL;
+	unsigned int nr_attrs;
 
 	for (cur = node; cur; cur = cur->next) {
 		if (cur->type != XML_ELEMENT_NODE) {
@@ -202,42 +1314,65 @@ static kusp_config* traverse_config(xmlNode *node)
 			continue;
 		}
 
-		config = alloc_config(cur);
+		config = alloc_config(arena, cur);
+
+		nr_attrs = 0;
+		for (ptr = cur->properties; ptr; ptr = ptr->next) 
+			nr_attrs++;
+
+		config->attributes = nr_attrs ? 
+			kusp_arena_alloc(arena, sizeof(kusp_attr) * nr_attrs) : NULL;
+
 		for (ptr = cur->properties; ptr; ptr = ptr->next) {
-			attr = malloc(sizeof(kusp_attr));
-			strncpy(attr->name, (const char *) ptr->name, sizeof(attr->name));
+			attr = &config->attributes[config->nr_attributes++];
+			attr->name_len = strlen((const char *) ptr->name);
+			attr->name = kusp_arena_intern(arena, (const char *) ptr->name,
+						       attr->name_len);
 			
 			xChar = xmlGetProp(cur, ptr->name);
-			strncpy(attr->value,(const char *) xChar, sizeof(attr->value));
+			attr->value_len = strlen((const char *) xChar);
+			attr->value = kusp_arena_strndup(arena, (const char *) xChar,
+							 attr->value_len);
 			xmlFree(xChar);
-
-			/* add attribute to the hash table */
-			HASH_ADD_STR(config->attributes, name, attr);
 		}
 
-		config->children = traverse_config(cur->children);
+		/* libxml2 has already rejected duplicate attributes */
+		set_attributes(arena, config, config->attributes, 
+			       config->nr_attributes);
+
+		config->children = traverse_config(arena, cur->children);
 		root_config = add_config(root_config, config);
 	}
 
 	return root_config;
 }
 
-static kusp_config* alloc_config(xmlNode *node)
+static kusp_config* alloc_config(kusp_arena *arena, xmlNode *node)
 {
 	kusp_config *cur = NULL;
+	const char *name = (const char *)node->name;
 
-	cur = malloc(sizeof(kusp_config));
-
-	strncpy(cur->name, (const char*)node->name, sizeof(cur->name));
-	cur->attributes = NULL;
-
+	cur = new_config(arena, kusp_arena_intern(arena, name, strlen(name)));
 
-	cur->content = NULL;
 	if (node->content != NULL) {
-		cur->content = malloc(sizeof(char) * strlen((const char*)node->content) + 1);
-		strcpy(cur->content, (const char*) node->content);
+		cur->content = kusp_arena_strdup(arena, (const char*) node->content);
 	}
 
+	return cur;
+}
+
+static kusp_config* new_config(kusp_arena *arena, const char *name)
+{
+	kusp_config *cur = NULL;
+
+	cur = kusp_arena_alloc(arena, sizeof(kusp_config));
+	cur->arena = arena;
+
+	cur->name = name;
+	cur->attributes = NULL;
+	cur->nr_attributes = 0;
+	cur->attr_index = NULL;
+	cur->content = NULL;
 	cur->children = NULL;
 	
 	cur->next = NULL;
@@ -246,6 +1381,46 @@ static kusp_config* alloc_config(xmlNode *node)
 	return cur;
 }
 
+/**
+ * Give @config the @nr_attrs attributes at @attrs, copying them into
+ * @arena unless they are already there, and index them if there are
+ * too many to search linearly. Returns -1 if two of them share a
+ * name, which is only checked here for the indexed sets.
+ */
+static int set_attributes(kusp_arena *arena, kusp_config *config,
+			  kusp_attr *attrs, unsigned int nr_attrs)
+{
+	kusp_attr_index *index, *dup;
+	unsigned int i;
+
+	if (!nr_attrs)
+		return 0;
+
+	if (attrs != config->attributes) {
+		config->attributes = kusp_arena_alloc(arena, sizeof(kusp_attr) * nr_attrs);
+		memcpy(config->attributes, attrs, sizeof(kusp_attr) * nr_attrs);
+	}
+	config->nr_attributes = nr_attrs;
+
+	if (nr_attrs <= KUSP_INLINE_ATTRS)
+		return 0;
+
+	index = kusp_arena_alloc(arena, sizeof(kusp_attr_index) * nr_attrs);
+	for (i = 0; i < nr_attrs; i++, index++) {
+		index->attr = &config->attributes[i];
+
+		HASH_FIND(hh, config->attr_index, index->attr->name, 
+			  index->attr->name_len, dup);
+		if (dup)
+			return -1;
+
+		HASH_ADD_KEYPTR(hh, config->attr_index, index->attr->name, 
+				index->attr->name_len, index);
+	}
+
+	return 0;
+}
+
 static kusp_config* add_config(kusp_config *root, kusp_config *child)
 {
 	kusp_config *temp;
@@ -261,50 +1436,11 @@ static kusp_config* add_config(kusp_config *root, kusp_config *child)
 
 		DL_APPEND(temp, child);
 	} else {
-		HASH_ADD_STR(root, name, child);
+		HASH_ADD_KEYPTR(hh, root, child->name, strlen(child->name), child);
 		child->prev = child;
 	}
 
 	return root;
 }
 
-static xmlNodePtr build_xml_config(kusp_config *config, xmlNodePtr node)
-{
-	xmlNodePtr temp_node;
-	kusp_config *temp_config, *temp_inner_config;
-	kusp_attr *temp_attr;
-
-	for (temp_config = config; temp_config; temp_config = temp_config->hh.next) {
-
-		/* for each name at this level */
-		DL_FOREACH(temp_config, temp_inner_config) {
-
-#ifdef XHASHCONF_DEBUG
-			printf("new node: %s\n", temp_inner_config->name);
-#endif	/* XHASHCONF_DEBUG */
-			temp_node = xmlNewChild(node, NULL, 
-						BAD_CAST temp_inner_config->name, 
-						BAD_CAST temp_inner_config->content);
-
-			if (temp_inner_config->attributes == NULL) {
-				continue;
-			}
-
-			/* for every attribute */
-			for (temp_attr = temp_inner_config->attributes; temp_attr; 
-			             temp_attr = temp_attr->hh.next) {
-
-				xmlNewProp(temp_node, BAD_CAST temp_attr->name, 
-					   BAD_CAST temp_attr->value);
-			}
-
-			if (temp_inner_config->children != NULL) {
-				temp_node = build_xml_config(temp_inner_config, temp_node);
-			}
-		}
-	}
-
-	return node;
-}
-
 #endif	/* XHASHCONF_C */
@@ -4,27 +4,89 @@
 #include "uthash/utlist.h"
 #include "uthash/uthash.h"
 
-#define NODE_NAME_LENGTH 20
-#define NODE_ATTR_LENGTH 20
-#define NODE_ATTR_VALUE_LENGTH (NODE_ATTR_LENGTH * 5)
 #define PPRINT_SPACES_PER_LEVEL 4
 
-typedef struct _kusp_attr
+/*
+ * Every node, attribute and string of a parsed config is allocated
+ * from a single arena, a list of large blocks that are carved up in
+ * order and only ever freed all at once by kusp_free_config().
+ */
+#define KUSP_ARENA_BLOCK_SIZE (1024 * 1024)
+
+typedef struct _kusp_arena_block
 {
-	char name[NODE_ATTR_LENGTH];
-	char value[NODE_ATTR_VALUE_LENGTH]; 
+	struct _kusp_arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+} kusp_arena_block;
 
+/*
+ * Element and attribute names repeat on every node, so each distinct
+ * name is stored once per arena and nodes point at the shared copy.
+ */
+typedef struct _kusp_intern
+{
 	UT_hash_handle hh;
+	char str[];
+} kusp_intern;
+
+/*
+ * @map: The config file, when it was parsed by kusp_map_xml_config().
+ *       Attribute values point into it, so it is unmapped with the
+ *       arena.
+ */
+typedef struct _kusp_arena
+{
+	kusp_arena_block *blocks;
+	kusp_intern *interned; /* hash table of interned names */
+
+	void *map;
+	size_t map_size;
+} kusp_arena;
+
+
+/*
+ * @name, @name_len: Interned, see kusp_arena_intern(). The length is
+ *                   kept so that decoders need not strlen() it.
+ *
+ * @value: @value_len bytes of attribute value, of any length. It is
+ *         only NUL terminated by kusp_parse_xml_config(); configs
+ *         from kusp_map_xml_config() point straight into the file.
+ */
+typedef struct _kusp_attr
+{
+	const char *name;
+	size_t name_len;
+	const char *value;
+	size_t value_len;
 } kusp_attr;	
 
+/*
+ * A node's attributes are an array in document order, searched
+ * linearly. Only nodes with more than KUSP_INLINE_ATTRS attributes
+ * also get a hash table indexing the array.
+ */
+#define KUSP_INLINE_ATTRS 8
+
+typedef struct _kusp_attr_index
+{
+	kusp_attr *attr;
+	UT_hash_handle hh;
+} kusp_attr_index;
+
 
 typedef struct _kusp_config
 { 
-	char name[NODE_NAME_LENGTH];
+	const char *name; /* interned, see kusp_arena_intern() */
 
-	kusp_attr *attributes; /* hash table with attributes */
+	kusp_attr *attributes; /* array of nr_attributes attributes */
+	unsigned int nr_attributes;
+	kusp_attr_index *attr_index; /* NULL unless > KUSP_INLINE_ATTRS */
 	char *content; /* any text content from the xml node */
 
+	kusp_arena *arena; /* the arena this node was allocated from */
+
 
 	struct _kusp_config *children;
 
@@ -36,10 +98,23 @@ typedef struct _kusp_config
 } kusp_config;
 
 
+kusp_arena *kusp_arena_create(void);
+void *kusp_arena_alloc(kusp_arena *arena, size_t size);
+char *kusp_arena_strndup(kusp_arena *arena, const char *str, size_t len);
+char *kusp_arena_strdup(kusp_arena *arena, const char *str);
+const char *kusp_arena_intern(kusp_arena *arena, const char *str, size_t len);
+size_t kusp_arena_used(kusp_arena *arena);
+void kusp_arena_destroy(kusp_arena *arena);
+
 kusp_config *kusp_parse_xml_config(char *filename);
+kusp_config *kusp_map_xml_config(char *filename);
+int kusp_xml_root_content(char *filename, const char *buf, size_t size,
+			  size_t *start, size_t *end);
+int kusp_scan_xml_elements(char *filename, const char *buf,
+			   size_t start, size_t end, kusp_config **elements);
 kusp_attr *kusp_get_attr(kusp_config *node, char *attr_name);
 kusp_config *kusp_get_node(kusp_config *node, char *node_name);
-void kusp_dump_config(kusp_config *config, char *filename);
+int kusp_dump_config(kusp_config *config, char *filename);
 void kusp_free_config(kusp_config *config);
 void kusp_pprint_config(kusp_config *config);
 